@@ -0,0 +1,96 @@
+#!/usr/bin/env bun
+/**
+ * Packet width benchmark - renders Claude plus the default snowfall with one
+ * 4-ray packet per step and with two packets interleaved (8 rays), for each
+ * acceleration mode, and reports frame time and ray throughput.
+ *
+ *   bun run bench:packets
+ */
+
+import { join, dirname } from "path";
+import { fileURLToPath } from "url";
+import { Camera, type Vec3 } from "../camera";
+import { compileScene, getClaudeBoxes, ShapeType, BlendMode, type ObjectDef, type GroupDef } from "../scene";
+import { seededRandom } from "../scene/utils";
+import { loadWasm, setupCamera, loadScene, generateRays, binTiles, AccelMode, type WasmRenderer } from "../wasm";
+
+const WIDTH = 120;
+const HEIGHT = 60;
+const SNOW_COUNT = 30;
+const WARMUP_FRAMES = 5;
+const FRAMES = 50;
+const PACKET_WIDTHS = [4, 8];
+
+const groupDefs: GroupDef[] = [
+  { blendMode: BlendMode.HARD }, // claude
+  { blendMode: BlendMode.HARD }, // snow
+];
+
+function makeSnow(count: number): ObjectDef[] {
+  const rng = seededRandom(123);
+  const snow: ObjectDef[] = [];
+  for (let i = 0; i < count; i++) {
+    const angle = rng() * Math.PI * 2;
+    const r = Math.sqrt(rng()) * 1.5;
+    snow.push({
+      shape: { type: ShapeType.SPHERE, params: [0.025], color: [1.0, 1.0, 1.0] },
+      position: [Math.cos(angle) * r, -1.0 + rng() * 2.0, Math.sin(angle) * r],
+      group: 1,
+    });
+  }
+  return snow;
+}
+
+function renderFrames(wasm: WasmRenderer, frames: number): number {
+  const start = Bun.nanoseconds();
+  for (let i = 0; i < frames; i++) {
+    wasm.exports.march_rays();
+  }
+  return (Bun.nanoseconds() - start) / 1e6 / frames;
+}
+
+async function main() {
+  const __dirname = dirname(fileURLToPath(import.meta.url));
+  const wasm = await loadWasm(join(__dirname, "..", "wasm", "renderer.wasm"));
+
+  const camera = new Camera({ eye: [0.0, 1.0, -3.0] as Vec3, at: [0, 0, 0], up: [0, 1, 0], fov: 25 });
+  const objects = [...getClaudeBoxes([0, 0, 0], 1.0, 0), ...makeSnow(SNOW_COUNT)];
+
+  wasm.exports.set_lighting(0.4, 0.5, 0.75, -1.0, 1.0);
+  wasm.exports.set_point_lights(0);
+  wasm.exports.compute_background(0);
+
+  const modes: [string, number][] = [
+    ["linear", AccelMode.LINEAR],
+    ["bvh", AccelMode.BVH],
+    ["grid", AccelMode.GRID],
+  ];
+  console.log(`${WIDTH}x${HEIGHT}, ${objects.length} shapes, ${FRAMES} frames per row`);
+  console.log("mode".padEnd(8) + PACKET_WIDTHS.map((w) => `${w}-wide ms`.padStart(12) + `${w}-wide Mray/s`.padStart(16)).join("") + "speedup".padStart(10));
+
+  for (const [name, mode] of modes) {
+    wasm.exports.set_accel_mode(mode);
+    loadScene(wasm, compileScene(objects, groupDefs, 0.0));
+    setupCamera(wasm, camera, WIDTH, HEIGHT);
+    generateRays(wasm, WIDTH, HEIGHT);
+    binTiles(wasm);
+    wasm.exports.cone_march();
+
+    let row = name.padEnd(8);
+    const times: number[] = [];
+    for (const width of PACKET_WIDTHS) {
+      wasm.exports.set_packet_width(width);
+      renderFrames(wasm, WARMUP_FRAMES);
+      const ms = renderFrames(wasm, FRAMES);
+      times.push(ms);
+      row += ms.toFixed(2).padStart(12) + ((WIDTH * HEIGHT) / (ms * 1e3)).toFixed(2).padStart(16);
+    }
+
+    console.log(row + `${(times[0]! / times[1]!).toFixed(2)}x`.padStart(10));
+  }
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
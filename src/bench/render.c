@@ -0,0 +1,443 @@
+// Headless render benchmark, C driver - the same matrix, scene and frame
+// pipeline as render.ts, linked straight against renderer.c for the native
+// build, so it runs (and profiles with perf) without Bun. With --trace it
+// replays a scene trace recorded from main.ts (see src/wasm/trace.ts).
+//
+//   bun run bench:c
+//   src/bench/render-native --trace run.trace
+//   perf record -g src/bench/render-native && perf report
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+typedef float f32;
+
+/////////
+// API //
+/////////
+// The renderer.c exports this driver calls (see SP_API there)
+u32* get_perf_metrics_ptr(void);
+void reset_perf_metrics(void);
+u8*  get_shape_types_ptr(void);
+f32* get_shape_params_ptr(void);
+f32* get_shape_positions_ptr(void);
+f32* get_shape_colors_ptr(void);
+u8*  get_shape_groups_ptr(void);
+u8*  get_group_blend_modes_ptr(void);
+f32* get_group_glow_ptr(void);
+void set_scene(u32 count, f32 k);
+void set_groups(u32 count);
+u32  get_max_shapes(void);
+u32  reserve_shapes(u32 count);
+u32  get_shape_capacity(void);
+u32  get_max_groups(void);
+u32  get_simd_backend(void);
+f32* get_point_light_x_ptr(void);
+f32* get_point_light_y_ptr(void);
+f32* get_point_light_z_ptr(void);
+f32* get_point_light_r_ptr(void);
+f32* get_point_light_g_ptr(void);
+f32* get_point_light_b_ptr(void);
+f32* get_point_light_intensity_ptr(void);
+f32* get_point_light_radius_ptr(void);
+u32  get_max_point_lights(void);
+void set_point_lights(u32 count);
+void set_camera(f32 ex, f32 ey, f32 ez, f32 fx, f32 fy, f32 fz, f32 rx, f32 ry, f32 rz, f32 ux, f32 uy, f32 uz, f32 halfW, f32 halfH);
+void generate_rays(u32 width, u32 height);
+void bin_tiles(void);
+void cone_march(void);
+void compute_background(f32 time);
+void set_lighting(f32 ambient, f32 dir_x, f32 dir_y, f32 dir_z, f32 intensity);
+void march_rays(void);
+void set_temporal(u32 enabled);
+void composite(u32 width, u32 height);
+
+///////////////
+// CONSTANTS //
+///////////////
+// Keep in sync with render.ts
+static const u32 SIZES[][2] = {{80, 24}, {120, 40}, {200, 60}};
+static const u32 SHAPE_COUNTS[] = {32, 256, 1024};
+static const u32 LIGHT_COUNTS[] = {1, 16};
+#define BOX_COUNT 8
+#define WARMUP_FRAMES 5
+#define FRAMES 30
+#define ORBIT_STEP 0.01
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static const char* BACKEND_NAMES[] = {"WASM", "SSE41", "AVX2"};
+
+// perf_metrics_t counters of the running total, in u64 past its header;
+// keep in sync with renderer.c
+#define PERF_TOTAL 4
+#define PERF_MARCH_STEPS 0
+#define PERF_NORMAL_PASSES 1
+#define PERF_CONE_STEPS 2
+#define PERF_SHAPES_EVALUATED 4
+#define PERF_RAYS 6
+#define PERF_HITS 7
+
+// Keep in sync with trace.ts; word offsets count from after the length word,
+// as in readTrace() and TraceRecorder.record()
+#define TRACE_MAGIC 0x52545053u
+#define TRACE_VERSION 1
+#define TRACE_FIXED_WORDS 26
+#define LIGHT_FLOATS 8
+
+///////////
+// SCENE //
+///////////
+// seededRandom() from src/scene/utils.ts, including its double rounding,
+// so both drivers build the same scene
+typedef struct {
+  u32 seed;
+} rng_t;
+
+static double rng_next(rng_t* rng) {
+  double product = (double)rng->seed * 1103515245.0 + 12345.0;
+  rng->seed = (u32)(int64_t)product & 0x7fffffff;
+  return (double)rng->seed / 2147483647.0;
+}
+
+// A 2x2x2 block of boxes in a cloud of snow spheres, uploaded the way
+// loadScene() does it
+static void load_scene(u32 shapes) {
+  reserve_shapes(shapes);
+  u8* types = get_shape_types_ptr();
+  f32* params = get_shape_params_ptr();
+  f32* positions = get_shape_positions_ptr();
+  f32* colors = get_shape_colors_ptr();
+  u8* groups = get_shape_groups_ptr();
+  u8* blend_modes = get_group_blend_modes_ptr();
+
+  for (u32 i = 0; i < shapes; i++) {
+    params[i * 4] = params[i * 4 + 1] = params[i * 4 + 2] = params[i * 4 + 3] = 0.0f;
+  }
+  for (u32 i = 0; i < BOX_COUNT; i++) {
+    types[i] = 1;
+    groups[i] = 0;
+    params[i * 4] = params[i * 4 + 1] = params[i * 4 + 2] = 0.2f;
+    positions[i * 3] = i & 1 ? 0.3f : -0.3f;
+    positions[i * 3 + 1] = i & 2 ? 0.3f : -0.3f;
+    positions[i * 3 + 2] = i & 4 ? 0.3f : -0.3f;
+    colors[i * 3] = 0.85f;
+    colors[i * 3 + 1] = 0.45f;
+    colors[i * 3 + 2] = 0.3f;
+  }
+
+  rng_t rng = {123};
+  for (u32 i = BOX_COUNT; i < shapes; i++) {
+    double angle = rng_next(&rng) * M_PI * 2.0;
+    double r = sqrt(rng_next(&rng)) * 1.5;
+    types[i] = 0;
+    groups[i] = 1;
+    params[i * 4] = 0.025f;
+    positions[i * 3] = (f32)(cos(angle) * r);
+    positions[i * 3 + 1] = (f32)(-1.0 + rng_next(&rng) * 2.0);
+    positions[i * 3 + 2] = (f32)(sin(angle) * r);
+    colors[i * 3] = colors[i * 3 + 1] = colors[i * 3 + 2] = 1.0f;
+  }
+
+  blend_modes[0] = blend_modes[1] = 0;
+  set_scene(shapes, 0.0f);
+  set_groups(2);
+}
+
+static void set_lights(u32 count) {
+  rng_t rng = {7};
+  for (u32 i = 0; i < count; i++) {
+    double angle = rng_next(&rng) * M_PI * 2.0;
+    double r = 1.0 + rng_next(&rng);
+    get_point_light_x_ptr()[i] = (f32)(cos(angle) * r);
+    get_point_light_y_ptr()[i] = (f32)(-1.0 + rng_next(&rng) * 2.0);
+    get_point_light_z_ptr()[i] = (f32)(sin(angle) * r);
+    get_point_light_r_ptr()[i] = 1.0f;
+    get_point_light_g_ptr()[i] = 0.8f;
+    get_point_light_b_ptr()[i] = 0.6f;
+    get_point_light_intensity_ptr()[i] = 1.0f;
+    get_point_light_radius_ptr()[i] = 0.3f;
+  }
+  set_point_lights(count);
+}
+
+///////////
+// FRAME //
+///////////
+static void normalize3(double* v) {
+  double len = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  v[0] /= len;
+  v[1] /= len;
+  v[2] /= len;
+}
+
+static void cross3(const double* a, const double* b, double* out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// setupCamera() for the orbit render.ts uses (fov 25, looking at the origin)
+static void setup_camera(u32 frame, u32 width, u32 height) {
+  double angle = frame * ORBIT_STEP;
+  double eye[3] = {sin(angle) * 3.0, 1.0, -cos(angle) * 3.0};
+  double world_up[3] = {0.0, 1.0, 0.0};
+  double forward[3] = {-eye[0], -eye[1], -eye[2]};
+  double right[3], up[3];
+  normalize3(forward);
+  cross3(forward, world_up, right);
+  normalize3(right);
+  cross3(right, forward, up);
+
+  double half_height = tan(25.0 * M_PI / 180.0 / 2.0);
+  double half_width = half_height * ((double)width / (double)height);
+  set_camera((f32)eye[0], (f32)eye[1], (f32)eye[2],
+             (f32)forward[0], (f32)forward[1], (f32)forward[2],
+             (f32)right[0], (f32)right[1], (f32)right[2],
+             (f32)up[0], (f32)up[1], (f32)up[2],
+             (f32)half_width, (f32)half_height);
+}
+
+static void render_frame(u32 shapes, u32 frame, u32 width, u32 height) {
+  load_scene(shapes);
+  setup_camera(frame, width, height);
+  generate_rays(width, height);
+  bin_tiles();
+  cone_march();
+  march_rays();
+  composite(width, height);
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int compare_double(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Vector SDF calls of the frame: marcher steps, normal passes and cone
+// steps, one call per 4-lane packet (perfSdfCalls() in index.ts)
+static double frame_sdf_calls(const u64* perf) {
+  return (double)(perf[PERF_MARCH_STEPS] + perf[PERF_NORMAL_PASSES] + perf[PERF_CONE_STEPS]);
+}
+
+///////////
+// TRACE //
+///////////
+// A frame record of a trace, pointing into the loaded file
+typedef struct {
+  const f32* f;
+  const u32* u;
+  u32 width, height, lights, shapes, groups;
+} trace_frame_t;
+
+static u8* read_file(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return NULL;
+  fseek(file, 0, SEEK_END);
+  *size = (size_t)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  u8* data = malloc(*size + 4);
+  if (data && fread(data, 1, *size, file) != *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+// Splits a trace into frames; returns the frame count, 0 if it isn't one
+static u32 parse_trace(u8* data, size_t size, trace_frame_t** frames_out) {
+  const u32* header = (const u32*)data;
+  if (size < 8 || header[0] != TRACE_MAGIC || header[1] != TRACE_VERSION) return 0;
+
+  u32 count = 0, capacity = 64;
+  trace_frame_t* frames = malloc(capacity * sizeof(trace_frame_t));
+  size_t offset = 8;
+  while (offset + 4 <= size) {
+    u32 bytes = *(const u32*)(data + offset);
+    if (offset + 4 + bytes > size) break; // truncated last frame
+    if (count == capacity) frames = realloc(frames, (capacity *= 2) * sizeof(trace_frame_t));
+    trace_frame_t* frame = &frames[count++];
+    frame->f = (const f32*)(data + offset + 4);
+    frame->u = (const u32*)(data + offset + 4);
+    frame->width = frame->u[1];
+    frame->height = frame->u[2];
+    frame->lights = frame->u[22];
+    frame->shapes = frame->u[24];
+    frame->groups = frame->u[25];
+    offset += 4 + bytes;
+  }
+  *frames_out = frames;
+  return count;
+}
+
+// applyTraceFrame() from trace.ts, then the march and composite
+static void replay_frame(const trace_frame_t* frame) {
+  const f32* f = frame->f;
+  u32 shapes = reserve_shapes(frame->shapes) ? frame->shapes : get_shape_capacity();
+  u32 groups = frame->groups < get_max_groups() ? frame->groups : get_max_groups();
+  u32 lights = frame->lights < get_max_point_lights() ? frame->lights : get_max_point_lights();
+
+  compute_background(f[0]);
+  const f32* light = f + TRACE_FIXED_WORDS;
+  const f32* params = light + frame->lights * LIGHT_FLOATS;
+  const f32* positions = params + frame->shapes * 4;
+  const f32* colors = positions + frame->shapes * 3;
+  const f32* glow = colors + frame->shapes * 3;
+  const u8* types = (const u8*)(glow + frame->groups * 4);
+  const u8* shape_groups = types + frame->shapes;
+  const u8* blend_modes = shape_groups + frame->shapes;
+  memcpy(get_shape_types_ptr(), types, shapes);
+  memcpy(get_shape_params_ptr(), params, shapes * 4 * sizeof(f32));
+  memcpy(get_shape_positions_ptr(), positions, shapes * 3 * sizeof(f32));
+  memcpy(get_shape_colors_ptr(), colors, shapes * 3 * sizeof(f32));
+  memcpy(get_shape_groups_ptr(), shape_groups, shapes);
+  memcpy(get_group_blend_modes_ptr(), blend_modes, groups);
+  memcpy(get_group_glow_ptr(), glow, groups * 4 * sizeof(f32));
+  set_scene(shapes, f[23]);
+  set_groups(groups);
+
+  const f32* c = f + 3;
+  set_camera(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8], c[9], c[10], c[11], c[12], c[13]);
+  generate_rays(frame->width, frame->height);
+  bin_tiles();
+  cone_march();
+  set_lighting(f[17], f[18], f[19], f[20], f[21]);
+
+  f32* light_arrays[LIGHT_FLOATS] = {
+    get_point_light_x_ptr(), get_point_light_y_ptr(), get_point_light_z_ptr(),
+    get_point_light_r_ptr(), get_point_light_g_ptr(), get_point_light_b_ptr(),
+    get_point_light_intensity_ptr(), get_point_light_radius_ptr(),
+  };
+  for (u32 i = 0; i < lights; i++) {
+    for (u32 k = 0; k < LIGHT_FLOATS; k++) light_arrays[k][i] = light[i * LIGHT_FLOATS + k];
+  }
+  set_point_lights(lights);
+
+  march_rays();
+  composite(frame->width, frame->height);
+}
+
+// Replays a trace the way render.ts --trace does: the first frames warm up,
+// the rest are measured as one row
+static int bench_trace(const char* path, const char* backend_name) {
+  size_t size;
+  u8* data = read_file(path, &size);
+  trace_frame_t* frames = NULL;
+  u32 count = data ? parse_trace(data, size, &frames) : 0;
+  if (count == 0) {
+    fprintf(stderr, "%s: not a scene trace or empty\n", path);
+    return 1;
+  }
+
+  printf("backend %s, median ns/ray, fps from mean frame time\n", backend_name);
+  printf("%-9s%7s%7s%9s%9s%9s%7s%9s%7s\n", "size", "shapes", "lights", "ns/ray", "vsdf/ray", "eval/ray", "hit %", "fps", "sd %");
+  u32 warmup = count - 1 < WARMUP_FRAMES ? count - 1 : WARMUP_FRAMES;
+  u32 measured = count - warmup;
+  for (u32 f = 0; f < warmup; f++) replay_frame(&frames[f]);
+
+  const u64* perf = (const u64*)get_perf_metrics_ptr() + PERF_TOTAL;
+  double* times = malloc(measured * sizeof(double));
+  double* ns_per_ray = malloc(measured * sizeof(double));
+  double sdf_calls = 0.0, shape_evals = 0.0, hit_rate = 0.0, mean = 0.0, variance = 0.0, rays = 0.0;
+  for (u32 f = 0; f < measured; f++) {
+    const trace_frame_t* frame = &frames[warmup + f];
+    reset_perf_metrics();
+    double start = now_ns();
+    replay_frame(frame);
+    times[f] = now_ns() - start;
+    ns_per_ray[f] = times[f] / (double)(frame->width * frame->height);
+    rays += (double)(frame->width * frame->height);
+    sdf_calls += frame_sdf_calls(perf);
+    shape_evals += (double)perf[PERF_SHAPES_EVALUATED];
+    hit_rate += perf[PERF_RAYS] ? 100.0 * (double)perf[PERF_HITS] / (double)perf[PERF_RAYS] : 0.0;
+    mean += times[f];
+  }
+  mean /= measured;
+  for (u32 f = 0; f < measured; f++) variance += (times[f] - mean) * (times[f] - mean);
+  qsort(ns_per_ray, measured, sizeof(double), compare_double);
+
+  double median = measured & 1 ? ns_per_ray[measured / 2]
+                               : (ns_per_ray[measured / 2 - 1] + ns_per_ray[measured / 2]) / 2.0;
+  const trace_frame_t* first = &frames[warmup];
+  char label[16];
+  snprintf(label, sizeof(label), "%ux%u", first->width, first->height);
+  printf("trace %s, %u warm-up + %u frames\n", path, warmup, measured);
+  printf("%-9s%7u%7u%9.1f%9.2f%9.1f%7.1f%9.1f%7.1f\n", label, first->shapes, first->lights,
+         median, sdf_calls / rays, shape_evals / rays, hit_rate / measured,
+         1e9 / mean, 100.0 * sqrt(variance / measured) / mean);
+
+  free(times);
+  free(ns_per_ray);
+  free(frames);
+  free(data);
+  return 0;
+}
+
+//////////
+// MAIN //
+//////////
+int main(int argc, char** argv) {
+  u32 backend = get_simd_backend();
+  set_lighting(0.4f, 0.5f, 0.75f, -1.0f, 1.0f);
+  compute_background(0.0f);
+  set_temporal(1);
+
+  const char* backend_name = backend < COUNT_OF(BACKEND_NAMES) ? BACKEND_NAMES[backend] : "?";
+  if (argc > 2 && strcmp(argv[1], "--trace") == 0) return bench_trace(argv[2], backend_name);
+
+  printf("backend %s, %d warm-up + %d frames per row, median ns/ray, fps from mean frame time\n",
+         backend_name, WARMUP_FRAMES, FRAMES);
+  printf("%-9s%7s%7s%9s%9s%9s%7s%9s%7s\n", "size", "shapes", "lights", "ns/ray", "vsdf/ray", "eval/ray", "hit %", "fps", "sd %");
+
+  const u64* perf = (const u64*)get_perf_metrics_ptr() + PERF_TOTAL;
+  for (u32 s = 0; s < COUNT_OF(SIZES); s++) {
+    u32 width = SIZES[s][0], height = SIZES[s][1];
+    for (u32 c = 0; c < COUNT_OF(SHAPE_COUNTS); c++) {
+      u32 shapes = SHAPE_COUNTS[c] < get_max_shapes() ? SHAPE_COUNTS[c] : get_max_shapes();
+      for (u32 l = 0; l < COUNT_OF(LIGHT_COUNTS); l++) {
+        u32 lights = LIGHT_COUNTS[l] < get_max_point_lights() ? LIGHT_COUNTS[l] : get_max_point_lights();
+        set_lights(lights);
+        for (u32 f = 0; f < WARMUP_FRAMES; f++) render_frame(shapes, f, width, height);
+
+        double times[FRAMES];
+        double sdf_calls = 0.0, shape_evals = 0.0, hit_rate = 0.0, mean = 0.0, variance = 0.0;
+        for (u32 f = 0; f < FRAMES; f++) {
+          reset_perf_metrics();
+          double start = now_ns();
+          render_frame(shapes, WARMUP_FRAMES + f, width, height);
+          times[f] = now_ns() - start;
+          sdf_calls += frame_sdf_calls(perf);
+          shape_evals += (double)perf[PERF_SHAPES_EVALUATED];
+          hit_rate += perf[PERF_RAYS] ? 100.0 * (double)perf[PERF_HITS] / (double)perf[PERF_RAYS] : 0.0;
+          mean += times[f];
+        }
+        mean /= FRAMES;
+        for (u32 f = 0; f < FRAMES; f++) variance += (times[f] - mean) * (times[f] - mean);
+        qsort(times, FRAMES, sizeof(double), compare_double);
+
+        double rays = (double)(width * height);
+        double median = (times[FRAMES / 2 - 1] + times[FRAMES / 2]) / 2.0;
+        char size[16];
+        snprintf(size, sizeof(size), "%ux%u", width, height);
+        printf("%-9s%7u%7u%9.1f%9.2f%9.1f%7.1f%9.1f%7.1f\n", size, SHAPE_COUNTS[c], LIGHT_COUNTS[l],
+               median / rays, sdf_calls / FRAMES / rays, shape_evals / FRAMES / rays, hit_rate / FRAMES,
+               1e9 / mean, 100.0 * sqrt(variance / FRAMES) / mean);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,219 @@
+#!/usr/bin/env bun
+/**
+ * Headless render benchmark - runs the frame pipeline main.ts runs (scene
+ * upload, rays, tiles, cones, march, composite) over a matrix of grid sizes,
+ * shape counts and point light counts, and reports ns/ray, SDF calls/ray,
+ * hit rate and frames/sec with their spread. src/bench/render.c is the same
+ * benchmark as a C driver for the native build. With --trace it replays a
+ * scene trace recorded from main.ts (RECORD_TRACE=path) instead.
+ *
+ *   bun run bench                    (wasm)
+ *   bun run bench:native             (librenderer.so through bun:ffi)
+ *   bun run bench --trace run.trace  (a recorded run)
+ */
+
+import { join, dirname } from "path";
+import { fileURLToPath } from "url";
+import { Camera, type Vec3 } from "../camera";
+import { compileScene, ShapeType, BlendMode, type ObjectDef, type GroupDef, type FlatScene } from "../scene";
+import { seededRandom } from "../scene/utils";
+import { loadWasm, setupCamera, loadScene, generateRays, binTiles, SimdBackend, PerfCounter, PERF_TOTAL, perfCounter, perfSdfCalls, type WasmRenderer } from "../wasm";
+import { readTrace, applyTraceFrame, LIGHT_FLOATS } from "../wasm/trace";
+
+// Keep in sync with render.c
+const SIZES: [number, number][] = [[80, 24], [120, 40], [200, 60]];
+const SHAPE_COUNTS = [32, 256, 1024];
+const LIGHT_COUNTS = [1, 16];
+const BOX_COUNT = 8;
+const WARMUP_FRAMES = 5;
+const FRAMES = 30;
+const ORBIT_STEP = 0.01; // radians per frame, so temporal reprojection sees motion
+
+const groupDefs: GroupDef[] = [
+  { blendMode: BlendMode.HARD }, // boxes
+  { blendMode: BlendMode.HARD }, // snow
+];
+
+// A 2x2x2 block of boxes in a cloud of snow spheres
+function makeScene(shapes: number): FlatScene {
+  const objects: ObjectDef[] = [];
+  for (let i = 0; i < BOX_COUNT; i++) {
+    objects.push({
+      shape: { type: ShapeType.BOX, params: [0.2, 0.2, 0.2], color: [0.85, 0.45, 0.3] },
+      position: [i & 1 ? 0.3 : -0.3, i & 2 ? 0.3 : -0.3, i & 4 ? 0.3 : -0.3],
+      group: 0,
+    });
+  }
+  const rng = seededRandom(123);
+  for (let i = BOX_COUNT; i < shapes; i++) {
+    const angle = rng() * Math.PI * 2;
+    const r = Math.sqrt(rng()) * 1.5;
+    objects.push({
+      shape: { type: ShapeType.SPHERE, params: [0.025], color: [1.0, 1.0, 1.0] },
+      position: [Math.cos(angle) * r, -1.0 + rng() * 2.0, Math.sin(angle) * r],
+      group: 1,
+    });
+  }
+  return compileScene(objects, groupDefs, 0.0);
+}
+
+function setLights(wasm: WasmRenderer, count: number): void {
+  const rng = seededRandom(7);
+  for (let i = 0; i < count; i++) {
+    const angle = rng() * Math.PI * 2;
+    const r = 1.0 + rng();
+    wasm.pointLightX[i] = Math.cos(angle) * r;
+    wasm.pointLightY[i] = -1.0 + rng() * 2.0;
+    wasm.pointLightZ[i] = Math.sin(angle) * r;
+    wasm.pointLightR[i] = 1.0;
+    wasm.pointLightG[i] = 0.8;
+    wasm.pointLightB[i] = 0.6;
+    wasm.pointLightIntensity[i] = 1.0;
+    wasm.pointLightRadius[i] = 0.3;
+  }
+  wasm.exports.set_point_lights(count);
+}
+
+function renderFrame(wasm: WasmRenderer, scene: FlatScene, frame: number, width: number, height: number): void {
+  const angle = frame * ORBIT_STEP;
+  const camera = new Camera({ eye: [Math.sin(angle) * 3.0, 1.0, -Math.cos(angle) * 3.0] as Vec3, at: [0, 0, 0], up: [0, 1, 0], fov: 25 });
+  loadScene(wasm, scene);
+  setupCamera(wasm, camera, width, height);
+  generateRays(wasm, width, height);
+  binTiles(wasm);
+  wasm.exports.cone_march();
+  wasm.exports.march_rays();
+  wasm.exports.composite(width, height);
+}
+
+// Vector SDF calls and shape kernels evaluated since reset_perf_metrics()
+function frameSdfCalls(wasm: WasmRenderer): number {
+  return perfSdfCalls(wasm.perfMetrics, PERF_TOTAL);
+}
+
+function frameShapeEvals(wasm: WasmRenderer): number {
+  return perfCounter(wasm.perfMetrics, PERF_TOTAL, PerfCounter.SHAPES_EVALUATED);
+}
+
+function frameHitRate(wasm: WasmRenderer): number {
+  const rays = perfCounter(wasm.perfMetrics, PERF_TOTAL, PerfCounter.RAYS);
+  return rays > 0 ? (100 * perfCounter(wasm.perfMetrics, PERF_TOTAL, PerfCounter.HITS)) / rays : 0;
+}
+
+function median(values: number[]): number {
+  const sorted = [...values].sort((a, b) => a - b);
+  const mid = sorted.length >> 1;
+  return sorted.length & 1 ? sorted[mid]! : (sorted[mid - 1]! + sorted[mid]!) / 2;
+}
+
+// One table row from per-frame times and ray counts
+function formatRow(size: string, shapes: number, lights: number, times: number[], rays: number[], sdfCalls: number, shapeEvals: number, hitRate: number): string {
+  const frames = times.length;
+  const mean = times.reduce((a, b) => a + b, 0) / frames;
+  const stddev = Math.sqrt(times.reduce((a, t) => a + (t - mean) * (t - mean), 0) / frames);
+  const totalRays = rays.reduce((a, b) => a + b, 0);
+  return (
+    size.padEnd(9) + String(shapes).padStart(7) + String(lights).padStart(7) +
+    median(times.map((t, f) => t / rays[f]!)).toFixed(1).padStart(9) +
+    (sdfCalls / totalRays).toFixed(2).padStart(9) +
+    (shapeEvals / totalRays).toFixed(1).padStart(9) +
+    (hitRate / frames).toFixed(1).padStart(7) +
+    (1e9 / mean).toFixed(1).padStart(9) +
+    ((100 * stddev) / mean).toFixed(1).padStart(7)
+  );
+}
+
+// Replays a recorded trace: the first frames warm up, the rest are measured
+// as one row (size and counts from the first measured frame)
+function benchTrace(wasm: WasmRenderer, path: string): void {
+  const frames = readTrace(path);
+  const warmup = Math.min(WARMUP_FRAMES, frames.length - 1);
+  if (warmup < 0) throw new Error(`${path} has no frames`);
+  for (let f = 0; f < warmup; f++) {
+    applyTraceFrame(wasm, frames[f]!);
+    wasm.exports.march_rays();
+    wasm.exports.composite(frames[f]!.width, frames[f]!.height);
+  }
+
+  const times: number[] = [];
+  const rays: number[] = [];
+  let sdfCalls = 0;
+  let shapeEvals = 0;
+  let hitRate = 0;
+  for (let f = warmup; f < frames.length; f++) {
+    const frame = frames[f]!;
+    wasm.exports.reset_perf_metrics();
+    const start = Bun.nanoseconds();
+    applyTraceFrame(wasm, frame);
+    wasm.exports.march_rays();
+    wasm.exports.composite(frame.width, frame.height);
+    times.push(Bun.nanoseconds() - start);
+    rays.push(frame.width * frame.height);
+    sdfCalls += frameSdfCalls(wasm);
+    shapeEvals += frameShapeEvals(wasm);
+    hitRate += frameHitRate(wasm);
+  }
+
+  const first = frames[warmup]!;
+  console.log(`trace ${path}, ${warmup} warm-up + ${times.length} frames`);
+  console.log(formatRow(`${first.width}x${first.height}`, first.scene.count, first.lights.length / LIGHT_FLOATS, times, rays, sdfCalls, shapeEvals, hitRate));
+}
+
+async function main() {
+  const __dirname = dirname(fileURLToPath(import.meta.url));
+  const native = process.argv.includes("--native");
+  const traceArg = process.argv.indexOf("--trace");
+  const tracePath = traceArg >= 0 ? process.argv[traceArg + 1] : undefined;
+  const wasm = await loadWasm(
+    join(__dirname, "..", "wasm", "renderer.wasm"),
+    native ? join(__dirname, "..", "wasm", "librenderer.so") : undefined
+  );
+  const backend = Object.entries(SimdBackend).find(([, id]) => id === wasm.exports.get_simd_backend())?.[0] ?? "?";
+
+  wasm.exports.set_lighting(0.4, 0.5, 0.75, -1.0, 1.0);
+  wasm.exports.compute_background(0);
+  wasm.exports.set_temporal(1);
+
+  const header =
+    "size".padEnd(9) + "shapes".padStart(7) + "lights".padStart(7) + "ns/ray".padStart(9) +
+    "vsdf/ray".padStart(9) + "eval/ray".padStart(9) + "hit %".padStart(7) + "fps".padStart(9) + "sd %".padStart(7);
+  if (tracePath) {
+    console.log(`backend ${backend}, median ns/ray, fps from mean frame time`);
+    console.log(header);
+    benchTrace(wasm, tracePath);
+    return;
+  }
+
+  console.log(`backend ${backend}, ${WARMUP_FRAMES} warm-up + ${FRAMES} frames per row, median ns/ray, fps from mean frame time`);
+  console.log(header);
+
+  for (const [width, height] of SIZES) {
+    for (const shapes of SHAPE_COUNTS) {
+      const scene = makeScene(Math.min(shapes, wasm.maxShapes));
+      for (const lights of LIGHT_COUNTS) {
+        setLights(wasm, Math.min(lights, wasm.maxPointLights));
+        for (let f = 0; f < WARMUP_FRAMES; f++) renderFrame(wasm, scene, f, width, height);
+
+        const times: number[] = [];
+        let sdfCalls = 0;
+        let shapeEvals = 0;
+        let hitRate = 0;
+        for (let f = 0; f < FRAMES; f++) {
+          wasm.exports.reset_perf_metrics();
+          const start = Bun.nanoseconds();
+          renderFrame(wasm, scene, WARMUP_FRAMES + f, width, height);
+          times.push(Bun.nanoseconds() - start);
+          sdfCalls += frameSdfCalls(wasm);
+          shapeEvals += frameShapeEvals(wasm);
+          hitRate += frameHitRate(wasm);
+        }
+        console.log(formatRow(`${width}x${height}`, shapes, lights, times, Array(FRAMES).fill(width * height), sdfCalls, shapeEvals, hitRate));
+      }
+    }
+  }
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
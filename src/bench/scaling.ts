@@ -0,0 +1,98 @@
+#!/usr/bin/env bun
+/**
+ * Shape-count scaling benchmark - renders Claude plus N snowflakes with each
+ * acceleration mode and reports frame time and shapes evaluated per SDF call.
+ *
+ *   bun run bench:scaling
+ */
+
+import { join, dirname } from "path";
+import { fileURLToPath } from "url";
+import { Camera, type Vec3 } from "../camera";
+import { compileScene, getClaudeBoxes, ShapeType, BlendMode, type ObjectDef, type GroupDef } from "../scene";
+import { seededRandom } from "../scene/utils";
+import { loadWasm, setupCamera, loadScene, generateRays, binTiles, AccelMode, PerfCounter, PERF_TOTAL, perfCounter, perfSdfCalls, type WasmRenderer } from "../wasm";
+
+const WIDTH = 120;
+const HEIGHT = 60;
+const WARMUP_FRAMES = 3;
+const FRAMES = 20;
+const SHAPE_COUNTS = [16, 64, 256, 1024, 4000];
+
+const groupDefs: GroupDef[] = [
+  { blendMode: BlendMode.HARD }, // claude
+  { blendMode: BlendMode.HARD }, // snow
+];
+
+function makeSnow(count: number): ObjectDef[] {
+  const rng = seededRandom(123);
+  const snow: ObjectDef[] = [];
+  for (let i = 0; i < count; i++) {
+    const angle = rng() * Math.PI * 2;
+    const r = Math.sqrt(rng()) * 1.5;
+    snow.push({
+      shape: { type: ShapeType.SPHERE, params: [0.025], color: [1.0, 1.0, 1.0] },
+      position: [Math.cos(angle) * r, -1.0 + rng() * 2.0, Math.sin(angle) * r],
+      group: 1,
+    });
+  }
+  return snow;
+}
+
+function renderFrames(wasm: WasmRenderer, frames: number): number {
+  const start = Bun.nanoseconds();
+  for (let i = 0; i < frames; i++) {
+    wasm.exports.march_rays();
+  }
+  return (Bun.nanoseconds() - start) / 1e6 / frames;
+}
+
+async function main() {
+  const __dirname = dirname(fileURLToPath(import.meta.url));
+  const wasm = await loadWasm(join(__dirname, "..", "wasm", "renderer.wasm"));
+
+  const camera = new Camera({ eye: [0.0, 1.0, -3.0] as Vec3, at: [0, 0, 0], up: [0, 1, 0], fov: 25 });
+  const claude = getClaudeBoxes([0, 0, 0], 1.0, 0);
+
+  wasm.exports.set_lighting(0.4, 0.5, 0.75, -1.0, 1.0);
+  wasm.exports.set_point_lights(0);
+  wasm.exports.compute_background(0);
+
+  const modes: [string, number][] = [
+    ["linear", AccelMode.LINEAR],
+    ["bvh", AccelMode.BVH],
+    ["grid", AccelMode.GRID],
+  ];
+  console.log(`${WIDTH}x${HEIGHT}, ${FRAMES} frames per row`);
+  console.log("shapes".padStart(8) + modes.map(([name]) => `${name} ms`.padStart(12) + `${name} eval/sdf`.padStart(18)).join(""));
+
+  for (const snowCount of SHAPE_COUNTS) {
+    const objects = [...claude, ...makeSnow(Math.min(snowCount, wasm.maxShapes - claude.length))];
+    let row = String(objects.length).padStart(8);
+
+    for (const [, mode] of modes) {
+      wasm.exports.set_accel_mode(mode);
+      loadScene(wasm, compileScene(objects, groupDefs, 0.0));
+      setupCamera(wasm, camera, WIDTH, HEIGHT);
+      generateRays(wasm, WIDTH, HEIGHT);
+      binTiles(wasm);
+      wasm.exports.cone_march();
+
+      renderFrames(wasm, WARMUP_FRAMES);
+      wasm.exports.reset_perf_metrics();
+      const ms = renderFrames(wasm, FRAMES);
+
+      const metrics = wasm.perfMetrics;
+      const sdfCalls = perfSdfCalls(metrics, PERF_TOTAL);
+      const evaluated = sdfCalls > 0 ? perfCounter(metrics, PERF_TOTAL, PerfCounter.SHAPES_EVALUATED) / sdfCalls : 0;
+      row += ms.toFixed(2).padStart(12) + evaluated.toFixed(1).padStart(18);
+    }
+
+    console.log(row);
+  }
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -20,14 +20,12 @@ import {
   brightYellow,
   brightCyan,
 } from "@opentui/core";
-import { Camera, type Vec3, normalize, cross, sub } from "./camera";
-import { readFileSync } from "fs";
+import { Camera, type Vec3 } from "./camera";
 import { join, dirname } from "path";
 import { fileURLToPath } from "url";
 import {
   compileScene,
   getClaudeBoxes,
-  type FlatScene,
   ShapeType,
   BlendMode,
   type ObjectDef,
@@ -36,6 +34,22 @@ import {
 import { ActionQueue, easeInOutCubic, easeInQuad } from "./scene/script";
 import { DialogueExecutor, type DialogueNode } from "./scene/dialogue";
 import { seededRandom } from "./scene/utils";
+import {
+  loadWasm,
+  cameraBasis,
+  setCameraBasis,
+  loadScene,
+  generateRays,
+  binTiles,
+  PerfCounter,
+  PerfStage,
+  perfRingFrame,
+  perfCounter,
+  perfSdfCalls,
+  perfStageMs,
+} from "./wasm";
+import { loadWasmThreaded, marchFrame } from "./wasm/threads";
+import { TraceRecorder } from "./wasm/trace";
 import { checkStatsExistence, readStatsCache, postStatsToApi, invokeClaudeStats } from "./utils/stats";
 
 // =============================================================================
@@ -376,131 +390,6 @@ And now, the sandbox!`,
   },
 ];
 
-// =============================================================================
-// WASM Loading (copied from main.ts)
-// =============================================================================
-
-interface WasmExports {
-  memory: WebAssembly.Memory;
-  get_bg_ptr: () => number;
-  get_shape_types_ptr: () => number;
-  get_shape_params_ptr: () => number;
-  get_shape_positions_ptr: () => number;
-  get_shape_colors_ptr: () => number;
-  get_shape_groups_ptr: () => number;
-  get_group_blend_modes_ptr: () => number;
-  get_point_light_x_ptr: () => number;
-  get_point_light_y_ptr: () => number;
-  get_point_light_z_ptr: () => number;
-  get_point_light_r_ptr: () => number;
-  get_point_light_g_ptr: () => number;
-  get_point_light_b_ptr: () => number;
-  get_point_light_intensity_ptr: () => number;
-  get_point_light_radius_ptr: () => number;
-  get_max_point_lights: () => number;
-  set_point_lights: (count: number) => void;
-  get_perf_metrics_ptr: () => number;
-  reset_perf_metrics: () => void;
-  get_max_rays: () => number;
-  get_max_shapes: () => number;
-  get_max_groups: () => number;
-  set_scene: (count: number, smoothK: number) => void;
-  set_groups: (count: number) => void;
-  set_camera: (
-    ex: number, ey: number, ez: number,
-    fx: number, fy: number, fz: number,
-    rx: number, ry: number, rz: number,
-    ux: number, uy: number, uz: number,
-    halfW: number, halfH: number
-  ) => void;
-  generate_rays: (width: number, height: number) => void;
-  compute_background: (time: number) => void;
-  set_lighting: (ambient: number, dirX: number, dirY: number, dirZ: number, intensity: number) => void;
-  march_rays: () => void;
-  get_out_char_ptr: () => number;
-  get_out_fg_ptr: () => number;
-  get_out_bg_ptr: () => number;
-  composite: (width: number, height: number) => void;
-  composite_blocks: (width: number, height: number) => void;
-  get_upscaled_char_ptr: () => number;
-  get_upscaled_fg_ptr: () => number;
-  upscale: (nativeW: number, nativeH: number, outW: number, outH: number, scale: number) => void;
-}
-
-interface WasmRenderer {
-  exports: WasmExports;
-  maxRays: number;
-  maxShapes: number;
-  maxGroups: number;
-  maxPointLights: number;
-  bgColor: Float32Array;
-  shapeTypes: Uint8Array;
-  shapeParams: Float32Array;
-  shapePositions: Float32Array;
-  shapeColors: Float32Array;
-  shapeGroups: Uint8Array;
-  groupBlendModes: Uint8Array;
-  pointLightX: Float32Array;
-  pointLightY: Float32Array;
-  pointLightZ: Float32Array;
-  pointLightR: Float32Array;
-  pointLightG: Float32Array;
-  pointLightB: Float32Array;
-  pointLightIntensity: Float32Array;
-  pointLightRadius: Float32Array;
-  perfMetrics: Float32Array;
-  outChar: Uint32Array;
-  outFg: Float32Array;
-  outBg: Float32Array;
-  upscaledChar: Uint32Array;
-  upscaledFg: Float32Array;
-}
-
-async function loadWasm(): Promise<WasmRenderer> {
-  const __dirname = dirname(fileURLToPath(import.meta.url));
-  const wasmPath = join(__dirname, "wasm", "renderer.wasm");
-  const wasmBuffer = readFileSync(wasmPath);
-  // @ts-ignore
-  const result = await WebAssembly.instantiate(wasmBuffer, {});
-  // @ts-ignore
-  const instance = result.instance as WebAssembly.Instance;
-  const exports = instance.exports as unknown as WasmExports;
-  const memory = exports.memory;
-  const maxRays = exports.get_max_rays();
-  const maxShapes = exports.get_max_shapes();
-  const maxGroups = exports.get_max_groups();
-  const maxPointLights = exports.get_max_point_lights();
-
-  return {
-    exports,
-    maxRays,
-    maxShapes,
-    maxGroups,
-    maxPointLights,
-    bgColor: new Float32Array(memory.buffer, exports.get_bg_ptr(), 3),
-    shapeTypes: new Uint8Array(memory.buffer, exports.get_shape_types_ptr(), maxShapes),
-    shapeParams: new Float32Array(memory.buffer, exports.get_shape_params_ptr(), maxShapes * 4),
-    shapePositions: new Float32Array(memory.buffer, exports.get_shape_positions_ptr(), maxShapes * 3),
-    shapeColors: new Float32Array(memory.buffer, exports.get_shape_colors_ptr(), maxShapes * 3),
-    shapeGroups: new Uint8Array(memory.buffer, exports.get_shape_groups_ptr(), maxShapes),
-    groupBlendModes: new Uint8Array(memory.buffer, exports.get_group_blend_modes_ptr(), maxGroups),
-    pointLightX: new Float32Array(memory.buffer, exports.get_point_light_x_ptr(), maxPointLights),
-    pointLightY: new Float32Array(memory.buffer, exports.get_point_light_y_ptr(), maxPointLights),
-    pointLightZ: new Float32Array(memory.buffer, exports.get_point_light_z_ptr(), maxPointLights),
-    pointLightR: new Float32Array(memory.buffer, exports.get_point_light_r_ptr(), maxPointLights),
-    pointLightG: new Float32Array(memory.buffer, exports.get_point_light_g_ptr(), maxPointLights),
-    pointLightB: new Float32Array(memory.buffer, exports.get_point_light_b_ptr(), maxPointLights),
-    pointLightIntensity: new Float32Array(memory.buffer, exports.get_point_light_intensity_ptr(), maxPointLights),
-    pointLightRadius: new Float32Array(memory.buffer, exports.get_point_light_radius_ptr(), maxPointLights),
-    perfMetrics: new Float32Array(memory.buffer, exports.get_perf_metrics_ptr(), 16),
-    outChar: new Uint32Array(memory.buffer, exports.get_out_char_ptr(), maxRays),
-    outFg: new Float32Array(memory.buffer, exports.get_out_fg_ptr(), maxRays * 4),
-    outBg: new Float32Array(memory.buffer, exports.get_out_bg_ptr(), maxRays * 4),
-    upscaledChar: new Uint32Array(memory.buffer, exports.get_upscaled_char_ptr(), maxRays),
-    upscaledFg: new Float32Array(memory.buffer, exports.get_upscaled_fg_ptr(), maxRays * 4),
-  };
-}
-
 // =============================================================================
 // Helpers
 // =============================================================================
@@ -521,32 +410,208 @@ function sliceStyledText(styled: StyledText, maxChars: number): StyledText {
   return new StyledText(chunks);
 }
 
-function setupCamera(wasm: WasmRenderer, camera: Camera, width: number, height: number): void {
-  const forward = normalize(sub(camera.at, camera.eye));
-  const right = normalize(cross(forward, camera.up));
-  const up = cross(right, forward);
-  const aspect = width / height;
-  const fovRad = (camera.fov * Math.PI) / 180;
-  const halfHeight = Math.tan(fovRad / 2);
-  const halfWidth = halfHeight * aspect;
-  wasm.exports.set_camera(
-    camera.eye[0], camera.eye[1], camera.eye[2],
-    forward[0], forward[1], forward[2],
-    right[0], right[1], right[2],
-    up[0], up[1], up[2],
-    halfWidth, halfHeight
-  );
+// =============================================================================
+// Perf HUD
+// =============================================================================
+
+// Toggled with `p` (PERF_HUD=1 starts with it shown). It is drawn straight
+// into the canvas buffers after the frame is copied in, from state allocated
+// up front, so it adds no allocation per frame.
+const HUD_WINDOW = 240; // frame times in the percentiles, 8 s at 30 fps
+const HUD_WIDTH = 21;
+const HUD_TEXT = [0.85, 0.85, 0.85];
+const HUD_OVER = [1.0, 0.35, 0.35];
+const HUD_BG = [0.0, 0.0, 0.0];
+const HUD_STAGES: [string, number][] = [
+  ["rays ", PerfStage.RAYS], ["tiles", PerfStage.TILES],
+  ["march", PerfStage.MARCH], ["norm ", PerfStage.NORMALS],
+  ["light", PerfStage.LIGHTING], ["comp ", PerfStage.COMPOSITE],
+  ["upscl", PerfStage.UPSCALE],
+];
+// What a cell-diffing terminal renderer writes for a truecolor SGR and for a
+// cursor move
+const SGR_BYTES = 19;
+const MOVE_BYTES = 8;
+
+function sameRgb(a: Float32Array, i: number, b: Float32Array, j: number): boolean {
+  return a[i] === b[j] && a[i + 1] === b[j + 1] && a[i + 2] === b[j + 2];
 }
 
-function loadScene(wasm: WasmRenderer, scene: FlatScene): void {
-  wasm.shapeTypes.set(scene.types);
-  wasm.shapeParams.set(scene.params);
-  wasm.shapePositions.set(scene.positions);
-  wasm.shapeColors.set(scene.colors);
-  wasm.shapeGroups.set(scene.groups);
-  wasm.groupBlendModes.set(scene.groupBlendModes);
-  wasm.exports.set_scene(scene.count, scene.smoothK);
-  wasm.exports.set_groups(scene.groupCount);
+class PerfHud {
+  visible = process.env.PERF_HUD === "1";
+  private times = new Float64Array(HUD_WINDOW).fill(Infinity);
+  private sorted = new Float64Array(HUD_WINDOW);
+  private bytes = new Float64Array(HUD_WINDOW);
+  private stageMs = new Float64Array(HUD_STAGES.length);
+  private samples = 0;
+  private next = 0;
+  private prevChar = new Uint32Array(0);
+  private prevFg = new Float32Array(0);
+  private prevBg = new Float32Array(0);
+
+  // Text cursor of draw()
+  private buffers: any = null;
+  private width = 0;
+  private height = 0;
+  private col = 0;
+  private row = 0;
+  private color = HUD_TEXT;
+
+  constructor(private budgetMs: number) {}
+
+  // Records a frame that took `ms` and left the canvas in `buffers`, then
+  // draws over it
+  frame(ms: number, buffers: any, width: number, height: number, metrics: Uint32Array): void {
+    this.times[this.next] = ms;
+    this.bytes[this.next] = this.terminalBytes(buffers, width, width * height);
+    this.next = (this.next + 1) % HUD_WINDOW;
+    this.samples = Math.min(this.samples + 1, HUD_WINDOW);
+    if (this.visible) this.draw(buffers, width, height, metrics);
+  }
+
+  // Bytes a cell-diffing renderer writes for the canvas this frame: the
+  // UTF-8 char of every changed cell, an SGR wherever its fg or bg differs
+  // from the previous changed cell's, and a cursor move where a run of
+  // changed cells starts. It is modelled on the cells rather than measured
+  // on stdout, and leaves out the dialogue panel.
+  private terminalBytes(buffers: any, width: number, count: number): number {
+    const char: Uint32Array = buffers.char;
+    const fg: Float32Array = buffers.fg;
+    const bg: Float32Array = buffers.bg;
+    if (this.prevChar.length !== count) {
+      this.prevChar = new Uint32Array(count);
+      this.prevFg = new Float32Array(count * 4);
+      this.prevBg = new Float32Array(count * 4);
+    }
+    const { prevChar, prevFg, prevBg } = this;
+
+    let bytes = 0;
+    let last = -1;
+    for (let i = 0; i < count; i++) {
+      const c = i * 4;
+      const ch = char[i]!;
+      const changed = ch !== prevChar[i] || !sameRgb(fg, c, prevFg, c) || !sameRgb(bg, c, prevBg, c);
+      prevChar[i] = ch;
+      prevFg[c] = fg[c]!; prevFg[c + 1] = fg[c + 1]!; prevFg[c + 2] = fg[c + 2]!;
+      prevBg[c] = bg[c]!; prevBg[c + 1] = bg[c + 1]!; prevBg[c + 2] = bg[c + 2]!;
+      if (!changed) continue;
+
+      if (i !== last + 1 || i % width === 0) bytes += MOVE_BYTES;
+      if (last < 0 || !sameRgb(fg, c, fg, last * 4)) bytes += SGR_BYTES;
+      if (last < 0 || !sameRgb(bg, c, bg, last * 4)) bytes += SGR_BYTES;
+      bytes += ch < 0x80 ? 1 : ch < 0x800 ? 2 : ch < 0x10000 ? 3 : 4;
+      last = i;
+    }
+    return bytes;
+  }
+
+  // Nearest-rank percentile of the window; unfilled slots hold Infinity and
+  // sort past the samples
+  private percentile(p: number): number {
+    return this.sorted[Math.max(0, Math.ceil(p * this.samples) - 1)]!;
+  }
+
+  private draw(buffers: any, width: number, height: number, metrics: Uint32Array): void {
+    this.buffers = buffers;
+    this.width = width;
+    this.height = height;
+
+    this.sorted.set(this.times);
+    this.sorted.sort();
+    let bytes = 0;
+    for (let i = 0; i < HUD_WINDOW; i++) bytes += this.bytes[i]!;
+
+    // Stages and counters average over the frames the metrics ring holds
+    this.stageMs.fill(0);
+    let frames = 0;
+    let sdfCalls = 0;
+    let laneSteps = 0;
+    let rays = 0;
+    let hits = 0;
+    let misses = 0;
+    for (let frame = perfRingFrame(metrics, 0); frame >= 0; frame = perfRingFrame(metrics, ++frames)) {
+      for (let s = 0; s < HUD_STAGES.length; s++) this.stageMs[s] = this.stageMs[s]! + perfStageMs(metrics, frame, HUD_STAGES[s]![1]);
+      sdfCalls += perfSdfCalls(metrics, frame);
+      laneSteps += perfCounter(metrics, frame, PerfCounter.LANE_STEPS);
+      rays += perfCounter(metrics, frame, PerfCounter.RAYS);
+      hits += perfCounter(metrics, frame, PerfCounter.HITS);
+      misses += perfCounter(metrics, frame, PerfCounter.MISSES);
+    }
+    frames = Math.max(frames, 1);
+
+    const p50 = this.percentile(0.5);
+    const p95 = this.percentile(0.95);
+    const p99 = this.percentile(0.99);
+    this.line(0, "frame p50 ", p50, 2, p50 > this.budgetMs);
+    this.line(1, "      p95 ", p95, 2, p95 > this.budgetMs);
+    this.line(2, "      p99 ", p99, 2, p99 > this.budgetMs);
+    this.line(3, "budget    ", this.budgetMs, 2, false);
+    for (let s = 0; s < HUD_STAGES.length; s += 2) {
+      this.start(4 + (s >> 1), HUD_TEXT);
+      this.put(HUD_STAGES[s]![0]);
+      this.num(this.stageMs[s]! / frames, 5, 2);
+      if (s + 1 < HUD_STAGES.length) {
+        this.cell(32);
+        this.put(HUD_STAGES[s + 1]![0]);
+        this.num(this.stageMs[s + 1]! / frames, 5, 2);
+      }
+      this.end();
+    }
+    this.line(8, "steps/ray ", rays > 0 ? laneSteps / rays : 0, 1, false);
+    this.line(9, "hit %     ", hits + misses > 0 ? (100 * hits) / (hits + misses) : 0, 1, false);
+    this.line(10, "vsdf calls", sdfCalls / frames, 0, false);
+    this.line(11, "term bytes", bytes / Math.max(this.samples, 1), 0, false);
+  }
+
+  private line(row: number, label: string, value: number, decimals: number, over: boolean): void {
+    this.start(row, over ? HUD_OVER : HUD_TEXT);
+    this.put(label);
+    this.num(value, HUD_WIDTH - label.length, decimals);
+    this.end();
+  }
+
+  private start(row: number, color: number[]): void {
+    this.row = row;
+    this.col = 0;
+    this.color = color;
+  }
+
+  private end(): void {
+    while (this.col < HUD_WIDTH) this.cell(32);
+  }
+
+  private put(label: string): void {
+    for (let i = 0; i < label.length; i++) this.cell(label.charCodeAt(i));
+  }
+
+  // Right-aligned in `width` columns, written digit by digit
+  private num(value: number, width: number, decimals: number): void {
+    if (!Number.isFinite(value)) {
+      for (let i = 1; i < width; i++) this.cell(32);
+      this.cell(45); // "-"
+      return;
+    }
+    const scaled = Math.round(Math.max(0, value) * 10 ** decimals);
+    let digits = decimals + 1;
+    while (digits < 16 && 10 ** digits <= scaled) digits++;
+    for (let i = digits + (decimals > 0 ? 1 : 0); i < width; i++) this.cell(32);
+    for (let d = digits - 1; d >= 0; d--) {
+      this.cell(48 + (Math.floor(scaled / 10 ** d) % 10));
+      if (d === decimals && d > 0) this.cell(46); // "."
+    }
+  }
+
+  private cell(code: number): void {
+    if (this.col < this.width && this.row < this.height) {
+      const i = this.row * this.width + this.col;
+      const c = i * 4;
+      const { char, fg, bg } = this.buffers;
+      char[i] = code;
+      fg[c] = this.color[0]; fg[c + 1] = this.color[1]; fg[c + 2] = this.color[2]; fg[c + 3] = 1.0;
+      bg[c] = HUD_BG[0]; bg[c + 1] = HUD_BG[1]; bg[c + 2] = HUD_BG[2]; bg[c + 3] = 1.0;
+    }
+    this.col++;
+  }
 }
 
 // =============================================================================
@@ -554,13 +619,31 @@ function loadScene(wasm: WasmRenderer, scene: FlatScene): void {
 // =============================================================================
 
 async function main() {
-  const wasm = await loadWasm();
+  const __dirname = dirname(fileURLToPath(import.meta.url));
+  // RENDER_THREADS=n marches on n threads with the threads build
+  const threads = Number(process.env.RENDER_THREADS) || 1;
+  const workerFile = import.meta.url.endsWith(".ts") ? "worker.ts" : "worker.js";
+  const threaded = threads > 1
+    ? await loadWasmThreaded(join(__dirname, "wasm", "renderer-threads.wasm"), join(__dirname, "wasm", workerFile), threads)
+    : null;
+  // RENDER_BACKEND=native uses the native library (build:native). `start`
+  // rebuilds only the wasm module, so a library left over from an earlier
+  // build would be stale; it is never picked up on its own.
+  const nativePath = process.env.RENDER_BACKEND === "native" ? join(__dirname, "wasm", "librenderer.so") : undefined;
+  const wasm = threaded ?? await loadWasm(join(__dirname, "wasm", "renderer.wasm"), nativePath);
+  // Scripted camera moves are slow, so last frame's depth is a good warm
+  // start; the falling snow caps the starts of the rays it can reach
+  wasm.exports.set_temporal(1);
+  // RECORD_TRACE=path records every frame's renderer inputs for `bench --trace`
+  const recorder = process.env.RECORD_TRACE ? new TraceRecorder(process.env.RECORD_TRACE) : null;
 
   // Create renderer
+  const targetFps = 30;
   const renderer = await createCliRenderer({
     exitOnCtrlC: true,
-    targetFps: 30,
+    targetFps,
   });
+  const perfHud = new PerfHud(1000 / targetFps);
 
   // Layout
   const sceneWidth = Math.floor(renderer.width / 2);
@@ -724,10 +807,12 @@ async function main() {
   };
   const dramaticLightColor: Vec3 = [0.8, 0.9, 1.0];
 
-  // Snowflake point lights (dialogue-controlled intensity)
+  // Snowflake glow (dialogue-controlled intensity), accumulated by the
+  // marcher from each ray's closest approach to the snow group
   let snowLightIntensity = 0;
-  const snowLightColor: Vec3 = [0.8, 0.9, 1.0];
-  const snowLightRadius = 0.2;
+  const snowGlowColor: Vec3 = [0.8, 0.9, 1.0];
+  const snowGlowRadius = 0.15;
+  const snowGlowScale = 0.5;
 
   const dramaticLightRadius = 0.5;
 
@@ -766,7 +851,7 @@ async function main() {
     getValue: () => smoothK, setValue: (v) => { smoothK = v; },
   });
   createSliderRow({
-    id: "snow-light", label: "Snow Light", min: 0.0, max: 5.0, initial: snowLightIntensity,
+    id: "snow-light", label: "Snow Glow", min: 0.0, max: 5.0, initial: snowLightIntensity,
     getValue: () => snowLightIntensity, setValue: (v) => { snowLightIntensity = v; },
   });
 
@@ -883,6 +968,7 @@ async function main() {
   };
 
   dialogue.onExit = (code) => {
+    recorder?.close();
     renderer.stop();
     process.exit(code);
   };
@@ -914,8 +1000,14 @@ async function main() {
   process.stdin.on("data", (data) => {
     const s = data.toString();
 
+    if (s === "p") {
+      perfHud.visible = !perfHud.visible;
+      return;
+    }
+
     if (sandboxMode) {
       if (s === "q" || s === "\u0003") {
+        recorder?.close();
         renderer.stop();
         process.exit(0);
       } else if (s === "\u001b[A" || s === "k") {
@@ -968,6 +1060,7 @@ async function main() {
   let time = 0;
 
   renderer.setFrameCallback(async (deltaTime) => {
+    const frameStart = performance.now();
     const dt = deltaTime / 1000;
     time += dt;
 
@@ -1030,6 +1123,11 @@ async function main() {
     }));
 
     const allObjects = [...claudeObjects, ...snowObjects];
+    groupDefs[SNOW_GROUP]!.glow = {
+      color: snowGlowColor,
+      intensity: snowLightIntensity * snowGlowScale,
+      radius: snowGlowRadius,
+    };
     const flatScene = compileScene(allObjects, groupDefs, smoothK);
     loadScene(wasm, flatScene);
 
@@ -1040,8 +1138,11 @@ async function main() {
       fov: cameraState.fov,
     });
 
-    setupCamera(wasm, camera, sceneWidth, sceneHeight);
-    wasm.exports.generate_rays(sceneWidth, sceneHeight);
+    const basis = cameraBasis(camera, sceneWidth, sceneHeight);
+    setCameraBasis(wasm, basis);
+    generateRays(wasm, sceneWidth, sceneHeight);
+    binTiles(wasm);
+    wasm.exports.cone_march();
 
     // Directional light
     const [dx, dy, dz] = lightDirection;
@@ -1056,24 +1157,22 @@ async function main() {
     wasm.pointLightB[0] = dramaticLightColor[2];
     wasm.pointLightIntensity[0] = dramaticLight.intensity;
     wasm.pointLightRadius[0] = dramaticLightRadius;
-
-    // Snowflake point lights (indices 1-30)
-    const numSnowLights = Math.min(snowflakes.length, 30);
-    for (let i = 0; i < numSnowLights; i++) {
-      const flake = snowflakes[i]!;
-      const idx = i + 1;
-      wasm.pointLightX[idx] = flake.x;
-      wasm.pointLightY[idx] = flake.y;
-      wasm.pointLightZ[idx] = flake.z;
-      wasm.pointLightR[idx] = snowLightColor[0];
-      wasm.pointLightG[idx] = snowLightColor[1];
-      wasm.pointLightB[idx] = snowLightColor[2];
-      wasm.pointLightIntensity[idx] = snowLightIntensity;
-      wasm.pointLightRadius[idx] = snowLightRadius;
+    wasm.exports.set_point_lights(1);
+    recorder?.record(wasm, {
+      time,
+      width: sceneWidth,
+      height: sceneHeight,
+      camera: basis,
+      lighting: new Float32Array([ambientIntensity, dx, dy, dz, directionalIntensity]),
+      scene: flatScene,
+    }, 1);
+    if (threaded) {
+      marchFrame(threaded, true);
+    } else {
+      wasm.exports.march_rays();
+      wasm.exports.composite(sceneWidth, sceneHeight);
     }
-    wasm.exports.set_point_lights(1 + numSnowLights);
-    wasm.exports.march_rays();
-    wasm.exports.composite(sceneWidth, sceneHeight);
+    wasm.exports.end_perf_frame();
 
     // Copy to framebuffer
     const buffers = (canvas.frameBuffer as any).buffers;
@@ -1087,6 +1186,7 @@ async function main() {
       buffers.bg[base + 2] = bg[2];
       buffers.bg[base + 3] = 1.0;
     }
+    perfHud.frame(performance.now() - frameStart, buffers, sceneWidth, sceneHeight, wasm.perfMetrics);
   });
 
   renderer.start();
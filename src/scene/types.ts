@@ -37,8 +37,15 @@ export interface ObjectDef {
   group: number;          // group ID for hierarchical blending
 }
 
+export interface GroupGlow {
+  color: Vec3;
+  intensity: number;
+  radius: number;         // distance from the group where the glow fades out
+}
+
 export interface GroupDef {
   blendMode: number;      // BlendMode - how shapes blend within this group
+  glow?: GroupGlow;       // emissive glow around the group's shapes
 }
 
 export interface FlatScene {
@@ -48,6 +55,7 @@ export interface FlatScene {
   colors: Float32Array;    // 3 floats per shape
   groups: Uint8Array;      // group ID per shape
   groupBlendModes: Uint8Array; // blend mode per group
+  groupGlow: Float32Array;     // 4 floats per group: r, g, b (times intensity), radius
   count: number;
   groupCount: number;
   smoothK: number;
@@ -66,10 +66,18 @@ export function compileScene(
     colors[i * 3 + 2] = obj.shape.color[2];
   }
 
-  // Build group blend modes array
+  // Build group blend modes and glow arrays
   const groupBlendModes = new Uint8Array(groupDefs.length);
+  const groupGlow = new Float32Array(groupDefs.length * 4);
   for (let g = 0; g < groupDefs.length; g++) {
-    groupBlendModes[g] = groupDefs[g]!.blendMode;
+    const def = groupDefs[g]!;
+    groupBlendModes[g] = def.blendMode;
+    if (def.glow) {
+      groupGlow[g * 4] = def.glow.color[0] * def.glow.intensity;
+      groupGlow[g * 4 + 1] = def.glow.color[1] * def.glow.intensity;
+      groupGlow[g * 4 + 2] = def.glow.color[2] * def.glow.intensity;
+      groupGlow[g * 4 + 3] = def.glow.radius;
+    }
   }
 
   return {
@@ -79,6 +87,7 @@ export function compileScene(
     colors,
     groups,
     groupBlendModes,
+    groupGlow,
     count: n,
     groupCount: groupDefs.length,
     smoothK,
@@ -0,0 +1,117 @@
+/**
+ * Tests that the acceleration structures and packet widths only change how
+ * fast a frame renders: BVH, GRID and 8-wide packets must draw the frame
+ * LINEAR draws with 4-wide packets, up to a few edge cells where a
+ * culling bound moves a hit by a step. Needs renderer.wasm (bun run test
+ * builds it first).
+ */
+
+import { describe, test, expect, beforeAll } from "bun:test";
+import { join, dirname } from "path";
+import { fileURLToPath } from "url";
+import { Camera, type Vec3 } from "../camera";
+import { compileScene, getClaudeBoxes, ShapeType, BlendMode, type ObjectDef, type GroupDef, type FlatScene } from "../scene";
+import { seededRandom } from "../scene/utils";
+import { loadWasm, setupCamera, loadScene, generateRays, binTiles, AccelMode, type WasmRenderer } from "./index";
+
+// =============================================================================
+// Test Harness
+// =============================================================================
+
+const WIDTH = 96;
+const HEIGHT = 48;
+const SNOW_COUNT = 60;
+const COLOR_TOLERANCE = 0.02;
+const MAX_DIFF_FRACTION = 0.005; // of the cells, i.e. a couple dozen here
+
+const CAMERAS: Vec3[] = [[0.0, 1.0, -3.0], [-2.0, 0.5, -2.0], [1.5, -0.8, -1.5]];
+
+const groupDefs: GroupDef[] = [
+  { blendMode: BlendMode.HARD }, // claude
+  { blendMode: BlendMode.HARD }, // snow
+];
+
+function makeScene(): FlatScene {
+  const rng = seededRandom(123);
+  const objects: ObjectDef[] = [...getClaudeBoxes([0, 0, 0], 1.0, 0)];
+  for (let i = 0; i < SNOW_COUNT; i++) {
+    const angle = rng() * Math.PI * 2;
+    const r = Math.sqrt(rng()) * 1.5;
+    objects.push({
+      shape: { type: ShapeType.SPHERE, params: [0.025], color: [1.0, 1.0, 1.0] },
+      position: [Math.cos(angle) * r, -1.0 + rng() * 2.0, Math.sin(angle) * r],
+      group: 1,
+    });
+  }
+  return compileScene(objects, groupDefs, 0.0);
+}
+
+interface Frame {
+  chars: Uint32Array;
+  fg: Float32Array;
+}
+
+// One frame through the stages main.ts runs, copied out of the renderer
+function render(wasm: WasmRenderer, scene: FlatScene, eye: Vec3, mode: number, packetWidth: number): Frame {
+  wasm.exports.set_accel_mode(mode);
+  wasm.exports.set_packet_width(packetWidth);
+  loadScene(wasm, scene);
+  setupCamera(wasm, new Camera({ eye, at: [0, 0, 0], up: [0, 1, 0], fov: 25 }), WIDTH, HEIGHT);
+  generateRays(wasm, WIDTH, HEIGHT);
+  binTiles(wasm);
+  wasm.exports.cone_march();
+  wasm.exports.march_rays();
+  wasm.exports.composite(WIDTH, HEIGHT);
+  return {
+    chars: wasm.outChar.slice(0, WIDTH * HEIGHT),
+    fg: wasm.outFg.slice(0, WIDTH * HEIGHT * 4),
+  };
+}
+
+// Cells whose glyph differs or whose colour is off by more than the tolerance
+function diffCells(a: Frame, b: Frame): number {
+  let cells = 0;
+  for (let i = 0; i < WIDTH * HEIGHT; i++) {
+    let differs = a.chars[i] !== b.chars[i];
+    for (let k = 0; k < 4 && !differs; k++) {
+      differs = Math.abs(a.fg[i * 4 + k]! - b.fg[i * 4 + k]!) > COLOR_TOLERANCE;
+    }
+    if (differs) cells++;
+  }
+  return cells;
+}
+
+let wasm: WasmRenderer;
+const scene = makeScene();
+
+beforeAll(async () => {
+  const __dirname = dirname(fileURLToPath(import.meta.url));
+  wasm = await loadWasm(join(__dirname, "renderer.wasm"));
+  wasm.exports.set_lighting(0.4, 0.5, 0.75, -1.0, 1.0);
+  wasm.exports.set_point_lights(0);
+  wasm.exports.compute_background(0);
+});
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+const cases: [string, number, number][] = [
+  ["linear, 8-wide", AccelMode.LINEAR, 8],
+  ["bvh, 4-wide", AccelMode.BVH, 4],
+  ["bvh, 8-wide", AccelMode.BVH, 8],
+  ["grid, 4-wide", AccelMode.GRID, 4],
+  ["grid, 8-wide", AccelMode.GRID, 8],
+];
+
+describe("acceleration modes match linear", () => {
+  for (const [name, mode, packetWidth] of cases) {
+    test(name, () => {
+      for (const eye of CAMERAS) {
+        const reference = render(wasm, scene, eye, AccelMode.LINEAR, 4);
+        const frame = render(wasm, scene, eye, mode, packetWidth);
+        expect(diffCells(reference, frame)).toBeLessThanOrEqual(WIDTH * HEIGHT * MAX_DIFF_FRACTION);
+      }
+    });
+  }
+});
@@ -0,0 +1,402 @@
+/**
+ * WASM renderer bindings - exports, typed views over wasm memory, and upload helpers.
+ */
+
+import { existsSync, readFileSync } from "fs";
+import { type Camera, normalize, cross, sub } from "../camera";
+import type { FlatScene } from "../scene";
+
+// How scene_sdf() finds the shapes near a point; applied on the next set_scene()
+export const AccelMode = {
+  LINEAR: 0,  // every shape, culled by bounding sphere
+  BVH: 1,     // per-group bounding volume hierarchy
+  AUTO: 2,    // BVH once the scene has more than a handful of shapes
+  GRID: 3,    // world-space uniform grid over the scene bounds
+} as const;
+
+// How march_rays() steps along each ray
+export const MarchMode = {
+  SPHERE: 0,   // plain sphere tracing, one step of exactly the distance
+  RELAXED: 1,  // over-relaxed steps with a fallback and a secant hit refinement
+} as const;
+
+// Which simd.h backend the loaded build runs on (get_simd_backend())
+export const SimdBackend = {
+  WASM: 0,   // wasm simd128
+  SSE41: 1,  // native library, -msse4.1
+  AVX2: 2,   // native library, -mavx2: 8-lane kernels for packet width 8
+} as const;
+
+// perf_metrics_t (renderer.c METRICS): a header, the running total, the open
+// frame and a ring of the last frames, each frame PerfCounter counters and
+// PerfStage times in ns, all u64. perfMetrics views it as u32 words; read it
+// with perfCounter(), perfStageMs() and perfRingFrame().
+export const PERF_METRICS_VERSION = 1;
+
+export const PerfCounter = {
+  MARCH_STEPS: 0,        // vector scene_sdf() calls of the marcher
+  NORMAL_PASSES: 1,      // scene_sdf_grad() passes, one per hit packet
+  CONE_STEPS: 2,         // vector scene_sdf() calls of cone_march()
+  LIGHT_EVALS: 3,        // (packet, point light) pairs lit
+  SHAPES_EVALUATED: 4,
+  SHAPES_CULLED: 5,
+  RAYS: 6,               // rays marched
+  HITS: 7,
+  MISSES: 8,
+  TILE_SKIPS: 9,         // packets whose tiles were all empty
+  LANE_STEPS: 10,        // lanes that held a ray across marcher calls
+  WARM_RAYS: 11,
+  WARM_STEPS: 12,
+  COLD_RAYS: 13,
+  COLD_STEPS: 14,
+  MARCHES: 15,           // march_rays() calls and threaded frames
+} as const;
+
+export const PerfStage = {
+  RAYS: 0,       // generate_rays()
+  TILES: 1,      // bin_tiles() and cone_march()
+  MARCH: 2,
+  NORMALS: 3,
+  LIGHTING: 4,
+  COMPOSITE: 5,
+  UPSCALE: 6,
+} as const;
+
+const PERF_COUNTERS = 16;
+const PERF_STAGES = 7;
+const PERF_HEADER_WORDS = 8;
+const PERF_FRAME_WORDS = (PERF_COUNTERS + PERF_STAGES) * 2;
+const PERF_FRAMES_WORD = 4;
+const PERF_RING_FRAMES_WORD = 3;
+
+// Word offsets of the frames perfCounter() and perfStageMs() read
+export const PERF_TOTAL = PERF_HEADER_WORDS;
+export const PERF_OPEN_FRAME = PERF_HEADER_WORDS + PERF_FRAME_WORDS;
+
+// The frame `age` end_perf_frame() calls back (0 = the last one), or -1 if
+// the ring does not hold it
+export function perfRingFrame(metrics: Uint32Array, age: number): number {
+  const frames = metrics[PERF_FRAMES_WORD]!;
+  const ring = metrics[PERF_RING_FRAMES_WORD]!;
+  if (age >= frames || age >= ring) return -1;
+  return PERF_HEADER_WORDS + (2 + ((frames - 1 - age) % ring)) * PERF_FRAME_WORDS;
+}
+
+export function perfCounter(metrics: Uint32Array, frame: number, counter: number): number {
+  const word = frame + counter * 2;
+  return metrics[word]! + metrics[word + 1]! * 0x100000000;
+}
+
+export function perfStageMs(metrics: Uint32Array, frame: number, stage: number): number {
+  const word = frame + (PERF_COUNTERS + stage) * 2;
+  return (metrics[word]! + metrics[word + 1]! * 0x100000000) / 1e6;
+}
+
+// Vector SDF calls of a frame: marcher steps, normal passes and cone steps.
+// Each is one call over a packet of 4 lanes; SHAPES_EVALUATED counts the
+// shape kernels those calls ran.
+export function perfSdfCalls(metrics: Uint32Array, frame: number): number {
+  return (
+    perfCounter(metrics, frame, PerfCounter.MARCH_STEPS) +
+    perfCounter(metrics, frame, PerfCounter.NORMAL_PASSES) +
+    perfCounter(metrics, frame, PerfCounter.CONE_STEPS)
+  );
+}
+
+// The renderer's imports: the monotonic clock the stage times are taken
+// from (the native build reads its own)
+export const rendererImports = {
+  perf_clock_ns: () => performance.now() * 1e6,
+};
+
+// =============================================================================
+// Loading
+// =============================================================================
+
+export interface WasmExports {
+  memory: WebAssembly.Memory;
+  get_bg_ptr: () => number;
+  get_shape_types_ptr: () => number;
+  get_shape_params_ptr: () => number;
+  get_shape_positions_ptr: () => number;
+  get_shape_colors_ptr: () => number;
+  get_shape_groups_ptr: () => number;
+  get_shape_order_ptr: () => number;
+  get_group_blend_modes_ptr: () => number;
+  get_group_glow_ptr: () => number;
+  get_point_light_x_ptr: () => number;
+  get_point_light_y_ptr: () => number;
+  get_point_light_z_ptr: () => number;
+  get_point_light_r_ptr: () => number;
+  get_point_light_g_ptr: () => number;
+  get_point_light_b_ptr: () => number;
+  get_point_light_intensity_ptr: () => number;
+  get_point_light_radius_ptr: () => number;
+  get_max_point_lights: () => number;
+  set_point_lights: (count: number) => void;
+  get_perf_metrics_ptr: () => number;
+  get_perf_metrics_size: () => number;
+  reset_perf_metrics: () => void;
+  end_perf_frame: () => void;
+  get_max_rays: () => number;
+  get_max_upscaled: () => number;
+  resize_buffers: (rays: number, upscaled: number) => number;
+  get_buffer_generation: () => number;
+  get_max_shapes: () => number;
+  reserve_shapes: (count: number) => number;
+  get_shape_capacity: () => number;
+  get_max_groups: () => number;
+  set_scene: (count: number, smoothK: number) => void;
+  set_groups: (count: number) => void;
+  set_accel_mode: (mode: number) => void;
+  get_accel_mode: () => number;
+  set_march_mode: (mode: number) => void;
+  get_march_mode: () => number;
+  set_packet_width: (width: number) => void;
+  get_packet_width: () => number;
+  get_simd_backend: () => number;
+  set_camera: (
+    ex: number, ey: number, ez: number,
+    fx: number, fy: number, fz: number,
+    rx: number, ry: number, rz: number,
+    ux: number, uy: number, uz: number,
+    halfW: number, halfH: number
+  ) => void;
+  generate_rays: (width: number, height: number) => void;
+  bin_tiles: () => void;
+  cone_march: () => void;
+  compute_background: (time: number) => void;
+  set_lighting: (ambient: number, dirX: number, dirY: number, dirZ: number, intensity: number) => void;
+  march_rays: () => void;
+  shade_frame: () => void;
+  set_temporal: (enabled: number) => void;
+  get_out_char_ptr: () => number;
+  get_out_fg_ptr: () => number;
+  get_out_bg_ptr: () => number;
+  composite: (width: number, height: number) => void;
+  composite_blocks: (width: number, height: number) => void;
+  get_upscaled_char_ptr: () => number;
+  get_upscaled_fg_ptr: () => number;
+  upscale: (nativeW: number, nativeH: number, outW: number, outH: number, scale: number) => void;
+  set_threads: (count: number) => number;
+  get_thread_stack_top: (index: number) => number;
+  get_thread_tls: (index: number) => number;
+  thread_init: (index: number) => void;
+  get_work_state_ptr: () => number;
+  begin_frame_work: (composite: number) => number;
+  run_frame_work: () => void;
+  end_frame_work: () => void;
+  // Only exported by the threads build (build:wasm:threads)
+  __stack_pointer?: WebAssembly.Global;
+  __wasm_init_tls?: (ptr: number) => void;
+}
+
+// Maps a renderer pointer to the buffer and byte offset a typed view of
+// `bytes` bytes is made on. Wasm pointers are offsets into memory.buffer;
+// the native library's are process addresses (see native.ts).
+export type MapPointer = (ptr: number, bytes: number) => [ArrayBufferLike, number];
+
+export interface WasmRenderer {
+  exports: WasmExports;
+  mapPointer: MapPointer;
+  // memory.buffer and buffer generation the views below were made for
+  viewBuffer: ArrayBuffer;
+  bufferGeneration: number;
+  maxRays: number;
+  maxUpscaled: number;
+  maxShapes: number;
+  shapeCapacity: number;
+  maxGroups: number;
+  maxPointLights: number;
+  bgColor: Float32Array;
+  shapeTypes: Uint8Array;
+  shapeParams: Float32Array;
+  shapePositions: Float32Array;
+  shapeColors: Float32Array;
+  shapeGroups: Uint8Array;
+  shapeOrder: Uint16Array;
+  groupBlendModes: Uint8Array;
+  groupGlow: Float32Array;
+  pointLightX: Float32Array;
+  pointLightY: Float32Array;
+  pointLightZ: Float32Array;
+  pointLightR: Float32Array;
+  pointLightG: Float32Array;
+  pointLightB: Float32Array;
+  pointLightIntensity: Float32Array;
+  pointLightRadius: Float32Array;
+  perfMetrics: Uint32Array;
+  outChar: Uint32Array;
+  outFg: Float32Array;
+  outBg: Float32Array;
+  upscaledChar: Uint32Array;
+  upscaledFg: Float32Array;
+}
+
+// Uses the native library (build:native) instead when `nativePath` is given
+// and exists
+export async function loadWasm(wasmPath: string, nativePath?: string): Promise<WasmRenderer> {
+  if (nativePath && existsSync(nativePath)) {
+    const { loadNative } = await import("./native");
+    return loadNative(nativePath);
+  }
+  if (!existsSync(wasmPath)) {
+    throw new Error(`${wasmPath} not found; build it with bun run build:wasm`);
+  }
+  const wasmBuffer = readFileSync(wasmPath);
+  // @ts-ignore
+  const result = await WebAssembly.instantiate(wasmBuffer, { env: rendererImports });
+  // @ts-ignore
+  const instance = result.instance as WebAssembly.Instance;
+  return createRenderer(instance.exports as unknown as WasmExports);
+}
+
+export function createRenderer(exports: WasmExports, mapPointer: MapPointer = (ptr) => [exports.memory.buffer, ptr]): WasmRenderer {
+  const wasm = { exports, mapPointer, ...createViews(exports, mapPointer) };
+  if (wasm.perfMetrics[0] !== PERF_METRICS_VERSION) {
+    throw new Error(`Renderer perf metrics are version ${wasm.perfMetrics[0]}, expected ${PERF_METRICS_VERSION}; rebuild it`);
+  }
+  return wasm;
+}
+
+interface TypedArrayType<T> {
+  new (buffer: ArrayBufferLike, byteOffset: number, length: number): T;
+  BYTES_PER_ELEMENT: number;
+}
+
+function createViews(exports: WasmExports, mapPointer: MapPointer): Omit<WasmRenderer, "exports" | "mapPointer"> {
+  const memory = exports.memory;
+  const maxRays = exports.get_max_rays();
+  const maxUpscaled = exports.get_max_upscaled();
+  const maxShapes = exports.get_max_shapes();
+  const shapeCapacity = exports.get_shape_capacity();
+  const maxGroups = exports.get_max_groups();
+  const maxPointLights = exports.get_max_point_lights();
+  const view = <T>(Type: TypedArrayType<T>, ptr: number, length: number): T => {
+    const [buffer, offset] = mapPointer(ptr, length * Type.BYTES_PER_ELEMENT);
+    return new Type(buffer, offset, length);
+  };
+
+  return {
+    viewBuffer: memory.buffer,
+    bufferGeneration: exports.get_buffer_generation(),
+    maxRays,
+    maxUpscaled,
+    maxShapes,
+    shapeCapacity,
+    maxGroups,
+    maxPointLights,
+    bgColor: view(Float32Array, exports.get_bg_ptr(), 3),
+    shapeTypes: view(Uint8Array, exports.get_shape_types_ptr(), shapeCapacity),
+    shapeParams: view(Float32Array, exports.get_shape_params_ptr(), shapeCapacity * 4),
+    shapePositions: view(Float32Array, exports.get_shape_positions_ptr(), shapeCapacity * 3),
+    shapeColors: view(Float32Array, exports.get_shape_colors_ptr(), shapeCapacity * 3),
+    shapeGroups: view(Uint8Array, exports.get_shape_groups_ptr(), shapeCapacity),
+    shapeOrder: view(Uint16Array, exports.get_shape_order_ptr(), shapeCapacity),
+    groupBlendModes: view(Uint8Array, exports.get_group_blend_modes_ptr(), maxGroups),
+    groupGlow: view(Float32Array, exports.get_group_glow_ptr(), maxGroups * 4),
+    pointLightX: view(Float32Array, exports.get_point_light_x_ptr(), maxPointLights),
+    pointLightY: view(Float32Array, exports.get_point_light_y_ptr(), maxPointLights),
+    pointLightZ: view(Float32Array, exports.get_point_light_z_ptr(), maxPointLights),
+    pointLightR: view(Float32Array, exports.get_point_light_r_ptr(), maxPointLights),
+    pointLightG: view(Float32Array, exports.get_point_light_g_ptr(), maxPointLights),
+    pointLightB: view(Float32Array, exports.get_point_light_b_ptr(), maxPointLights),
+    pointLightIntensity: view(Float32Array, exports.get_point_light_intensity_ptr(), maxPointLights),
+    pointLightRadius: view(Float32Array, exports.get_point_light_radius_ptr(), maxPointLights),
+    perfMetrics: view(Uint32Array, exports.get_perf_metrics_ptr(), exports.get_perf_metrics_size() / 4),
+    outChar: view(Uint32Array, exports.get_out_char_ptr(), maxRays),
+    outFg: view(Float32Array, exports.get_out_fg_ptr(), maxRays * 4),
+    outBg: view(Float32Array, exports.get_out_bg_ptr(), maxRays * 4),
+    upscaledChar: view(Uint32Array, exports.get_upscaled_char_ptr(), maxUpscaled),
+    upscaledFg: view(Float32Array, exports.get_upscaled_fg_ptr(), maxUpscaled * 4),
+  };
+}
+
+// The shape, ray and output buffers live in an arena that resize_buffers()
+// (or generate_rays() and upscale() on a larger grid) and reserve_shapes()
+// re-carve, and growing wasm memory detaches every view. Rebuilds the views
+// when either happened; returns whether they changed.
+export function syncViews(wasm: WasmRenderer): boolean {
+  const { exports } = wasm;
+  if (wasm.viewBuffer === exports.memory.buffer && wasm.bufferGeneration === exports.get_buffer_generation()) {
+    return false;
+  }
+  Object.assign(wasm, createViews(exports, wasm.mapPointer));
+  return true;
+}
+
+// Sizes the arena for `rays` rays and an upscale() output of `upscaled`
+// cells ahead of time, so the first frame does not reallocate
+export function resizeBuffers(wasm: WasmRenderer, rays: number, upscaled: number): boolean {
+  const ok = wasm.exports.resize_buffers(rays, upscaled) !== 0;
+  syncViews(wasm);
+  return ok;
+}
+
+export function generateRays(wasm: WasmRenderer, width: number, height: number): void {
+  wasm.exports.generate_rays(width, height);
+  syncViews(wasm);
+}
+
+// upscale() grows its output buffers to the output grid like generate_rays()
+export function upscale(wasm: WasmRenderer, nativeW: number, nativeH: number, outW: number, outH: number, scale: number): void {
+  wasm.exports.upscale(nativeW, nativeH, outW, outH, scale);
+  syncViews(wasm);
+}
+
+// bin_tiles() grows the tile lists with the scene, which can grow memory
+export function binTiles(wasm: WasmRenderer): void {
+  wasm.exports.bin_tiles();
+  syncViews(wasm);
+}
+
+// =============================================================================
+// Upload
+// =============================================================================
+
+// The set_camera() arguments for a camera over a width x height grid: eye,
+// forward, right, up, half width, half height
+export function cameraBasis(camera: Camera, width: number, height: number): Float32Array {
+  const forward = normalize(sub(camera.at, camera.eye));
+  const right = normalize(cross(forward, camera.up));
+  const up = cross(right, forward);
+  const aspect = width / height;
+  const fovRad = (camera.fov * Math.PI) / 180;
+  const halfHeight = Math.tan(fovRad / 2);
+  const halfWidth = halfHeight * aspect;
+  return new Float32Array([
+    camera.eye[0], camera.eye[1], camera.eye[2],
+    forward[0], forward[1], forward[2],
+    right[0], right[1], right[2],
+    up[0], up[1], up[2],
+    halfWidth, halfHeight,
+  ]);
+}
+
+export function setCameraBasis(wasm: WasmRenderer, b: Float32Array): void {
+  wasm.exports.set_camera(b[0]!, b[1]!, b[2]!, b[3]!, b[4]!, b[5]!, b[6]!, b[7]!, b[8]!, b[9]!, b[10]!, b[11]!, b[12]!, b[13]!);
+}
+
+export function setupCamera(wasm: WasmRenderer, camera: Camera, width: number, height: number): void {
+  setCameraBasis(wasm, cameraBasis(camera, width, height));
+}
+
+// Grows the shape arrays first when the scene does not fit; that moves the
+// ray buffers too, so generateRays() follows before the next march.
+// set_scene() can grow memory for the grid lists, hence the second sync.
+export function loadScene(wasm: WasmRenderer, scene: FlatScene): void {
+  if (scene.count > wasm.shapeCapacity && !wasm.exports.reserve_shapes(scene.count)) {
+    throw new Error(`Cannot reserve memory for ${scene.count} shapes (max ${wasm.maxShapes})`);
+  }
+  syncViews(wasm);
+  wasm.shapeTypes.set(scene.types);
+  wasm.shapeParams.set(scene.params);
+  wasm.shapePositions.set(scene.positions);
+  wasm.shapeColors.set(scene.colors);
+  wasm.shapeGroups.set(scene.groups);
+  wasm.groupBlendModes.set(scene.groupBlendModes);
+  wasm.groupGlow.set(scene.groupGlow);
+  wasm.exports.set_scene(scene.count, scene.smoothK);
+  wasm.exports.set_groups(scene.groupCount);
+  syncViews(wasm);
+}
@@ -0,0 +1,94 @@
+/**
+ * Native renderer backend - renderer.c built as a shared library
+ * (build:native) and called through bun:ffi. Same exports and views as the
+ * wasm module, so everything above loadWasm() is unchanged.
+ */
+
+import { dlopen, FFIType, toArrayBuffer, type Pointer } from "bun:ffi";
+import { createRenderer, type WasmExports, type WasmRenderer } from "./index";
+
+const getter = { args: [], returns: FFIType.ptr } as const;
+const count = { args: [], returns: FFIType.u32 } as const;
+const action = { args: [], returns: FFIType.void } as const;
+const setter = { args: [FFIType.u32], returns: FFIType.void } as const;
+const size = { args: [FFIType.u32, FFIType.u32], returns: FFIType.void } as const;
+
+// Every SP_API export of renderer.c
+const symbols = {
+  get_perf_metrics_ptr: getter,
+  get_perf_metrics_size: count,
+  reset_perf_metrics: action,
+  end_perf_frame: action,
+  get_bg_ptr: getter,
+  get_shape_types_ptr: getter,
+  get_shape_params_ptr: getter,
+  get_shape_positions_ptr: getter,
+  get_shape_colors_ptr: getter,
+  get_shape_groups_ptr: getter,
+  get_shape_order_ptr: getter,
+  get_group_blend_modes_ptr: getter,
+  get_group_glow_ptr: getter,
+  set_scene: { args: [FFIType.u32, FFIType.f32], returns: FFIType.void },
+  set_groups: setter,
+  set_accel_mode: setter,
+  get_accel_mode: count,
+  set_march_mode: setter,
+  get_march_mode: count,
+  set_packet_width: setter,
+  get_packet_width: count,
+  get_simd_backend: count,
+  get_max_shapes: count,
+  reserve_shapes: { args: [FFIType.u32], returns: FFIType.u32 },
+  get_shape_capacity: count,
+  get_max_groups: count,
+  get_point_light_x_ptr: getter,
+  get_point_light_y_ptr: getter,
+  get_point_light_z_ptr: getter,
+  get_point_light_r_ptr: getter,
+  get_point_light_g_ptr: getter,
+  get_point_light_b_ptr: getter,
+  get_point_light_intensity_ptr: getter,
+  get_point_light_radius_ptr: getter,
+  get_max_point_lights: count,
+  set_point_lights: setter,
+  set_camera: { args: Array(14).fill(FFIType.f32), returns: FFIType.void },
+  generate_rays: size,
+  bin_tiles: action,
+  cone_march: action,
+  compute_background: { args: [FFIType.f32], returns: FFIType.void },
+  set_lighting: { args: Array(5).fill(FFIType.f32), returns: FFIType.void },
+  march_rays: action,
+  shade_frame: action,
+  set_temporal: setter,
+  get_max_rays: count,
+  resize_buffers: { args: [FFIType.u32, FFIType.u32], returns: FFIType.u32 },
+  get_buffer_generation: count,
+  set_threads: { args: [FFIType.u32], returns: FFIType.u32 },
+  get_thread_stack_top: { args: [FFIType.u32], returns: FFIType.ptr },
+  get_thread_tls: { args: [FFIType.u32], returns: FFIType.ptr },
+  thread_init: setter,
+  get_work_state_ptr: getter,
+  begin_frame_work: { args: [FFIType.u32], returns: FFIType.u32 },
+  run_frame_work: action,
+  end_frame_work: action,
+  get_out_char_ptr: getter,
+  get_out_fg_ptr: getter,
+  get_out_bg_ptr: getter,
+  composite: size,
+  composite_blocks: size,
+  get_upscaled_char_ptr: getter,
+  get_upscaled_fg_ptr: getter,
+  get_max_upscaled: count,
+  upscale: { args: Array(5).fill(FFIType.u32), returns: FFIType.void },
+};
+
+// Native memory is never detached or moved by growth (the arena is a fixed
+// reservation in the library), so syncViews() only follows the buffer
+// generation; this stands in for memory.buffer
+const nativeMemory = { buffer: new ArrayBuffer(0) } as WebAssembly.Memory;
+
+export function loadNative(libPath: string): WasmRenderer {
+  const lib = dlopen(libPath, symbols);
+  const exports = { ...lib.symbols, memory: nativeMemory } as unknown as WasmExports;
+  return createRenderer(exports, (ptr, bytes) => [toArrayBuffer(ptr as Pointer, 0, bytes), 0]);
+}
@@ -1,42 +1,220 @@
-#include <wasm_simd128.h>
+#include "simd.h"
+#ifndef __wasm__
+#include <time.h>
+#endif
 
 ///////////
 // TYPES //
 ///////////
+typedef unsigned long long u64;
 typedef unsigned int u32;
+typedef unsigned short u16;
 typedef unsigned char u8;
 typedef int i32;
 typedef float f32;
+typedef double f64;
+
+typedef struct {
+  f32 min[3];
+  f32 max[3];
+  u32 first;  // first entry in bvh_shape_index covered by this subtree
+  u32 count;  // shapes in this subtree; nodes with <= BVH_LEAF_SIZE are leaves
+  u32 right;  // right child (the left child always directly follows its parent)
+} bvh_node_t;
+
+// Per-lane nearest individual shape seen by one scene_sdf() evaluation,
+// ignoring blends; id is a sorted shape index. near lists every evaluated
+// shape by fold position (its sorted index, or its bvh_shape_index slot
+// with the BVH) and near_lanes the lanes whose running group distance it
+// could still change; the other shapes had no effect on that lane. glow
+// is the nearest glowing group's distance over its glow radius, and
+// glow_group that group.
+typedef struct {
+  v128_t dist;
+  v128_t id;
+  v128_t glow;
+  v128_t glow_group;
+  u16* near;
+  u8* near_lanes;
+  u32 near_count;
+} closest_shape_t;
+
+// Four point lights, one per lane, as set_point_lights() prepares them
+typedef struct {
+  v128_t x, y, z;
+  v128_t r, g, b;
+  v128_t intensity;
+  v128_t inv_radius_sq;
+  v128_t inv_reach_sq;
+} light_pack_t;
+
+// Distance and (unnormalized) gradient of an SDF at four points
+typedef struct {
+  v128_t d;
+  v128_t gx, gy, gz;
+} sdf_grad_t;
+
+// A contiguous range of sorted shapes that share a group and a type
+typedef struct {
+  u32 first;
+  u32 count;
+  u8 group;
+  u8 type;
+} shape_run_t;
+
+// Merges up to eight ascending shape lists (the grid cells or screen tiles
+// of one or two packets)
+typedef struct {
+  const u16* items;
+  u32 cur[8];
+  u32 end[8];
+  u32 lists;
+} shape_cursor_t;
+
+// Per-frame counters and stage times from marching and shading a range of
+// rays, kept on the stack and added to perf_metrics once per call
+typedef struct {
+  u32 iterations;     // vector SDF evaluations
+  u32 lane_steps;     // lanes that held a ray across those evaluations
+  u32 warm_rays;
+  u32 warm_steps;
+  u32 cold_rays;
+  u32 cold_steps;
+  u32 tile_skips;     // packets whose tiles were all empty
+  u32 hits;
+  u32 misses;
+  u32 normal_passes;  // scene_sdf_grad() passes, one per hit packet
+  u32 light_evals;    // (packet, point light) pairs lit
+  u64 march_ns;
+  u64 normals_ns;
+  u64 lighting_ns;
+  u64 composite_ns;   // composite_rows() of threaded bands
+} march_stats_t;
+
+// State of one SIMD packet of persistent marcher lanes; ray[l] is the ray
+// lane l is marching, or RAY_NONE while it waits for a refill
+typedef struct {
+  u32 ray[4];
+  v128_t ox, oy, oz, dx, dy, dz;
+  v128_t t, t_far, t_cold;
+  v128_t active, warm, fresh, steps;
+  v128_t omega, prev_radius, step_len;
+  v128_t last_t, last_dist, refine_left;
+  v128_t glow, glow_group;
+} march_lanes_t;
+
+// Shared frame state of a threaded frame; JS waits on `frame` (workers) and
+// `done` (main thread) through an Int32Array view of it
+typedef struct {
+  u32 frame;      // bumped by begin_frame_work()
+  u32 next;       // frame tag (high 16 bits) and next band to claim
+  u32 done;       // bands finished
+  u32 bands;      // bands in this frame, one row of tiles each
+  u32 warm;       // march_begin() result for the frame
+  u32 composite;  // also composite() each band
+  u32 lock;       // guards work_stats and work_shapes_*
+  u32 pad;
+} work_state_t;
 
 ///////////////
 // CONSTANTS //
 ///////////////
-#define MAX_RAYS 16384
-#define MAX_SHAPES 64
+#define RAY_NONE 0xFFFFFFFFu
+#define WASM_PAGE_SIZE 65536
+#define ARENA_ALIGN 16
+#define THREAD_STACK_SIZE (256 * 1024)
+#define WORK_STATE_WORDS 8
+#define WORK_BAND_BITS 16
+#define WORK_BAND_MASK ((1u << WORK_BAND_BITS) - 1)
+#define MAX_SHAPES 4096
+#define SHAPE_CAPACITY_STEP 64
+#define LIST_CAPACITY_STEP 1024
 #define MAX_STEPS 64
 #define MAX_DIST 100.0f
 #define HIT_THRESHOLD 0.001f
-#define NORMAL_EPS 0.001f
+#define SHADE_NEAR_MAX 8
+#define SHADE_NEAR_FULL 0xFF
+
+#define MARCH_SPHERE 0
+#define MARCH_RELAXED 1
+#define MARCH_OMEGA 1.2f
+#define MARCH_REFINE_STEPS 1
+#define MARCH_MIN_SLOPE 0.1f
 
 #define SHAPE_SPHERE 0
 #define SHAPE_BOX 1
 #define SHAPE_CYLINDER 2
 #define SHAPE_CONE 3
 #define SHAPE_CYLINDER_Y 4
-
-#define PERF_METRICS_SIZE 16
-#define PERF_TOTAL_STEPS 0
-#define PERF_TOTAL_SDF_CALLS 1
-#define PERF_NORMAL_SDF_CALLS 2
-#define PERF_COLOR_LOOKUPS 3
-#define PERF_EARLY_HITS 4
-#define PERF_MISSES 5
-#define PERF_AVG_STEPS 6
-#define PERF_HIT_RATE 7
-
-#define MAX_POINT_LIGHTS 64
+#define SHAPE_TYPE_COUNT 5
+#define MAX_SHAPE_RUNS (MAX_GROUPS * SHAPE_TYPE_COUNT)
+#define SHAPE_SPAN_MAX 32
+
+// perf_metrics_t layout; bump PERF_METRICS_VERSION with any change to it
+// or to what a counter counts (and PERF_* in index.ts)
+#define PERF_METRICS_VERSION 1
+#define PERF_RING_FRAMES 64
+
+#define PERF_MARCH_STEPS 0       // vector scene_sdf() calls of the marcher
+#define PERF_NORMAL_PASSES 1     // scene_sdf_grad() passes
+#define PERF_CONE_STEPS 2        // vector scene_sdf() calls of cone_march()
+#define PERF_LIGHT_EVALS 3       // (packet, point light) pairs lit
+#define PERF_SHAPES_EVALUATED 4  // shapes folded, per vector SDF call
+#define PERF_SHAPES_CULLED 5     // shapes skipped by bounds
+#define PERF_RAYS 6              // rays marched
+#define PERF_HITS 7              // rays shaded as hits
+#define PERF_MISSES 8            // rays shaded as background
+#define PERF_TILE_SKIPS 9        // packets whose tiles were all empty
+#define PERF_LANE_STEPS 10       // lanes that held a ray across marcher calls
+#define PERF_WARM_RAYS 11
+#define PERF_WARM_STEPS 12
+#define PERF_COLD_RAYS 13
+#define PERF_COLD_STEPS 14
+#define PERF_MARCHES 15          // march_rays() and threaded frames
+#define PERF_COUNTER_COUNT 16
+
+#define PERF_STAGE_RAYS 0        // generate_rays()
+#define PERF_STAGE_TILES 1       // bin_tiles() and cone_march()
+#define PERF_STAGE_MARCH 2       // reprojection, queueing and marching
+#define PERF_STAGE_NORMALS 3
+#define PERF_STAGE_LIGHTING 4
+#define PERF_STAGE_COMPOSITE 5   // composite() or composite_blocks()
+#define PERF_STAGE_UPSCALE 6
+#define PERF_STAGE_COUNT 7
+
+#define MAX_POINT_LIGHTS 64  // one bit each in a tile's u64 light mask
+#define POINT_LIGHT_CUTOFF 0.005f
 #define MAX_GROUPS 8
 
+#define ACCEL_LINEAR 0
+#define ACCEL_BVH 1
+#define ACCEL_AUTO 2
+#define ACCEL_GRID 3
+#define ACCEL_AUTO_BVH_THRESHOLD 128
+
+#define BVH_LEAF_SIZE 4
+#define BVH_STACK_SIZE 64
+#define BVH_NONE 0xFFFFFFFFu
+
+#define GRID_MAX_DIM 16
+#define GRID_MAX_CELLS (GRID_MAX_DIM * GRID_MAX_DIM * GRID_MAX_DIM)
+#define GRID_MAX_ENTRIES (MAX_SHAPES * 16)
+#define GRID_MARGIN 0.5f
+#define GRID_BUILD_ATTEMPTS 4
+#define CURSOR_END 0xFFFFFFFFu
+
+#define TILE_SIZE 8
+#define TILE_MAX_ENTRIES (MAX_SHAPES * 16)
+
+#define CONE_MAX_STEPS 32
+#define CONE_MIN_STEP 0.01f
+
+#define TEMPORAL_FRACTION 0.9f
+#define TEMPORAL_MAX_RATIO 1.25f
+#define TEMPORAL_REFRESH 8
+#define TEMPORAL_MAX_EYE_MOVE 0.25f
+#define TEMPORAL_MIN_FORWARD_DOT 0.99f
+
 #define RGB_AVG_DIVISOR 0.333333f
 #define BG_THRESHOLD 0.04f
 #define ASCII_RAMP_MAX_IDX 9.0f
@@ -46,7 +224,7 @@ typedef float f32;
 
 #define SQRT_ITERATIONS 5
 
-#define MAKE_F32X4(v) wasm_f32x4_const(v, v, v, v)
+#define MAKE_F32X4(v) f32x4_const(v, v, v, v)
 
 #define BLOCK_FULL  0x2588
 #define BLOCK_UPPER 0x2580
@@ -69,62 +247,206 @@ f32 point_light_intensity[MAX_POINT_LIGHTS];
 f32 point_light_radius[MAX_POINT_LIGHTS];
 u32 point_light_count = 0;
 
-v128_t pl_x_simd[MAX_POINT_LIGHTS];
-v128_t pl_y_simd[MAX_POINT_LIGHTS];
-v128_t pl_z_simd[MAX_POINT_LIGHTS];
-v128_t pl_r_simd[MAX_POINT_LIGHTS];
-v128_t pl_g_simd[MAX_POINT_LIGHTS];
-v128_t pl_b_simd[MAX_POINT_LIGHTS];
-v128_t pl_intensity_simd[MAX_POINT_LIGHTS];
-v128_t pl_radius_simd[MAX_POINT_LIGHTS];
-
-f32 ray_ox[MAX_RAYS];
-f32 ray_oy[MAX_RAYS];
-f32 ray_oz[MAX_RAYS];
-f32 ray_dx[MAX_RAYS];
-f32 ray_dy[MAX_RAYS];
-f32 ray_dz[MAX_RAYS];
-
-f32 out_r[MAX_RAYS];
-f32 out_g[MAX_RAYS];
-f32 out_b[MAX_RAYS];
-
-u32 out_char[MAX_RAYS];
-f32 out_fg[MAX_RAYS * 4];
-f32 out_bg[MAX_RAYS * 4];
-
-u32 upscaled_char[MAX_RAYS];
-f32 upscaled_fg[MAX_RAYS * 4];
+// set_point_lights() keeps only the lights that can reach POINT_LIGHT_CUTOFF,
+// transposed into packs of four: lane j of light_packs[k] is kept light
+// 4k + j. pl_source maps a kept light back to its upload index.
+light_pack_t light_packs[MAX_POINT_LIGHTS / 4];
+u8 pl_source[MAX_POINT_LIGHTS];
+f32 pl_reach[MAX_POINT_LIGHTS];
+
+// Bitmask, per screen tile, of the lights whose reach sphere projects onto
+// it; rebuilt by shade_frame() after set_point_lights(), set_camera() or
+// generate_rays()
+u8 light_tiles_valid = 0;
+u8 light_tiles_enabled = 0;
+u64* tile_lights;
+
+// Every per-ray and per-tile buffer below lives in the arena and is sized
+// by resize_buffers() (see ARENA)
+f32* ray_ox;
+f32* ray_oy;
+f32* ray_oz;
+f32* ray_dx;
+f32* ray_dy;
+f32* ray_dz;
+
+// Hit distance per ray from the last march_rays() (0 = miss), the previous
+// frame's hits reprojected into the current ray grid, and the warm start
+// distance each ray takes from them (0 = march from the scene AABB).
+// reproj_depth is dead once the starts are picked, so it shares its memory
+// with ray_t_near.
+f32* ray_depth;
+f32* reproj_depth;
+f32* ray_start;
+
+// Rays that enter the scene bounds, in screen order, and the segment of each
+// one inside them; march_queue_rays() feeds its lanes from this queue
+u32* march_queue;
+
+// Nearest shape (sorted index) at each hit, picked by the marcher's last
+// scene_sdf_closest() call and used for the hit colour
+u16* ray_shape;
+
+// Shapes that could affect the field at each hit, as closest_shape_t fold
+// positions in fold order, recorded from the same call; SHADE_NEAR_FULL
+// when there were more than SHADE_NEAR_MAX
+u16* ray_near;
+u8* ray_near_count;
+
+// Closest approach of each ray to a glowing group over the marcher's
+// samples, in units of that group's glow radius, and the group
+f32* ray_glow;
+u8* ray_glow_group;
+
+// Unit normal per hit ray, from shade_rays()' normals pass to its lighting
+// pass
+f32* ray_nx;
+f32* ray_ny;
+f32* ray_nz;
+
+// closest_shape_t near lists for the (up to two) packets of one call. Like
+// every buffer the marcher writes outside its own rays, these are per
+// thread (see THREADS): two lists of shape_capacity entries per thread,
+// by thread_index.
+u16* near_scratch;
+u8* near_lanes_scratch;
+f32* ray_t_near;
+f32* ray_t_far;
+
+f32* out_r;
+f32* out_g;
+f32* out_b;
+
+u32* out_char;
+f32* out_fg;
+f32* out_bg;
+
+// Sized separately, for upscale()'s output grid
+u32* upscaled_char;
+f32* upscaled_fg;
 
 f32 bg_color[3];
 
-u8 shape_types[MAX_SHAPES];
-f32 shape_params[MAX_SHAPES * 4];
-f32 shape_positions[MAX_SHAPES * 3];
-f32 shape_colors[MAX_SHAPES * 3];
-u8 shape_groups[MAX_SHAPES];
+// Every per-shape array below (uploads, sorted copies, bounds, BVH and the
+// grid and tile spans) lives in the arena too, sized for shape_capacity
+// shapes by reserve_shapes()
+u8* shape_types;
+f32* shape_params;
+f32* shape_positions;
+f32* shape_colors;
+u8* shape_groups;
 u32 shape_count = 0;
 f32 smooth_k = 0.5f;
 
+// set_scene() sorts the uploaded shapes by (group, type) so each pair forms
+// one contiguous run. Every per-shape array below, and every shape index
+// used inside the renderer, is in sorted order; shape_order maps a sorted
+// index back to its upload index (for colours and IDs reported to JS).
+u16* shape_order;
+u8* sorted_types;
+u8* sorted_groups;
+shape_run_t shape_runs[MAX_SHAPE_RUNS];
+u32 shape_run_count = 0;
+// shape_sort()'s (group, type) key per upload index
+u8* shape_keys;
+
+// Shapes whose type, group or AABB changed in the last set_scene(), flagged
+// per sorted index and listed; warm starts are capped at their bounds
+u8* shape_moved;
+u16* moved_shapes;
+u32 moved_count = 0;
+
 f32 scene_aabb_min[3];
 f32 scene_aabb_max[3];
 
 u8 group_blend_mode[MAX_GROUPS];
 u32 group_count = 0;
 
-v128_t shape_cx[MAX_SHAPES];
-v128_t shape_cy[MAX_SHAPES];
-v128_t shape_cz[MAX_SHAPES];
-v128_t shape_p0[MAX_SHAPES];
-v128_t shape_p1[MAX_SHAPES];
-v128_t shape_p2[MAX_SHAPES];
-v128_t shape_r[MAX_SHAPES];
-v128_t shape_g[MAX_SHAPES];
-v128_t shape_b[MAX_SHAPES];
+// Emissive glow per group as uploaded: r, g, b already scaled by the
+// intensity, then the radius. set_groups() sets bit g of glow_groups for
+// every group that glows.
+f32 group_glow[MAX_GROUPS * 4];
+u32 glow_groups = 0;
+v128_t glow_inv_radius_simd[MAX_GROUPS];
+
+v128_t* shape_cx;
+v128_t* shape_cy;
+v128_t* shape_cz;
+v128_t* shape_p0;
+v128_t* shape_p1;
+v128_t* shape_p2;
+v128_t* shape_r;
+v128_t* shape_g;
+v128_t* shape_b;
+
+// Bounding sphere per shape (center xyz, radius), for conservative culling
+f32* shape_bounds;
+v128_t* shape_bound_x;
+v128_t* shape_bound_y;
+v128_t* shape_bound_z;
+v128_t* shape_bound_r;
+f32* shape_aabb;
+
+u32 accel_mode = ACCEL_AUTO;
+u32 march_mode = MARCH_SPHERE;
+u32 packet_width = 4;
+u8 bvh_enabled = 0;
+bvh_node_t* bvh_nodes;
+u32 bvh_node_count = 0;
+u32* bvh_shape_index;
+u32 bvh_group_root[MAX_GROUPS];
+
+u8 grid_enabled = 0;
+u32 grid_dim[3];
+f32 grid_margin;
+f32 grid_min[3];
+f32 grid_cell_size[3];
+f32 grid_inv_cell_size[3];
+// The cell starts and lists are at the top of the arena, with tile_items
+u32* grid_cell_start;
+u16* grid_items;
+u8* grid_shape_span;
+
+// Screen-space shape lists per TILE_SIZE x TILE_SIZE tile, built by bin_tiles()
+u8 tiles_valid = 0;
+u32 tiles_x = 0;
+u32 tiles_y = 0;
+u32* tile_start;
+u16* tile_items;
+u16* tile_shape_span;
+
+// Per tile, the distance along the tile's rays that cone_march() proved empty
+u8 cones_valid = 0;
+f32* tile_cone_t;
+
+// Set by march_rays() for the packet being marched
+_Thread_local u8 tile_cursor_enabled = 0;
+_Thread_local shape_cursor_t tile_cursor;
 
 v128_t smooth_k_simd;
 
 u32 ray_count = 0;
+u32 ray_width = 0;
+u32 ray_height = 0;
+
+// Sizes of the arena buffers; buffer_generation changes whenever
+// resize_buffers() or reserve_shapes() moves them
+u32 shape_capacity = 0;
+u32 ray_capacity = 0;
+u32 tile_capacity = 0;
+u32 upscale_capacity = 0;
+u32 grid_item_capacity = 0;
+u32 tile_item_capacity = 0;
+u32 buffer_generation = 0;
+
+// Stack and TLS blocks of the worker threads, at the bottom of the arena
+u32 worker_count = 0;
+u32 thread_area_size = 0;
+_Thread_local u32 thread_index = 0;
+work_state_t work_state;
+march_stats_t work_stats;
+u64 work_shapes_evaluated;
+u64 work_shapes_culled;
 
 f32 cam_eye[3];
 f32 cam_forward[3];
@@ -133,7 +455,24 @@ f32 cam_up[3];
 f32 cam_half_width;
 f32 cam_half_height;
 
-f32 perf_metrics[PERF_METRICS_SIZE];
+// Camera and ray grid that produced ray_depth
+u8 temporal_enabled = 0;
+u8 depth_valid = 0;
+u32 temporal_frame = 0;
+u32 prev_ray_width = 0;
+u32 prev_ray_height = 0;
+f32 prev_cam_eye[3];
+f32 prev_cam_forward[3];
+f32 prev_cam_right[3];
+f32 prev_cam_up[3];
+f32 prev_cam_half_width;
+f32 prev_cam_half_height;
+
+// Per thread: shape counts of the scene_sdf() calls since the last
+// perf_flush(); workers fold theirs into work_shapes_* at the end of each
+// band (see THREADS)
+_Thread_local u64 perf_shapes_evaluated;
+_Thread_local u64 perf_shapes_culled;
 
 v128_t max_dist_simd;
 v128_t light_x_simd;
@@ -152,34 +491,151 @@ f32    sqrtf_approx(f32 x);
 f32    sinf_approx(f32 x);
 f32    maxf(f32 a, f32 b);
 f32    minf(f32 a, f32 b);
+u32    minu(u32 a, u32 b);
+u8*    arena_start(void);
+u8     arena_reserve(u32 bytes);
+void*  arena_take(u32* used, u32 bytes);
+u32    carve_buffers(u32 shapes, u32 rays, u32 tiles, u32 upscaled);
+u32    relayout_arena(u32 shapes, u32 rays, u32 tiles, u32 upscaled);
+u8     reserve_lists(u32 grid, u32 tile);
+u32    thread_tls_size(void);
+void   work_lock(void);
+void   work_unlock(void);
 f32    clampf(f32 x, f32 lo, f32 hi);
+f32    cbrtf_approx(f32 x);
 v128_t sdf_sphere(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r);
 v128_t sdf_box(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t bx, v128_t by, v128_t bz);
 v128_t sdf_cylinder(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h);
 v128_t sdf_cone(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h);
 v128_t sdf_cylinder_y(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h);
 v128_t sdf_smooth_union(v128_t d1, v128_t d2, v128_t k);
+#ifdef SIMD_F32X8
+v256_t sdf_sphere8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r);
+v256_t sdf_box8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t bx, v256_t by, v256_t bz);
+v256_t sdf_cylinder8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r, v256_t h);
+v256_t sdf_cone8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r, v256_t h);
+v256_t sdf_cylinder_y8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r, v256_t h);
+v256_t eval_shape8(u32 i, v256_t px, v256_t py, v256_t pz);
+#endif
+void   sdf_sphere_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, sdf_grad_t* out);
+void   sdf_box_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t bx, v128_t by, v128_t bz, sdf_grad_t* out);
+void   sdf_capped_grad(v128_t d_radial, v128_t d_axial, v128_t* c_radial, v128_t* c_axial);
+void   sdf_cylinder_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h, sdf_grad_t* out);
+void   sdf_cylinder_y_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h, sdf_grad_t* out);
+void   sdf_cone_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h, sdf_grad_t* out);
+void   sdf_min_grad(sdf_grad_t* acc, const sdf_grad_t* b);
+void   sdf_smooth_union_grad(sdf_grad_t* acc, const sdf_grad_t* b, v128_t k);
+void   eval_shape_grad(u32 i, v128_t px, v128_t py, v128_t pz, sdf_grad_t* out);
+void   eval_shape_grad2(u32 i, v128_t px0, v128_t py0, v128_t pz0, v128_t px1, v128_t py1, v128_t pz1, sdf_grad_t* out0, sdf_grad_t* out1);
+void   grad_fold(sdf_grad_t* acc, u8* initialized, u8 blend, const sdf_grad_t* d);
+void   grad_union_groups(const sdf_grad_t* group_grads, const u8* group_initialized, v128_t* g);
+void   scene_sdf_grad(v128_t px, v128_t py, v128_t pz, v128_t mask, const u16* near, u32 near_count, v128_t* g);
+void   scene_sdf_grad2(v128_t px0, v128_t py0, v128_t pz0, const u16* near0, u32 count0, v128_t px1, v128_t py1, v128_t pz1, const u16* near1, u32 count1, v128_t* g0, v128_t* g1);
+u32    packet_near(const u32* rays, v128_t hit, u16* near);
 v128_t eval_shape(u32 i, v128_t px, v128_t py, v128_t pz);
+void   eval_shape2(u32 i, v128_t px0, v128_t py0, v128_t pz0, v128_t px1, v128_t py1, v128_t pz1, v128_t* d0, v128_t* d1);
+u8     cull_shape(u32 i, v128_t px, v128_t py, v128_t pz, v128_t limit, v128_t mask);
 v128_t scene_sdf(v128_t px, v128_t py, v128_t pz);
-void   get_hit_colors(v128_t px, v128_t py, v128_t pz, i32* hit_mask, f32* out_cr, f32* out_cg, f32* out_cb);
+v128_t scene_sdf_masked(v128_t px, v128_t py, v128_t pz, v128_t mask);
+v128_t scene_sdf_closest(v128_t px, v128_t py, v128_t pz, v128_t mask, closest_shape_t* closest);
+void   closest_init(closest_shape_t* closest, u32 slot);
+void   closest_update(closest_shape_t* closest, u32 pos, u32 i, v128_t d, v128_t limit);
+void   closest_glow(closest_shape_t* closest, const v128_t* group_dists, const u8* group_initialized);
+void   scene_sdf_masked2(v128_t px0, v128_t py0, v128_t pz0, v128_t mask0, v128_t px1, v128_t py1, v128_t pz1, v128_t mask1, v128_t* out0, v128_t* out1, closest_shape_t* closest0, closest_shape_t* closest1);
+v128_t scene_union_groups(const v128_t* group_dists, const u8* group_initialized);
+v128_t scene_run(const shape_run_t* run, const u16* span, u32 count, v128_t px, v128_t py, v128_t pz, v128_t mask, u8 blend, v128_t acc, closest_shape_t* closest, u32* evaluated, u32* culled);
+void   scene_run2(const shape_run_t* run, const u16* span, u32 count, v128_t px0, v128_t py0, v128_t pz0, v128_t mask0, v128_t px1, v128_t py1, v128_t pz1, v128_t mask1, u8 blend, v128_t* acc0, v128_t* acc1, closest_shape_t* closest0, closest_shape_t* closest1, u32* evaluated, u32* culled);
+v128_t intersect_scene_aabb(v128_t ox, v128_t oy, v128_t oz, v128_t dx, v128_t dy, v128_t dz, v128_t* t_near, v128_t* t_far);
 void   init_simd_constants(void);
+void   perf_add(u32 counter, u64 value);
+void   perf_add_stage(u32 stage, u64 ns);
+void   perf_stage(u32 stage, u64 start);
+void   perf_flush_shapes(void);
+void   perf_flush(const march_stats_t* stats);
+u8     temporal_reproject(void);
+f32    moved_start_cap(u32 idx, f32 start);
+void   shape_sort(void);
+u32    queue_rays(u32 first, u32 end, u8 warm, u32* queue, march_stats_t* stats);
+void   march_queue_rays(const u32* queue, u32 queued, march_stats_t* stats);
+void   shade_rays(u32 first, u32 end, march_stats_t* stats);
+v128_t packet_hits(u32 base, u32 end, u32* rays, v128_t* px, v128_t* py, v128_t* pz);
+u8     march_begin(void);
+void   march_range(u32 first, u32 end, u8 warm, march_stats_t* stats);
+void   march_end(const march_stats_t* stats);
+void   stats_add(march_stats_t* acc, const march_stats_t* stats);
+void   composite_rows(u32 width, u32 first_row, u32 end_row);
+void   shade_packet(u32 base, v128_t px, v128_t py, v128_t pz, v128_t hit, const v128_t* n, march_stats_t* stats);
+void   shade_packet2(u32 base, const v128_t* px, const v128_t* py, const v128_t* pz, const v128_t* hit, v128_t n[2][3], march_stats_t* stats);
+void   shade_store(u32 base, v128_t hit, const v128_t* light, march_stats_t* stats);
+v128_t point_light_factor(v128_t lx, v128_t ly, v128_t lz, v128_t nx, v128_t ny, v128_t nz, v128_t intensity, v128_t inv_radius_sq, v128_t inv_reach_sq, v128_t active);
+u32    light_point(v128_t px, v128_t py, v128_t pz, const v128_t* n, u32 lane, u64 lights, f32* rgb);
+u32    light_packet(v128_t px, v128_t py, v128_t pz, v128_t hit, const v128_t* n, u64 lights, v128_t* light);
+u32    light_packet2(const v128_t* px, const v128_t* py, const v128_t* pz, const v128_t* hit, v128_t n[2][3], const u64* lights, v128_t light[2][3]);
+void   light_directional(const v128_t* n, v128_t* light);
+void   hit_grad(const u32* rays, v128_t px, v128_t py, v128_t pz, v128_t hit, const u16* near, u32 near_count, v128_t* g);
+void   normalize_grad(v128_t* n);
+void   hit_normals(const u32* rays, v128_t px, v128_t py, v128_t pz, v128_t hit, v128_t* n);
+void   hit_normals2(const u32* rays, const v128_t* px, const v128_t* py, const v128_t* pz, const v128_t* hit, v128_t n[2][3]);
+void   lanes_init(march_lanes_t* lanes);
+u8     lanes_refill(march_lanes_t* lanes, const u32* queue, u32 queued, u32* next);
+void   lanes_point(const march_lanes_t* lanes, v128_t* px, v128_t* py, v128_t* pz);
+void   lanes_step(march_lanes_t* lanes, v128_t dist, const closest_shape_t* closest, march_stats_t* stats);
+void   record_near(u32 ray, u32 lane, const closest_shape_t* closest);
+void   bvh_build(void);
+u32    bvh_build_node(u32 first, u32 count);
+void   bvh_select(u32 first, u32 count, u32 nth, u32 axis);
+u8     grid_build(void);
+u8     grid_bin(const f32* extent, f32 cell);
+void   grid_cursor_init(shape_cursor_t* cursor, v128_t px, v128_t py, v128_t pz, v128_t mask, v128_t* cell_exit);
+u32    shape_cursor_next(shape_cursor_t* cursor);
+u32    shape_cursor_peek(const shape_cursor_t* cursor);
+void   shape_cursor_skip(shape_cursor_t* cursor, u32 i);
+u32    shape_cursor_span(shape_cursor_t* cursor, u32* run, u16* span);
+void   shape_cursor_merge(shape_cursor_t* cursor, const shape_cursor_t* other);
+u8     tile_span(u32 i, u16* span);
+u8     sphere_tile_span(f32 cx, f32 cy, f32 cz, f32 r, u16* span);
+void   tile_lists_build(void);
+void   march_cones(void);
+void   bin_lights(void);
+u64    packet_lights(u32 base, v128_t hit);
+u32    ray_tile(u32 idx);
+void   tile_cone(u32 t, f32* dir, f32* tan_half);
+u32    packet_tiles(const u32* rays, u32 count, shape_cursor_t* cursor);
+v128_t bvh_node_dist_sq(const bvh_node_t* node, v128_t px, v128_t py, v128_t pz);
+u8     bvh_cull_node(const bvh_node_t* node, v128_t px, v128_t py, v128_t pz, v128_t limit, v128_t mask);
+void   bvh_eval_group(u32 g, v128_t px, v128_t py, v128_t pz, v128_t mask, u8 blend, v128_t* acc, u8* initialized, closest_shape_t* closest, u32* evaluated, u32* culled);
+void   bvh_eval_group_grad(u32 g, v128_t px, v128_t py, v128_t pz, v128_t mask, u8 blend, sdf_grad_t* acc, u8* initialized, u32* evaluated, u32* culled);
+void   bvh_eval_group2(u32 g, v128_t px0, v128_t py0, v128_t pz0, v128_t mask0, v128_t px1, v128_t py1, v128_t pz1, v128_t mask1, u8 blend, v128_t* acc0, v128_t* acc1, u8* initialized, closest_shape_t* closest0, closest_shape_t* closest1, u32* evaluated, u32* culled);
 
 /////////
 // API //
 /////////
 #define SP_API __attribute__((visibility("default")))
-SP_API f32* get_perf_metrics_ptr(void);
+SP_API u32* get_perf_metrics_ptr(void);
+SP_API u32  get_perf_metrics_size(void);
 SP_API void reset_perf_metrics(void);
+SP_API void end_perf_frame(void);
 SP_API f32* get_bg_ptr(void);
 SP_API u8*  get_shape_types_ptr(void);
 SP_API f32* get_shape_params_ptr(void);
 SP_API f32* get_shape_positions_ptr(void);
 SP_API f32* get_shape_colors_ptr(void);
 SP_API u8*  get_shape_groups_ptr(void);
+SP_API u16* get_shape_order_ptr(void);
 SP_API u8*  get_group_blend_modes_ptr(void);
+SP_API f32* get_group_glow_ptr(void);
 SP_API void set_scene(u32 count, f32 k);
 SP_API void set_groups(u32 count);
+SP_API void set_accel_mode(u32 mode);
+SP_API u32  get_accel_mode(void);
+SP_API void set_march_mode(u32 mode);
+SP_API u32  get_march_mode(void);
+SP_API void set_packet_width(u32 width);
+SP_API u32  get_packet_width(void);
+SP_API u32  get_simd_backend(void);
 SP_API u32  get_max_shapes(void);
+SP_API u32  reserve_shapes(u32 count);
+SP_API u32  get_shape_capacity(void);
 SP_API u32  get_max_groups(void);
 SP_API f32* get_point_light_x_ptr(void);
 SP_API f32* get_point_light_y_ptr(void);
@@ -193,10 +649,24 @@ SP_API u32  get_max_point_lights(void);
 SP_API void set_point_lights(u32 count);
 SP_API void set_camera(f32 ex, f32 ey, f32 ez, f32 fx, f32 fy, f32 fz, f32 rx, f32 ry, f32 rz, f32 ux, f32 uy, f32 uz, f32 halfW, f32 halfH);
 SP_API void generate_rays(u32 width, u32 height);
+SP_API void bin_tiles(void);
+SP_API void cone_march(void);
 SP_API void compute_background(f32 time);
 SP_API void set_lighting(f32 ambient, f32 dir_x, f32 dir_y, f32 dir_z, f32 intensity);
 SP_API void march_rays(void);
+SP_API void shade_frame(void);
+SP_API void set_temporal(u32 enabled);
 SP_API u32  get_max_rays(void);
+SP_API u32  resize_buffers(u32 rays, u32 upscaled);
+SP_API u32  get_buffer_generation(void);
+SP_API u32  set_threads(u32 count);
+SP_API u8*  get_thread_stack_top(u32 index);
+SP_API u8*  get_thread_tls(u32 index);
+SP_API void thread_init(u32 index);
+SP_API u32* get_work_state_ptr(void);
+SP_API u32  begin_frame_work(u32 composite);
+SP_API void run_frame_work(void);
+SP_API void end_frame_work(void);
 SP_API u32* get_out_char_ptr(void);
 SP_API f32* get_out_fg_ptr(void);
 SP_API f32* get_out_bg_ptr(void);
@@ -212,7 +682,7 @@ SP_API void upscale(u32 native_width, u32 native_height, u32 output_width, u32 o
 //////////
 f32 sqrtf_approx(f32 x) {
   if (x <= 0.0f) return 0.0f;
-  return wasm_f32x4_extract_lane(wasm_f32x4_sqrt(wasm_f32x4_splat(x)), 0);
+  return f32x4_extract_lane(f32x4_sqrt(f32x4_splat(x)), 0);
 }
 
 f32 sinf_approx(f32 x) {
@@ -235,138 +705,753 @@ f32 minf(f32 a, f32 b) {
   return a < b ? a : b;
 }
 
+u32 minu(u32 a, u32 b) {
+  return a < b ? a : b;
+}
+
 f32 clampf(f32 x, f32 lo, f32 hi) {
   return minf(maxf(x, lo), hi);
 }
 
+f32 cbrtf_approx(f32 x) {
+  if (x <= 0.0f) return 0.0f;
+  union { f32 f; u32 u; } bits = { x };
+  bits.u = bits.u / 3 + 0x2a514067u;
+  f32 y = bits.f;
+  for (int i = 0; i < 3; i++) {
+    y = y - (y * y * y - x) / (3.0f * y * y);
+  }
+  return y;
+}
+
+///////////
+// ARENA //
+///////////
+// The frame buffers are carved from a bump arena that runs from the end of
+// the static data to the end of linear memory. Nothing else in the module
+// allocates, so the arena is always last in memory and memory.grow extends
+// it in place. resize_buffers() and reserve_shapes() start over from the
+// bottom and carve every buffer again, so nothing is ever freed piecemeal.
+//
+// Layout from the bottom: worker stacks and TLS (see THREADS), the per-shape
+// arrays, the per-ray, per-tile and upscale buffers, then the grid and tile
+// lists. Resizing the ray buffers leaves the scene where it is; growing the
+// shape arrays moves the ray buffers along with them. The lists are sized
+// by the builds that fill them (reserve_lists()), so growing them moves
+// nothing else.
+#ifdef __wasm__
+extern u8 __heap_base;
+#define ARENA_BASE (&__heap_base)
+#define memory_end() ((u8*)(__builtin_wasm_memory_size(0) * WASM_PAGE_SIZE))
+#define memory_grow(pages) ((i32)__builtin_wasm_memory_grow(0, pages))
+#else
+// Native builds stand in a fixed reserve for linear memory
+#define NATIVE_MEMORY_PAGES 1024
+u8 native_memory[NATIVE_MEMORY_PAGES * WASM_PAGE_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+u32 native_memory_pages = 0;
+#define ARENA_BASE native_memory
+#define memory_end() (native_memory + native_memory_pages * WASM_PAGE_SIZE)
+static inline i32 memory_grow(u32 pages) {
+  if (native_memory_pages + pages > NATIVE_MEMORY_PAGES) return -1;
+  native_memory_pages += pages;
+  return (i32)(native_memory_pages - pages);
+}
+#endif
+
+u8* arena_start(void) {
+  return (u8*)(((unsigned long)ARENA_BASE + ARENA_ALIGN - 1) & ~(unsigned long)(ARENA_ALIGN - 1));
+}
+
+// Grows memory until the arena holds `bytes`; returns 0 when it cannot
+u8 arena_reserve(u32 bytes) {
+  u8* end = memory_end();
+  u8* start = arena_start();
+  u32 have = end > start ? (u32)(end - start) : 0;
+  if (bytes <= have) return 1;
+  u32 pages = (bytes - have + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE;
+  return memory_grow(pages) >= 0;
+}
+
+void* arena_take(u32* used, u32 bytes) {
+  void* p = arena_start() + *used;
+  *used += (bytes + ARENA_ALIGN - 1) & ~(u32)(ARENA_ALIGN - 1);
+  return p;
+}
+
+// Points every arena buffer at its slice for the given sizes and returns
+// the bytes they span. Only computes addresses; the caller reserves them.
+u32 carve_buffers(u32 shapes, u32 rays, u32 tiles, u32 upscaled) {
+  u32 used = worker_count * thread_area_size;
+  shape_types = arena_take(&used, shapes * sizeof(u8));
+  shape_params = arena_take(&used, shapes * 4 * sizeof(f32));
+  shape_positions = arena_take(&used, shapes * 3 * sizeof(f32));
+  shape_colors = arena_take(&used, shapes * 3 * sizeof(f32));
+  shape_groups = arena_take(&used, shapes * sizeof(u8));
+  shape_order = arena_take(&used, shapes * sizeof(u16));
+  sorted_types = arena_take(&used, shapes * sizeof(u8));
+  sorted_groups = arena_take(&used, shapes * sizeof(u8));
+  shape_moved = arena_take(&used, shapes * sizeof(u8));
+  moved_shapes = arena_take(&used, shapes * sizeof(u16));
+  shape_cx = arena_take(&used, shapes * sizeof(v128_t));
+  shape_cy = arena_take(&used, shapes * sizeof(v128_t));
+  shape_cz = arena_take(&used, shapes * sizeof(v128_t));
+  shape_p0 = arena_take(&used, shapes * sizeof(v128_t));
+  shape_p1 = arena_take(&used, shapes * sizeof(v128_t));
+  shape_p2 = arena_take(&used, shapes * sizeof(v128_t));
+  shape_r = arena_take(&used, shapes * sizeof(v128_t));
+  shape_g = arena_take(&used, shapes * sizeof(v128_t));
+  shape_b = arena_take(&used, shapes * sizeof(v128_t));
+  shape_bounds = arena_take(&used, shapes * 4 * sizeof(f32));
+  shape_bound_x = arena_take(&used, shapes * sizeof(v128_t));
+  shape_bound_y = arena_take(&used, shapes * sizeof(v128_t));
+  shape_bound_z = arena_take(&used, shapes * sizeof(v128_t));
+  shape_bound_r = arena_take(&used, shapes * sizeof(v128_t));
+  shape_aabb = arena_take(&used, shapes * 6 * sizeof(f32));
+  // Each group's tree has fewer than two nodes per shape
+  bvh_nodes = arena_take(&used, shapes * 2 * sizeof(bvh_node_t));
+  bvh_shape_index = arena_take(&used, shapes * sizeof(u32));
+  grid_shape_span = arena_take(&used, shapes * 6 * sizeof(u8));
+  tile_shape_span = arena_take(&used, shapes * 4 * sizeof(u16));
+  shape_keys = arena_take(&used, shapes * sizeof(u8));
+  near_scratch = arena_take(&used, (worker_count + 1) * 2 * shapes * sizeof(u16));
+  near_lanes_scratch = arena_take(&used, (worker_count + 1) * 2 * shapes * sizeof(u8));
+
+  ray_ox = arena_take(&used, rays * sizeof(f32));
+  ray_oy = arena_take(&used, rays * sizeof(f32));
+  ray_oz = arena_take(&used, rays * sizeof(f32));
+  ray_dx = arena_take(&used, rays * sizeof(f32));
+  ray_dy = arena_take(&used, rays * sizeof(f32));
+  ray_dz = arena_take(&used, rays * sizeof(f32));
+  ray_depth = arena_take(&used, rays * sizeof(f32));
+  ray_start = arena_take(&used, rays * sizeof(f32));
+  ray_t_near = arena_take(&used, rays * sizeof(f32));
+  reproj_depth = ray_t_near;
+  ray_t_far = arena_take(&used, rays * sizeof(f32));
+  march_queue = arena_take(&used, rays * sizeof(u32));
+  ray_shape = arena_take(&used, rays * sizeof(u16));
+  ray_near = arena_take(&used, rays * SHADE_NEAR_MAX * sizeof(u16));
+  ray_near_count = arena_take(&used, rays * sizeof(u8));
+  ray_glow = arena_take(&used, rays * sizeof(f32));
+  ray_glow_group = arena_take(&used, rays * sizeof(u8));
+  ray_nx = arena_take(&used, rays * sizeof(f32));
+  ray_ny = arena_take(&used, rays * sizeof(f32));
+  ray_nz = arena_take(&used, rays * sizeof(f32));
+  out_r = arena_take(&used, rays * sizeof(f32));
+  out_g = arena_take(&used, rays * sizeof(f32));
+  out_b = arena_take(&used, rays * sizeof(f32));
+  out_char = arena_take(&used, rays * sizeof(u32));
+  out_fg = arena_take(&used, rays * 4 * sizeof(f32));
+  out_bg = arena_take(&used, rays * 4 * sizeof(f32));
+
+  tile_lights = arena_take(&used, tiles * sizeof(u64));
+  tile_start = arena_take(&used, (tiles + 1) * sizeof(u32));
+  tile_cone_t = arena_take(&used, tiles * sizeof(f32));
+
+  upscaled_char = arena_take(&used, upscaled * sizeof(u32));
+  upscaled_fg = arena_take(&used, upscaled * 4 * sizeof(f32));
+
+  grid_cell_start = arena_take(&used, grid_item_capacity ? (GRID_MAX_CELLS + 1) * sizeof(u32) : 0);
+  grid_items = arena_take(&used, grid_item_capacity * sizeof(u16));
+  tile_items = arena_take(&used, tile_item_capacity * sizeof(u16));
+  return used;
+}
+
+// Carves the arena for the given sizes, growing memory if needed. The ray
+// buffers move and lose their contents: the frame needs generate_rays()
+// again and the next march is cold. Growing memory also detaches every JS
+// view, so JS rebuilds its views when get_buffer_generation() changes.
+// Returns 0, keeping the old layout, when memory cannot grow.
+u32 relayout_arena(u32 shapes, u32 rays, u32 tiles, u32 upscaled) {
+  if (!arena_reserve(carve_buffers(shapes, rays, tiles, upscaled))) {
+    carve_buffers(shape_capacity, ray_capacity, tile_capacity, upscale_capacity);
+    return 0;
+  }
+
+  shape_capacity = shapes;
+  ray_capacity = rays;
+  tile_capacity = tiles;
+  upscale_capacity = upscaled;
+  buffer_generation++;
+
+  ray_count = 0;
+  ray_width = 0;
+  ray_height = 0;
+  tiles_valid = 0;
+  cones_valid = 0;
+  light_tiles_valid = 0;
+  depth_valid = 0;
+  return 1;
+}
+
+// Sizes the buffers for `rays` rays and an upscale() output of `upscaled`
+// cells (see relayout_arena()). The shape arrays keep their place and the
+// scene stays loaded; the grid lists move above the new buffers and are
+// binned again.
+u32 resize_buffers(u32 rays, u32 upscaled) {
+  // SIMD packets load whole groups of four rays
+  rays = (rays + 3) & ~3u;
+  // A w x h grid has at most (w * h + 7) / 8 tiles, when one side is 1
+  u32 tiles = (rays + TILE_SIZE - 1) / TILE_SIZE + 1;
+  if (!relayout_arena(shape_capacity, rays, tiles, upscaled)) return 0;
+  if (grid_enabled) grid_enabled = grid_build();
+  return 1;
+}
+
+// Grows the grid and tile lists to hold at least `grid` and `tile` entries,
+// in steps of LIST_CAPACITY_STEP. They are last in the arena, so only the
+// tile lists move (when the grid grows), and set_scene() and bin_tiles()
+// rebuild them right after. Growing memory detaches the JS views like any
+// resize. Returns 0, keeping the old lists, when memory cannot grow.
+u8 reserve_lists(u32 grid, u32 tile) {
+  u32 old_grid = grid_item_capacity;
+  u32 old_tile = tile_item_capacity;
+  grid = (grid + LIST_CAPACITY_STEP - 1) & ~(u32)(LIST_CAPACITY_STEP - 1);
+  tile = (tile + LIST_CAPACITY_STEP - 1) & ~(u32)(LIST_CAPACITY_STEP - 1);
+  grid_item_capacity = grid > old_grid ? grid : old_grid;
+  tile_item_capacity = tile > old_tile ? tile : old_tile;
+  if (arena_reserve(carve_buffers(shape_capacity, ray_capacity, tile_capacity, upscale_capacity))) return 1;
+
+  grid_item_capacity = old_grid;
+  tile_item_capacity = old_tile;
+  carve_buffers(shape_capacity, ray_capacity, tile_capacity, upscale_capacity);
+  return 0;
+}
+
+// Sizes the shape arrays for at least `count` shapes, up to MAX_SHAPES;
+// JS calls it before uploading a scene that does not fit. Growing moves
+// every buffer (see relayout_arena()) and drops the scene, so the shapes
+// are uploaded and set_scene() called after it. Returns 0 when `count` is
+// over MAX_SHAPES or memory cannot grow.
+u32 reserve_shapes(u32 count) {
+  if (count <= shape_capacity) return 1;
+  if (count > MAX_SHAPES) return 0;
+  u32 shapes = (count + SHAPE_CAPACITY_STEP - 1) & ~(u32)(SHAPE_CAPACITY_STEP - 1);
+  if (shapes > MAX_SHAPES) shapes = MAX_SHAPES;
+  if (!relayout_arena(shapes, ray_capacity, tile_capacity, upscale_capacity)) return 0;
+  set_scene(0, smooth_k);
+  return 1;
+}
+
+u32 get_shape_capacity(void) { return shape_capacity; }
+
+u32 get_buffer_generation(void) { return buffer_generation; }
+
+/////////////
+// METRICS //
+/////////////
+// Counters are u64 and only ever added to perf_metrics at the end of an
+// exported call (or a threaded frame), from locals and march_stats_t; the
+// hot loops never touch it. Stage times come from a monotonic clock, the
+// host's in wasm (perf_clock_ns in index.ts). Everything is added to both
+// the running total and the open frame, and end_perf_frame() moves the open
+// frame into a ring of the last PERF_RING_FRAMES. JS reads the whole struct
+// through one Uint32Array, a u64 as two words.
+#ifdef __wasm__
+__attribute__((import_module("env"), import_name("perf_clock_ns"))) f64 perf_clock_ns(void);
+#define perf_now() ((u64)perf_clock_ns())
+#else
+static inline u64 perf_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+#endif
+
+typedef struct {
+  u64 counters[PERF_COUNTER_COUNT];
+  u64 stage_ns[PERF_STAGE_COUNT];
+} perf_frame_t;
+
+typedef struct {
+  u32 version;       // PERF_METRICS_VERSION
+  u32 counter_count;
+  u32 stage_count;
+  u32 ring_frames;   // PERF_RING_FRAMES
+  u32 frames;        // end_perf_frame() calls; the last is in ring[(frames - 1) % ring_frames]
+  u32 pad[3];
+  perf_frame_t total;  // since reset_perf_metrics()
+  perf_frame_t frame;  // since the last end_perf_frame()
+  perf_frame_t ring[PERF_RING_FRAMES];
+} perf_metrics_t;
+
+perf_metrics_t perf_metrics = {
+  .version = PERF_METRICS_VERSION,
+  .counter_count = PERF_COUNTER_COUNT,
+  .stage_count = PERF_STAGE_COUNT,
+  .ring_frames = PERF_RING_FRAMES,
+};
+
+u32* get_perf_metrics_ptr(void) { return &perf_metrics.version; }
+u32 get_perf_metrics_size(void) { return sizeof(perf_metrics); }
+
+void reset_perf_metrics(void) {
+  perf_frame_t zero = {0};
+  perf_metrics.frames = 0;
+  perf_metrics.total = zero;
+  perf_metrics.frame = zero;
+  for (u32 i = 0; i < PERF_RING_FRAMES; i++) perf_metrics.ring[i] = zero;
+}
+
+void end_perf_frame(void) {
+  perf_frame_t zero = {0};
+  perf_metrics.ring[perf_metrics.frames % PERF_RING_FRAMES] = perf_metrics.frame;
+  perf_metrics.frames++;
+  perf_metrics.frame = zero;
+}
+
+void perf_add(u32 counter, u64 value) {
+  perf_metrics.total.counters[counter] += value;
+  perf_metrics.frame.counters[counter] += value;
+}
+
+void perf_add_stage(u32 stage, u64 ns) {
+  perf_metrics.total.stage_ns[stage] += ns;
+  perf_metrics.frame.stage_ns[stage] += ns;
+}
+
+// Closes a stage that began at perf_now() == start
+void perf_stage(u32 stage, u64 start) {
+  perf_add_stage(stage, perf_now() - start);
+}
+
+// Adds this thread's shape counts; main thread only
+void perf_flush_shapes(void) {
+  perf_add(PERF_SHAPES_EVALUATED, perf_shapes_evaluated);
+  perf_add(PERF_SHAPES_CULLED, perf_shapes_culled);
+  perf_shapes_evaluated = 0;
+  perf_shapes_culled = 0;
+}
+
+// Adds a call's (or frame's) march and shading stats and the shape counts
+void perf_flush(const march_stats_t* stats) {
+  perf_add(PERF_MARCH_STEPS, stats->iterations);
+  perf_add(PERF_NORMAL_PASSES, stats->normal_passes);
+  perf_add(PERF_LIGHT_EVALS, stats->light_evals);
+  perf_add(PERF_HITS, stats->hits);
+  perf_add(PERF_MISSES, stats->misses);
+  perf_add(PERF_TILE_SKIPS, stats->tile_skips);
+  perf_add(PERF_LANE_STEPS, stats->lane_steps);
+  perf_add(PERF_WARM_RAYS, stats->warm_rays);
+  perf_add(PERF_WARM_STEPS, stats->warm_steps);
+  perf_add(PERF_COLD_RAYS, stats->cold_rays);
+  perf_add(PERF_COLD_STEPS, stats->cold_steps);
+  perf_flush_shapes();
+
+  perf_add_stage(PERF_STAGE_MARCH, stats->march_ns);
+  perf_add_stage(PERF_STAGE_NORMALS, stats->normals_ns);
+  perf_add_stage(PERF_STAGE_LIGHTING, stats->lighting_ns);
+  perf_add_stage(PERF_STAGE_COMPOSITE, stats->composite_ns);
+}
+
 /////////
 // SDF //
 /////////
 v128_t sdf_sphere(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r) {
-  v128_t dx = wasm_f32x4_sub(px, cx);
-  v128_t dy = wasm_f32x4_sub(py, cy);
-  v128_t dz = wasm_f32x4_sub(pz, cz);
-  v128_t len_sq = wasm_f32x4_add(wasm_f32x4_add(
-    wasm_f32x4_mul(dx, dx),
-    wasm_f32x4_mul(dy, dy)),
-    wasm_f32x4_mul(dz, dz));
-  return wasm_f32x4_sub(wasm_f32x4_sqrt(len_sq), r);
+  v128_t dx = f32x4_sub(px, cx);
+  v128_t dy = f32x4_sub(py, cy);
+  v128_t dz = f32x4_sub(pz, cz);
+  v128_t len_sq = f32x4_add(f32x4_add(
+    f32x4_mul(dx, dx),
+    f32x4_mul(dy, dy)),
+    f32x4_mul(dz, dz));
+  return f32x4_sub(f32x4_sqrt(len_sq), r);
 }
 
 v128_t sdf_box(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t bx, v128_t by, v128_t bz) {
-  v128_t dx = wasm_f32x4_sub(wasm_f32x4_abs(wasm_f32x4_sub(px, cx)), bx);
-  v128_t dy = wasm_f32x4_sub(wasm_f32x4_abs(wasm_f32x4_sub(py, cy)), by);
-  v128_t dz = wasm_f32x4_sub(wasm_f32x4_abs(wasm_f32x4_sub(pz, cz)), bz);
+  v128_t dx = f32x4_sub(f32x4_abs(f32x4_sub(px, cx)), bx);
+  v128_t dy = f32x4_sub(f32x4_abs(f32x4_sub(py, cy)), by);
+  v128_t dz = f32x4_sub(f32x4_abs(f32x4_sub(pz, cz)), bz);
 
-  v128_t zero = wasm_f32x4_splat(0.0f);
-  v128_t dx_pos = wasm_f32x4_max(dx, zero);
-  v128_t dy_pos = wasm_f32x4_max(dy, zero);
-  v128_t dz_pos = wasm_f32x4_max(dz, zero);
+  v128_t zero = f32x4_splat(0.0f);
+  v128_t dx_pos = f32x4_max(dx, zero);
+  v128_t dy_pos = f32x4_max(dy, zero);
+  v128_t dz_pos = f32x4_max(dz, zero);
 
-  v128_t outside = wasm_f32x4_sqrt(wasm_f32x4_add(wasm_f32x4_add(
-    wasm_f32x4_mul(dx_pos, dx_pos),
-    wasm_f32x4_mul(dy_pos, dy_pos)),
-    wasm_f32x4_mul(dz_pos, dz_pos)));
+  v128_t outside = f32x4_sqrt(f32x4_add(f32x4_add(
+    f32x4_mul(dx_pos, dx_pos),
+    f32x4_mul(dy_pos, dy_pos)),
+    f32x4_mul(dz_pos, dz_pos)));
 
-  v128_t inside = wasm_f32x4_min(wasm_f32x4_max(dx, wasm_f32x4_max(dy, dz)), zero);
+  v128_t inside = f32x4_min(f32x4_max(dx, f32x4_max(dy, dz)), zero);
 
-  return wasm_f32x4_add(outside, inside);
+  return f32x4_add(outside, inside);
 }
 
 v128_t sdf_cylinder(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h) {
-  v128_t dy = wasm_f32x4_sub(py, cy);
-  v128_t dz = wasm_f32x4_sub(pz, cz);
-  v128_t radial_sq = wasm_f32x4_add(wasm_f32x4_mul(dy, dy), wasm_f32x4_mul(dz, dz));
-  v128_t d_radial = wasm_f32x4_sub(wasm_f32x4_sqrt(radial_sq), r);
-  v128_t d_axial = wasm_f32x4_sub(wasm_f32x4_abs(wasm_f32x4_sub(px, cx)), h);
-
-  v128_t zero = wasm_f32x4_splat(0.0f);
-  v128_t d_radial_pos = wasm_f32x4_max(d_radial, zero);
-  v128_t d_axial_pos = wasm_f32x4_max(d_axial, zero);
-
-  v128_t outside = wasm_f32x4_sqrt(wasm_f32x4_add(
-    wasm_f32x4_mul(d_radial_pos, d_radial_pos),
-    wasm_f32x4_mul(d_axial_pos, d_axial_pos)));
-  v128_t inside = wasm_f32x4_min(wasm_f32x4_max(d_radial, d_axial), zero);
-
-  return wasm_f32x4_add(outside, inside);
+  v128_t dy = f32x4_sub(py, cy);
+  v128_t dz = f32x4_sub(pz, cz);
+  v128_t radial_sq = f32x4_add(f32x4_mul(dy, dy), f32x4_mul(dz, dz));
+  v128_t d_radial = f32x4_sub(f32x4_sqrt(radial_sq), r);
+  v128_t d_axial = f32x4_sub(f32x4_abs(f32x4_sub(px, cx)), h);
+
+  v128_t zero = f32x4_splat(0.0f);
+  v128_t d_radial_pos = f32x4_max(d_radial, zero);
+  v128_t d_axial_pos = f32x4_max(d_axial, zero);
+
+  v128_t outside = f32x4_sqrt(f32x4_add(
+    f32x4_mul(d_radial_pos, d_radial_pos),
+    f32x4_mul(d_axial_pos, d_axial_pos)));
+  v128_t inside = f32x4_min(f32x4_max(d_radial, d_axial), zero);
+
+  return f32x4_add(outside, inside);
 }
 
 v128_t sdf_cone(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h) {
-  v128_t dx = wasm_f32x4_sub(px, cx);
-  v128_t dy = wasm_f32x4_sub(py, cy);
-  v128_t dz = wasm_f32x4_sub(pz, cz);
+  v128_t dx = f32x4_sub(px, cx);
+  v128_t dy = f32x4_sub(py, cy);
+  v128_t dz = f32x4_sub(pz, cz);
 
-  v128_t zero = wasm_f32x4_splat(0.0f);
-  v128_t one = wasm_f32x4_splat(1.0f);
+  v128_t zero = f32x4_splat(0.0f);
+  v128_t one = f32x4_splat(1.0f);
 
-  v128_t q = wasm_f32x4_sqrt(wasm_f32x4_add(wasm_f32x4_mul(dx, dx), wasm_f32x4_mul(dz, dz)));
+  v128_t q = f32x4_sqrt(f32x4_add(f32x4_mul(dx, dx), f32x4_mul(dz, dz)));
 
-  v128_t cone_len_sq = wasm_f32x4_add(wasm_f32x4_mul(r, r), wasm_f32x4_mul(h, h));
-  v128_t cone_len = wasm_f32x4_sqrt(cone_len_sq);
-  v128_t sin_a = wasm_f32x4_div(r, cone_len);
-  v128_t cos_a = wasm_f32x4_div(h, cone_len);
+  v128_t cone_len_sq = f32x4_add(f32x4_mul(r, r), f32x4_mul(h, h));
+  v128_t cone_len = f32x4_sqrt(cone_len_sq);
+  v128_t sin_a = f32x4_div(r, cone_len);
+  v128_t cos_a = f32x4_div(h, cone_len);
 
-  v128_t t = wasm_f32x4_max(zero, wasm_f32x4_min(one, wasm_f32x4_div(dy, h)));
-  v128_t r_at_y = wasm_f32x4_mul(r, wasm_f32x4_sub(one, t));
+  v128_t t = f32x4_max(zero, f32x4_min(one, f32x4_div(dy, h)));
+  v128_t r_at_y = f32x4_mul(r, f32x4_sub(one, t));
 
-  v128_t dist_to_surface = wasm_f32x4_sub(q, r_at_y);
-  v128_t cone_dist = wasm_f32x4_mul(dist_to_surface, cos_a);
+  v128_t dist_to_surface = f32x4_sub(q, r_at_y);
+  v128_t cone_dist = f32x4_mul(dist_to_surface, cos_a);
 
-  v128_t below = wasm_f32x4_lt(dy, zero);
-  v128_t base_radial = wasm_f32x4_max(wasm_f32x4_sub(q, r), zero);
-  v128_t base_axial = wasm_f32x4_sub(zero, dy);
-  v128_t base_dist = wasm_f32x4_sqrt(wasm_f32x4_add(
-    wasm_f32x4_mul(base_radial, base_radial),
-    wasm_f32x4_mul(base_axial, base_axial)));
+  v128_t below = f32x4_lt(dy, zero);
+  v128_t base_radial = f32x4_max(f32x4_sub(q, r), zero);
+  v128_t base_axial = f32x4_sub(zero, dy);
+  v128_t base_dist = f32x4_sqrt(f32x4_add(
+    f32x4_mul(base_radial, base_radial),
+    f32x4_mul(base_axial, base_axial)));
 
-  v128_t above = wasm_f32x4_gt(dy, h);
-  v128_t dy_h = wasm_f32x4_sub(dy, h);
-  v128_t tip_dist = wasm_f32x4_sqrt(wasm_f32x4_add(wasm_f32x4_mul(q, q), wasm_f32x4_mul(dy_h, dy_h)));
+  v128_t above = f32x4_gt(dy, h);
+  v128_t dy_h = f32x4_sub(dy, h);
+  v128_t tip_dist = f32x4_sqrt(f32x4_add(f32x4_mul(q, q), f32x4_mul(dy_h, dy_h)));
 
   v128_t result = cone_dist;
-  result = wasm_v128_bitselect(base_dist, result, below);
-  result = wasm_v128_bitselect(tip_dist, result, above);
+  result = v128_bitselect(base_dist, result, below);
+  result = v128_bitselect(tip_dist, result, above);
 
   return result;
 }
 
 v128_t sdf_cylinder_y(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h) {
-  v128_t dx = wasm_f32x4_sub(px, cx);
-  v128_t dz = wasm_f32x4_sub(pz, cz);
-  v128_t radial_sq = wasm_f32x4_add(wasm_f32x4_mul(dx, dx), wasm_f32x4_mul(dz, dz));
-  v128_t d_radial = wasm_f32x4_sub(wasm_f32x4_sqrt(radial_sq), r);
-  v128_t d_axial = wasm_f32x4_sub(wasm_f32x4_abs(wasm_f32x4_sub(py, cy)), h);
-
-  v128_t zero = wasm_f32x4_splat(0.0f);
-  v128_t d_radial_pos = wasm_f32x4_max(d_radial, zero);
-  v128_t d_axial_pos = wasm_f32x4_max(d_axial, zero);
-
-  v128_t outside = wasm_f32x4_sqrt(wasm_f32x4_add(
-    wasm_f32x4_mul(d_radial_pos, d_radial_pos),
-    wasm_f32x4_mul(d_axial_pos, d_axial_pos)));
-  v128_t inside = wasm_f32x4_min(wasm_f32x4_max(d_radial, d_axial), zero);
-
-  return wasm_f32x4_add(outside, inside);
+  v128_t dx = f32x4_sub(px, cx);
+  v128_t dz = f32x4_sub(pz, cz);
+  v128_t radial_sq = f32x4_add(f32x4_mul(dx, dx), f32x4_mul(dz, dz));
+  v128_t d_radial = f32x4_sub(f32x4_sqrt(radial_sq), r);
+  v128_t d_axial = f32x4_sub(f32x4_abs(f32x4_sub(py, cy)), h);
+
+  v128_t zero = f32x4_splat(0.0f);
+  v128_t d_radial_pos = f32x4_max(d_radial, zero);
+  v128_t d_axial_pos = f32x4_max(d_axial, zero);
+
+  v128_t outside = f32x4_sqrt(f32x4_add(
+    f32x4_mul(d_radial_pos, d_radial_pos),
+    f32x4_mul(d_axial_pos, d_axial_pos)));
+  v128_t inside = f32x4_min(f32x4_max(d_radial, d_axial), zero);
+
+  return f32x4_add(outside, inside);
 }
 
 v128_t sdf_smooth_union(v128_t d1, v128_t d2, v128_t k) {
-  v128_t half = wasm_f32x4_splat(0.5f);
-  v128_t one = wasm_f32x4_splat(1.0f);
-  v128_t zero = wasm_f32x4_splat(0.0f);
-
-  v128_t diff = wasm_f32x4_sub(d2, d1);
-  v128_t h = wasm_f32x4_add(half, wasm_f32x4_mul(half, wasm_f32x4_div(diff, k)));
-  h = wasm_f32x4_max(zero, wasm_f32x4_min(one, h));
-
-  return wasm_f32x4_add(d2,
-    wasm_f32x4_sub(
-      wasm_f32x4_mul(wasm_f32x4_sub(d1, d2), h),
-      wasm_f32x4_mul(k, wasm_f32x4_mul(h, wasm_f32x4_sub(one, h)))
+  v128_t half = f32x4_splat(0.5f);
+  v128_t one = f32x4_splat(1.0f);
+  v128_t zero = f32x4_splat(0.0f);
+
+  v128_t diff = f32x4_sub(d2, d1);
+  v128_t h = f32x4_add(half, f32x4_mul(half, f32x4_div(diff, k)));
+  h = f32x4_max(zero, f32x4_min(one, h));
+
+  return f32x4_add(d2,
+    f32x4_sub(
+      f32x4_mul(f32x4_sub(d1, d2), h),
+      f32x4_mul(k, f32x4_mul(h, f32x4_sub(one, h)))
     )
   );
 }
 
+#ifdef SIMD_F32X8
+// 8-lane copies of the kernels above for simd.h's v256_t: the same ops in
+// the same order, so each half matches the 4-lane kernel bit for bit. The
+// dual-packet path runs its two packets through these as one.
+v256_t sdf_sphere8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r) {
+  v256_t dx = f32x8_sub(px, cx);
+  v256_t dy = f32x8_sub(py, cy);
+  v256_t dz = f32x8_sub(pz, cz);
+  v256_t len_sq = f32x8_add(f32x8_add(
+    f32x8_mul(dx, dx),
+    f32x8_mul(dy, dy)),
+    f32x8_mul(dz, dz));
+  return f32x8_sub(f32x8_sqrt(len_sq), r);
+}
+
+v256_t sdf_box8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t bx, v256_t by, v256_t bz) {
+  v256_t dx = f32x8_sub(f32x8_abs(f32x8_sub(px, cx)), bx);
+  v256_t dy = f32x8_sub(f32x8_abs(f32x8_sub(py, cy)), by);
+  v256_t dz = f32x8_sub(f32x8_abs(f32x8_sub(pz, cz)), bz);
+
+  v256_t zero = f32x8_splat(0.0f);
+  v256_t dx_pos = f32x8_max(dx, zero);
+  v256_t dy_pos = f32x8_max(dy, zero);
+  v256_t dz_pos = f32x8_max(dz, zero);
+
+  v256_t outside = f32x8_sqrt(f32x8_add(f32x8_add(
+    f32x8_mul(dx_pos, dx_pos),
+    f32x8_mul(dy_pos, dy_pos)),
+    f32x8_mul(dz_pos, dz_pos)));
+
+  v256_t inside = f32x8_min(f32x8_max(dx, f32x8_max(dy, dz)), zero);
+
+  return f32x8_add(outside, inside);
+}
+
+v256_t sdf_cylinder8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r, v256_t h) {
+  v256_t dy = f32x8_sub(py, cy);
+  v256_t dz = f32x8_sub(pz, cz);
+  v256_t radial_sq = f32x8_add(f32x8_mul(dy, dy), f32x8_mul(dz, dz));
+  v256_t d_radial = f32x8_sub(f32x8_sqrt(radial_sq), r);
+  v256_t d_axial = f32x8_sub(f32x8_abs(f32x8_sub(px, cx)), h);
+
+  v256_t zero = f32x8_splat(0.0f);
+  v256_t d_radial_pos = f32x8_max(d_radial, zero);
+  v256_t d_axial_pos = f32x8_max(d_axial, zero);
+
+  v256_t outside = f32x8_sqrt(f32x8_add(
+    f32x8_mul(d_radial_pos, d_radial_pos),
+    f32x8_mul(d_axial_pos, d_axial_pos)));
+  v256_t inside = f32x8_min(f32x8_max(d_radial, d_axial), zero);
+
+  return f32x8_add(outside, inside);
+}
+
+v256_t sdf_cone8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r, v256_t h) {
+  v256_t dx = f32x8_sub(px, cx);
+  v256_t dy = f32x8_sub(py, cy);
+  v256_t dz = f32x8_sub(pz, cz);
+
+  v256_t zero = f32x8_splat(0.0f);
+  v256_t one = f32x8_splat(1.0f);
+
+  v256_t q = f32x8_sqrt(f32x8_add(f32x8_mul(dx, dx), f32x8_mul(dz, dz)));
+
+  v256_t cone_len_sq = f32x8_add(f32x8_mul(r, r), f32x8_mul(h, h));
+  v256_t cone_len = f32x8_sqrt(cone_len_sq);
+  v256_t cos_a = f32x8_div(h, cone_len);
+
+  v256_t t = f32x8_max(zero, f32x8_min(one, f32x8_div(dy, h)));
+  v256_t r_at_y = f32x8_mul(r, f32x8_sub(one, t));
+
+  v256_t dist_to_surface = f32x8_sub(q, r_at_y);
+  v256_t cone_dist = f32x8_mul(dist_to_surface, cos_a);
+
+  v256_t below = f32x8_lt(dy, zero);
+  v256_t base_radial = f32x8_max(f32x8_sub(q, r), zero);
+  v256_t base_axial = f32x8_sub(zero, dy);
+  v256_t base_dist = f32x8_sqrt(f32x8_add(
+    f32x8_mul(base_radial, base_radial),
+    f32x8_mul(base_axial, base_axial)));
+
+  v256_t above = f32x8_gt(dy, h);
+  v256_t dy_h = f32x8_sub(dy, h);
+  v256_t tip_dist = f32x8_sqrt(f32x8_add(f32x8_mul(q, q), f32x8_mul(dy_h, dy_h)));
+
+  v256_t result = cone_dist;
+  result = f32x8_bitselect(base_dist, result, below);
+  result = f32x8_bitselect(tip_dist, result, above);
+
+  return result;
+}
+
+v256_t sdf_cylinder_y8(v256_t px, v256_t py, v256_t pz, v256_t cx, v256_t cy, v256_t cz, v256_t r, v256_t h) {
+  v256_t dx = f32x8_sub(px, cx);
+  v256_t dz = f32x8_sub(pz, cz);
+  v256_t radial_sq = f32x8_add(f32x8_mul(dx, dx), f32x8_mul(dz, dz));
+  v256_t d_radial = f32x8_sub(f32x8_sqrt(radial_sq), r);
+  v256_t d_axial = f32x8_sub(f32x8_abs(f32x8_sub(py, cy)), h);
+
+  v256_t zero = f32x8_splat(0.0f);
+  v256_t d_radial_pos = f32x8_max(d_radial, zero);
+  v256_t d_axial_pos = f32x8_max(d_axial, zero);
+
+  v256_t outside = f32x8_sqrt(f32x8_add(
+    f32x8_mul(d_radial_pos, d_radial_pos),
+    f32x8_mul(d_axial_pos, d_axial_pos)));
+  v256_t inside = f32x8_min(f32x8_max(d_radial, d_axial), zero);
+
+  return f32x8_add(outside, inside);
+}
+#endif
+
+// Gradient variants of the kernels above: each returns the same distance
+// plus its closed-form gradient, so a normal needs no finite-difference taps.
+// Degenerate points (exactly on a centre or axis) get a zero gradient.
+void sdf_sphere_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, sdf_grad_t* out) {
+  v128_t dx = f32x4_sub(px, cx);
+  v128_t dy = f32x4_sub(py, cy);
+  v128_t dz = f32x4_sub(pz, cz);
+  v128_t len = f32x4_sqrt(f32x4_add(f32x4_add(
+    f32x4_mul(dx, dx),
+    f32x4_mul(dy, dy)),
+    f32x4_mul(dz, dz)));
+  v128_t inv_len = f32x4_div(f32x4_splat(1.0f), f32x4_max(len, f32x4_splat(1e-12f)));
+
+  out->d = f32x4_sub(len, r);
+  out->gx = f32x4_mul(dx, inv_len);
+  out->gy = f32x4_mul(dy, inv_len);
+  out->gz = f32x4_mul(dz, inv_len);
+}
+
+void sdf_box_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t bx, v128_t by, v128_t bz, sdf_grad_t* out) {
+  v128_t zero = f32x4_splat(0.0f);
+  v128_t one = f32x4_splat(1.0f);
+  v128_t rx = f32x4_sub(px, cx);
+  v128_t ry = f32x4_sub(py, cy);
+  v128_t rz = f32x4_sub(pz, cz);
+  v128_t dx = f32x4_sub(f32x4_abs(rx), bx);
+  v128_t dy = f32x4_sub(f32x4_abs(ry), by);
+  v128_t dz = f32x4_sub(f32x4_abs(rz), bz);
+
+  v128_t dx_pos = f32x4_max(dx, zero);
+  v128_t dy_pos = f32x4_max(dy, zero);
+  v128_t dz_pos = f32x4_max(dz, zero);
+  v128_t outside = f32x4_sqrt(f32x4_add(f32x4_add(
+    f32x4_mul(dx_pos, dx_pos),
+    f32x4_mul(dy_pos, dy_pos)),
+    f32x4_mul(dz_pos, dz_pos)));
+  v128_t d_max = f32x4_max(dx, f32x4_max(dy, dz));
+  out->d = f32x4_add(outside, f32x4_min(d_max, zero));
+
+  // Outside: along the clamped offset to the nearest box point. Inside:
+  // along the axis of the nearest face
+  v128_t is_out = f32x4_gt(outside, zero);
+  v128_t inv_out = f32x4_div(one, f32x4_max(outside, f32x4_splat(1e-12f)));
+  v128_t face_x = f32x4_eq(dx, d_max);
+  v128_t face_y = v128_andnot(f32x4_eq(dy, d_max), face_x);
+  v128_t face_z = v128_not(v128_or(face_x, face_y));
+  v128_t gx = v128_bitselect(f32x4_mul(dx_pos, inv_out), v128_and(face_x, one), is_out);
+  v128_t gy = v128_bitselect(f32x4_mul(dy_pos, inv_out), v128_and(face_y, one), is_out);
+  v128_t gz = v128_bitselect(f32x4_mul(dz_pos, inv_out), v128_and(face_z, one), is_out);
+
+  out->gx = v128_bitselect(f32x4_neg(gx), gx, f32x4_lt(rx, zero));
+  out->gy = v128_bitselect(f32x4_neg(gy), gy, f32x4_lt(ry, zero));
+  out->gz = v128_bitselect(f32x4_neg(gz), gz, f32x4_lt(rz, zero));
+}
+
+// Weights of the radial and axial unit directions in the gradient of the
+// capped-cylinder distance built from d_radial and d_axial
+void sdf_capped_grad(v128_t d_radial, v128_t d_axial, v128_t* c_radial, v128_t* c_axial) {
+  v128_t zero = f32x4_splat(0.0f);
+  v128_t one = f32x4_splat(1.0f);
+  v128_t r_pos = f32x4_max(d_radial, zero);
+  v128_t a_pos = f32x4_max(d_axial, zero);
+  v128_t outside = f32x4_sqrt(f32x4_add(f32x4_mul(r_pos, r_pos), f32x4_mul(a_pos, a_pos)));
+  v128_t inv_out = f32x4_div(one, f32x4_max(outside, f32x4_splat(1e-12f)));
+
+  v128_t is_out = f32x4_gt(outside, zero);
+  v128_t radial_face = v128_and(f32x4_ge(d_radial, d_axial), one);
+  *c_radial = v128_bitselect(f32x4_mul(r_pos, inv_out), radial_face, is_out);
+  *c_axial = v128_bitselect(f32x4_mul(a_pos, inv_out), f32x4_sub(one, radial_face), is_out);
+}
+
+void sdf_cylinder_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h, sdf_grad_t* out) {
+  v128_t ax = f32x4_sub(px, cx);
+  v128_t dy = f32x4_sub(py, cy);
+  v128_t dz = f32x4_sub(pz, cz);
+  v128_t radial = f32x4_sqrt(f32x4_add(f32x4_mul(dy, dy), f32x4_mul(dz, dz)));
+  v128_t d_radial = f32x4_sub(radial, r);
+  v128_t d_axial = f32x4_sub(f32x4_abs(ax), h);
+  out->d = sdf_cylinder(px, py, pz, cx, cy, cz, r, h);
+
+  v128_t c_radial, c_axial;
+  sdf_capped_grad(d_radial, d_axial, &c_radial, &c_axial);
+  c_radial = f32x4_div(c_radial, f32x4_max(radial, f32x4_splat(1e-12f)));
+  out->gx = v128_bitselect(f32x4_neg(c_axial), c_axial, f32x4_lt(ax, zero_simd));
+  out->gy = f32x4_mul(dy, c_radial);
+  out->gz = f32x4_mul(dz, c_radial);
+}
+
+void sdf_cylinder_y_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h, sdf_grad_t* out) {
+  v128_t dx = f32x4_sub(px, cx);
+  v128_t ay = f32x4_sub(py, cy);
+  v128_t dz = f32x4_sub(pz, cz);
+  v128_t radial = f32x4_sqrt(f32x4_add(f32x4_mul(dx, dx), f32x4_mul(dz, dz)));
+  v128_t d_radial = f32x4_sub(radial, r);
+  v128_t d_axial = f32x4_sub(f32x4_abs(ay), h);
+  out->d = sdf_cylinder_y(px, py, pz, cx, cy, cz, r, h);
+
+  v128_t c_radial, c_axial;
+  sdf_capped_grad(d_radial, d_axial, &c_radial, &c_axial);
+  c_radial = f32x4_div(c_radial, f32x4_max(radial, f32x4_splat(1e-12f)));
+  out->gx = f32x4_mul(dx, c_radial);
+  out->gy = v128_bitselect(f32x4_neg(c_axial), c_axial, f32x4_lt(ay, zero_simd));
+  out->gz = f32x4_mul(dz, c_radial);
+}
+
+// Same three regions as sdf_cone(): the slanted side, the base below and
+// the tip above
+void sdf_cone_grad(v128_t px, v128_t py, v128_t pz, v128_t cx, v128_t cy, v128_t cz, v128_t r, v128_t h, sdf_grad_t* out) {
+  v128_t dx = f32x4_sub(px, cx);
+  v128_t dy = f32x4_sub(py, cy);
+  v128_t dz = f32x4_sub(pz, cz);
+  v128_t zero = f32x4_splat(0.0f);
+  v128_t one = f32x4_splat(1.0f);
+  v128_t tiny = f32x4_splat(1e-12f);
+  out->d = sdf_cone(px, py, pz, cx, cy, cz, r, h);
+
+  v128_t q = f32x4_sqrt(f32x4_add(f32x4_mul(dx, dx), f32x4_mul(dz, dz)));
+  v128_t inv_q = f32x4_div(one, f32x4_max(q, tiny));
+  v128_t ux = f32x4_mul(dx, inv_q);
+  v128_t uz = f32x4_mul(dz, inv_q);
+  v128_t cos_a = f32x4_div(h, f32x4_sqrt(f32x4_add(f32x4_mul(r, r), f32x4_mul(h, h))));
+
+  // Side: (q - r * (1 - dy / h)) * cos_a
+  v128_t c_radial = cos_a;
+  v128_t c_y = f32x4_mul(cos_a, f32x4_div(r, h));
+
+  v128_t below = f32x4_lt(dy, zero);
+  v128_t base_radial = f32x4_max(f32x4_sub(q, r), zero);
+  v128_t inv_base = f32x4_div(one, f32x4_max(f32x4_sqrt(f32x4_add(
+    f32x4_mul(base_radial, base_radial), f32x4_mul(dy, dy))), tiny));
+  c_radial = v128_bitselect(f32x4_mul(base_radial, inv_base), c_radial, below);
+  c_y = v128_bitselect(f32x4_mul(dy, inv_base), c_y, below);
+
+  v128_t above = f32x4_gt(dy, h);
+  v128_t dy_h = f32x4_sub(dy, h);
+  v128_t inv_tip = f32x4_div(one, f32x4_max(f32x4_sqrt(f32x4_add(
+    f32x4_mul(q, q), f32x4_mul(dy_h, dy_h))), tiny));
+  c_radial = v128_bitselect(f32x4_mul(q, inv_tip), c_radial, above);
+  c_y = v128_bitselect(f32x4_mul(dy_h, inv_tip), c_y, above);
+
+  out->gx = f32x4_mul(ux, c_radial);
+  out->gy = c_y;
+  out->gz = f32x4_mul(uz, c_radial);
+}
+
+// acc = min(acc, b), taking the gradient of whichever side is smaller
+void sdf_min_grad(sdf_grad_t* acc, const sdf_grad_t* b) {
+  v128_t take = f32x4_lt(b->d, acc->d);
+  acc->d = v128_bitselect(b->d, acc->d, take);
+  acc->gx = v128_bitselect(b->gx, acc->gx, take);
+  acc->gy = v128_bitselect(b->gy, acc->gy, take);
+  acc->gz = v128_bitselect(b->gz, acc->gz, take);
+}
+
+// acc = sdf_smooth_union(acc, b, k). The blend factor h drops out of the
+// derivative, so the gradient is h * grad(acc) + (1 - h) * grad(b)
+void sdf_smooth_union_grad(sdf_grad_t* acc, const sdf_grad_t* b, v128_t k) {
+  v128_t half = f32x4_splat(0.5f);
+  v128_t one = f32x4_splat(1.0f);
+  v128_t h = f32x4_add(half, f32x4_mul(half, f32x4_div(f32x4_sub(b->d, acc->d), k)));
+  h = f32x4_max(zero_simd, f32x4_min(one, h));
+  v128_t h_b = f32x4_sub(one, h);
+
+  acc->d = sdf_smooth_union(acc->d, b->d, k);
+  acc->gx = f32x4_add(f32x4_mul(acc->gx, h), f32x4_mul(b->gx, h_b));
+  acc->gy = f32x4_add(f32x4_mul(acc->gy, h), f32x4_mul(b->gy, h_b));
+  acc->gz = f32x4_add(f32x4_mul(acc->gz, h), f32x4_mul(b->gz, h_b));
+}
+
 
 ///////////
 // SCENE //
@@ -376,43 +1461,462 @@ v128_t eval_shape(u32 i, v128_t px, v128_t py, v128_t pz) {
   v128_t cy = shape_cy[i];
   v128_t cz = shape_cz[i];
 
-  if (shape_types[i] == SHAPE_SPHERE) {
+  if (sorted_types[i] == SHAPE_SPHERE) {
     return sdf_sphere(px, py, pz, cx, cy, cz, shape_p0[i]);
-  } else if (shape_types[i] == SHAPE_CYLINDER) {
+  } else if (sorted_types[i] == SHAPE_CYLINDER) {
     return sdf_cylinder(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i]);
-  } else if (shape_types[i] == SHAPE_CONE) {
+  } else if (sorted_types[i] == SHAPE_CONE) {
     return sdf_cone(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i]);
-  } else if (shape_types[i] == SHAPE_CYLINDER_Y) {
+  } else if (sorted_types[i] == SHAPE_CYLINDER_Y) {
     return sdf_cylinder_y(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i]);
   } else {
     return sdf_box(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i], shape_p2[i]);
   }
 }
 
+#ifdef SIMD_F32X8
+// eval_shape() on an 8-lane packet; the shape splats fill both halves
+v256_t eval_shape8(u32 i, v256_t px, v256_t py, v256_t pz) {
+  v256_t cx = f32x8_dup(shape_cx[i]);
+  v256_t cy = f32x8_dup(shape_cy[i]);
+  v256_t cz = f32x8_dup(shape_cz[i]);
+
+  if (sorted_types[i] == SHAPE_SPHERE) {
+    return sdf_sphere8(px, py, pz, cx, cy, cz, f32x8_dup(shape_p0[i]));
+  } else if (sorted_types[i] == SHAPE_CYLINDER) {
+    return sdf_cylinder8(px, py, pz, cx, cy, cz, f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i]));
+  } else if (sorted_types[i] == SHAPE_CONE) {
+    return sdf_cone8(px, py, pz, cx, cy, cz, f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i]));
+  } else if (sorted_types[i] == SHAPE_CYLINDER_Y) {
+    return sdf_cylinder_y8(px, py, pz, cx, cy, cz, f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i]));
+  } else {
+    return sdf_box8(px, py, pz, cx, cy, cz, f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i]), f32x8_dup(shape_p2[i]));
+  }
+}
+#endif
+
+// eval_shape() for two packets at once. With SIMD_F32X8 the two packets
+// are one 8-lane kernel call. Otherwise the two 4-lane calls share the
+// shape loads and the type branch and have no dependency on each other,
+// so their sqrt/div chains overlap instead of stalling back to back.
+void eval_shape2(u32 i, v128_t px0, v128_t py0, v128_t pz0, v128_t px1, v128_t py1, v128_t pz1, v128_t* d0, v128_t* d1) {
+#ifdef SIMD_F32X8
+  v256_t d = eval_shape8(i, f32x8_join(px0, px1), f32x8_join(py0, py1), f32x8_join(pz0, pz1));
+  *d0 = f32x8_lo(d);
+  *d1 = f32x8_hi(d);
+#else
+  v128_t cx = shape_cx[i];
+  v128_t cy = shape_cy[i];
+  v128_t cz = shape_cz[i];
+
+  if (sorted_types[i] == SHAPE_SPHERE) {
+    *d0 = sdf_sphere(px0, py0, pz0, cx, cy, cz, shape_p0[i]);
+    *d1 = sdf_sphere(px1, py1, pz1, cx, cy, cz, shape_p0[i]);
+  } else if (sorted_types[i] == SHAPE_CYLINDER) {
+    *d0 = sdf_cylinder(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i]);
+    *d1 = sdf_cylinder(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i]);
+  } else if (sorted_types[i] == SHAPE_CONE) {
+    *d0 = sdf_cone(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i]);
+    *d1 = sdf_cone(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i]);
+  } else if (sorted_types[i] == SHAPE_CYLINDER_Y) {
+    *d0 = sdf_cylinder_y(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i]);
+    *d1 = sdf_cylinder_y(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i]);
+  } else {
+    *d0 = sdf_box(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i], shape_p2[i]);
+    *d1 = sdf_box(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i], shape_p2[i]);
+  }
+#endif
+}
+
+void eval_shape_grad(u32 i, v128_t px, v128_t py, v128_t pz, sdf_grad_t* out) {
+  v128_t cx = shape_cx[i];
+  v128_t cy = shape_cy[i];
+  v128_t cz = shape_cz[i];
+
+  if (sorted_types[i] == SHAPE_SPHERE) {
+    sdf_sphere_grad(px, py, pz, cx, cy, cz, shape_p0[i], out);
+  } else if (sorted_types[i] == SHAPE_CYLINDER) {
+    sdf_cylinder_grad(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i], out);
+  } else if (sorted_types[i] == SHAPE_CONE) {
+    sdf_cone_grad(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i], out);
+  } else if (sorted_types[i] == SHAPE_CYLINDER_Y) {
+    sdf_cylinder_y_grad(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i], out);
+  } else {
+    sdf_box_grad(px, py, pz, cx, cy, cz, shape_p0[i], shape_p1[i], shape_p2[i], out);
+  }
+}
+
+// eval_shape_grad() for two packets, with the two kernel calls back to back
+void eval_shape_grad2(u32 i, v128_t px0, v128_t py0, v128_t pz0, v128_t px1, v128_t py1, v128_t pz1, sdf_grad_t* out0, sdf_grad_t* out1) {
+  v128_t cx = shape_cx[i];
+  v128_t cy = shape_cy[i];
+  v128_t cz = shape_cz[i];
+
+  if (sorted_types[i] == SHAPE_SPHERE) {
+    sdf_sphere_grad(px0, py0, pz0, cx, cy, cz, shape_p0[i], out0);
+    sdf_sphere_grad(px1, py1, pz1, cx, cy, cz, shape_p0[i], out1);
+  } else if (sorted_types[i] == SHAPE_CYLINDER) {
+    sdf_cylinder_grad(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i], out0);
+    sdf_cylinder_grad(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i], out1);
+  } else if (sorted_types[i] == SHAPE_CONE) {
+    sdf_cone_grad(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i], out0);
+    sdf_cone_grad(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i], out1);
+  } else if (sorted_types[i] == SHAPE_CYLINDER_Y) {
+    sdf_cylinder_y_grad(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i], out0);
+    sdf_cylinder_y_grad(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i], out1);
+  } else {
+    sdf_box_grad(px0, py0, pz0, cx, cy, cz, shape_p0[i], shape_p1[i], shape_p2[i], out0);
+    sdf_box_grad(px1, py1, pz1, cx, cy, cz, shape_p0[i], shape_p1[i], shape_p2[i], out1);
+  }
+}
+
+// True when every masked lane is at least `limit` away from the shape's
+// bounding sphere, i.e. the exact SDF could not lower the running distance.
+u8 cull_shape(u32 i, v128_t px, v128_t py, v128_t pz, v128_t limit, v128_t mask) {
+  v128_t dx = f32x4_sub(px, shape_bound_x[i]);
+  v128_t dy = f32x4_sub(py, shape_bound_y[i]);
+  v128_t dz = f32x4_sub(pz, shape_bound_z[i]);
+  v128_t dist_sq = f32x4_add(f32x4_add(
+    f32x4_mul(dx, dx),
+    f32x4_mul(dy, dy)),
+    f32x4_mul(dz, dz));
+
+  v128_t reach = f32x4_add(limit, shape_bound_r[i]);
+  v128_t far = v128_or(
+    f32x4_lt(reach, zero_simd),
+    f32x4_ge(dist_sq, f32x4_mul(reach, reach)));
+  return i32x4_all_true(v128_or(far, v128_not(mask)));
+}
+
 v128_t scene_sdf(v128_t px, v128_t py, v128_t pz) {
+  return scene_sdf_masked(px, py, pz, i32x4_splat(-1));
+}
+
+// Lanes outside `mask` are don't-cares: they never keep a shape or BVH node
+// alive, so their distances are only guaranteed for unmasked lanes.
+v128_t scene_sdf_masked(v128_t px, v128_t py, v128_t pz, v128_t mask) {
+  return scene_sdf_closest(px, py, pz, mask, 0);
+}
+
+void closest_init(closest_shape_t* closest, u32 slot) {
+  closest->dist = max_dist_simd;
+  closest->id = i32x4_splat(0);
+  u32 list = (thread_index * 2 + slot) * shape_capacity;
+  closest->near = near_scratch + list;
+  closest->near_lanes = near_lanes_scratch + list;
+  closest->near_count = 0;
+  closest->glow = max_dist_simd;
+  closest->glow_group = i32x4_splat(0);
+}
+
+// limit is the cull limit of shape i's group before folding it in (the
+// group distance plus the blend slack, or MAX_DIST for its first shape); a
+// lane at or past it keeps both min() and the smooth union unchanged
+void closest_update(closest_shape_t* closest, u32 pos, u32 i, v128_t d, v128_t limit) {
+  v128_t nearer = f32x4_lt(d, closest->dist);
+  closest->dist = v128_bitselect(d, closest->dist, nearer);
+  closest->id = v128_bitselect(i32x4_splat((i32)i), closest->id, nearer);
+
+  closest->near[closest->near_count] = (u16)pos;
+  closest->near_lanes[closest->near_count] = (u8)i32x4_bitmask(f32x4_lt(d, limit));
+  closest->near_count++;
+}
+
+// Keeps the nearest glowing group per lane from one call's group distances.
+// A group with shapes left out by culling, tiles or the grid reads as
+// further away than it is, so glow only reaches as far as those bounds.
+void closest_glow(closest_shape_t* closest, const v128_t* group_dists, const u8* group_initialized) {
+  for (u32 bits = glow_groups; bits; bits &= bits - 1) {
+    u32 g = (u32)__builtin_ctz(bits);
+    if (!group_initialized[g]) continue;
+    v128_t rel = f32x4_mul(group_dists[g], glow_inv_radius_simd[g]);
+    v128_t nearer = f32x4_lt(rel, closest->glow);
+    closest->glow = v128_bitselect(rel, closest->glow, nearer);
+    closest->glow_group = v128_bitselect(i32x4_splat((i32)g), closest->glow_group, nearer);
+  }
+}
+
+// scene_sdf_masked() that also reports, when `closest` is non-null, the
+// nearest evaluated shape per lane. Culled shapes can never be nearer: their
+// bound is past the group distance plus the blend slack, and a smooth union
+// is at most k/4 below its nearest member.
+v128_t scene_sdf_closest(v128_t px, v128_t py, v128_t pz, v128_t mask, closest_shape_t* closest) {
+  if (closest) closest_init(closest, 0);
   if (shape_count == 0) return max_dist_simd;
 
   v128_t group_dists[MAX_GROUPS];
   u8 group_initialized[MAX_GROUPS] = {0};
 
-  for (u32 i = 0; i < shape_count; i++) {
-    u8 g = shape_groups[i];
-    if (g >= group_count) g = 0;
+  u32 evaluated = 0;
+  u32 culled = 0;
+
+  if (bvh_enabled) {
+    for (u32 rg = 0; rg < MAX_GROUPS; rg++) {
+      u32 g = rg < group_count ? rg : 0;
+      bvh_eval_group(rg, px, py, pz, mask, group_blend_mode[g],
+        &group_dists[g], &group_initialized[g], closest, &evaluated, &culled);
+    }
+  }
 
-    v128_t d = eval_shape(i, px, py, pz);
+  shape_cursor_t cursor;
+  v128_t cell_exit = max_dist_simd;
+  u8 use_cursor = 1;
+  if (grid_enabled) {
+    grid_cursor_init(&cursor, px, py, pz, mask, &cell_exit);
+  } else if (tile_cursor_enabled) {
+    cursor = tile_cursor;
+  } else {
+    use_cursor = 0;
+  }
 
+  // Whole runs, or the cursor's shapes cut into spans of one run; either
+  // way each span goes through its run's kernel loop
+  u16 span[SHAPE_SPAN_MAX];
+  u32 run = 0;
+  for (u32 r = 0; !bvh_enabled; r++) {
+    u32 count;
+    if (use_cursor) {
+      count = shape_cursor_span(&cursor, &run, span);
+      if (count == 0) break;
+    } else {
+      if (r >= shape_run_count) break;
+      run = r;
+      count = shape_runs[r].count;
+    }
+
+    u32 g = shape_runs[run].group < group_count ? shape_runs[run].group : 0;
     if (!group_initialized[g]) {
-      group_dists[g] = d;
+      group_dists[g] = max_dist_simd;
       group_initialized[g] = 1;
+    }
+    group_dists[g] = scene_run(&shape_runs[run], use_cursor ? span : 0, count, px, py, pz, mask,
+      group_blend_mode[g], group_dists[g], closest, &evaluated, &culled);
+  }
+
+  perf_shapes_evaluated += evaluated;
+  perf_shapes_culled += culled;
+
+  if (closest) closest_glow(closest, group_dists, group_initialized);
+  v128_t result = scene_union_groups(group_dists, group_initialized);
+
+  // Shapes missing from the cell lists are at least this far away
+  if (grid_enabled) result = f32x4_min(result, cell_exit);
+
+  return result;
+}
+
+// Folds shapes of one run into `acc` (the running distance of the run's
+// group, starting at MAX_DIST): the `count` shapes listed in `span`, or the
+// first `count` of the run without one. The type and blend mode are fixed
+// for the whole run, so the loop calls its kernel directly instead of
+// dispatching per shape. A shape whose bound is past the group distance
+// (plus the blend radius for smooth groups) leaves both min() and the
+// smooth union unchanged, so it is culled.
+v128_t scene_run(const shape_run_t* run, const u16* span, u32 count, v128_t px, v128_t py, v128_t pz, v128_t mask, u8 blend, v128_t acc, closest_shape_t* closest, u32* evaluated, u32* culled) {
+  v128_t slack = blend == 0 ? zero_simd : smooth_k_simd;
+
+#define RUN_LOOP(kernel)                                                   \
+  for (u32 n = 0; n < count; n++) {                                        \
+    u32 i = span ? span[n] : run->first + n;                               \
+    v128_t limit = f32x4_add(acc, slack);                                  \
+    if (cull_shape(i, px, py, pz, limit, mask)) {                          \
+      (*culled)++;                                                         \
+      continue;                                                            \
+    }                                                                      \
+    (*evaluated)++;                                                        \
+    v128_t d = kernel;                                                     \
+    if (closest) closest_update(closest, i, i, d, limit);                  \
+    acc = blend == 0 ? f32x4_min(acc, d) : sdf_smooth_union(acc, d, smooth_k_simd); \
+  }
+
+  switch (run->type) {
+    case SHAPE_SPHERE:
+      RUN_LOOP(sdf_sphere(px, py, pz, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i]));
+      break;
+    case SHAPE_CYLINDER:
+      RUN_LOOP(sdf_cylinder(px, py, pz, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]));
+      break;
+    case SHAPE_CONE:
+      RUN_LOOP(sdf_cone(px, py, pz, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]));
+      break;
+    case SHAPE_CYLINDER_Y:
+      RUN_LOOP(sdf_cylinder_y(px, py, pz, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]));
+      break;
+    default:
+      RUN_LOOP(sdf_box(px, py, pz, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i], shape_p2[i]));
+      break;
+  }
+
+#undef RUN_LOOP
+  return acc;
+}
+
+// scene_run() for two packets: a shape is culled only when both packets
+// can cull it, and the kernels run like eval_shape2(): as one 8-lane call
+// with SIMD_F32X8, else as two 4-lane calls back to back
+void scene_run2(const shape_run_t* run, const u16* span, u32 count, v128_t px0, v128_t py0, v128_t pz0, v128_t mask0, v128_t px1, v128_t py1, v128_t pz1, v128_t mask1, u8 blend, v128_t* acc0, v128_t* acc1, closest_shape_t* closest0, closest_shape_t* closest1, u32* evaluated, u32* culled) {
+  v128_t slack = blend == 0 ? zero_simd : smooth_k_simd;
+  v128_t a0 = *acc0;
+  v128_t a1 = *acc1;
+
+#ifdef SIMD_F32X8
+  v256_t px = f32x8_join(px0, px1);
+  v256_t py = f32x8_join(py0, py1);
+  v256_t pz = f32x8_join(pz0, pz1);
+#define RUN_KERNELS(kernel8, kernel0, kernel1)                             \
+    v256_t d = kernel8;                                                    \
+    v128_t d0 = f32x8_lo(d);                                               \
+    v128_t d1 = f32x8_hi(d);
+#else
+#define RUN_KERNELS(kernel8, kernel0, kernel1)                             \
+    v128_t d0 = kernel0;                                                   \
+    v128_t d1 = kernel1;
+#endif
+
+#define RUN_LOOP(kernel8, kernel0, kernel1)                                \
+  for (u32 n = 0; n < count; n++) {                                        \
+    u32 i = span ? span[n] : run->first + n;                               \
+    v128_t limit0 = f32x4_add(a0, slack);                                  \
+    v128_t limit1 = f32x4_add(a1, slack);                                  \
+    if (cull_shape(i, px0, py0, pz0, limit0, mask0) &&                     \
+        cull_shape(i, px1, py1, pz1, limit1, mask1)) {                     \
+      *culled += 2;                                                        \
+      continue;                                                            \
+    }                                                                      \
+    *evaluated += 2;                                                       \
+    RUN_KERNELS(kernel8, kernel0, kernel1)                                 \
+    if (closest0) {                                                        \
+      closest_update(closest0, i, i, d0, limit0);                          \
+      closest_update(closest1, i, i, d1, limit1);                          \
+    }                                                                      \
+    if (blend == 0) {                                                      \
+      a0 = f32x4_min(a0, d0);                                              \
+      a1 = f32x4_min(a1, d1);                                              \
+    } else {                                                               \
+      a0 = sdf_smooth_union(a0, d0, smooth_k_simd);                        \
+      a1 = sdf_smooth_union(a1, d1, smooth_k_simd);                        \
+    }                                                                      \
+  }
+
+  switch (run->type) {
+    case SHAPE_SPHERE:
+      RUN_LOOP(sdf_sphere8(px, py, pz, f32x8_dup(shape_cx[i]), f32x8_dup(shape_cy[i]), f32x8_dup(shape_cz[i]), f32x8_dup(shape_p0[i])),
+               sdf_sphere(px0, py0, pz0, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i]),
+               sdf_sphere(px1, py1, pz1, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i]));
+      break;
+    case SHAPE_CYLINDER:
+      RUN_LOOP(sdf_cylinder8(px, py, pz, f32x8_dup(shape_cx[i]), f32x8_dup(shape_cy[i]), f32x8_dup(shape_cz[i]), f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i])),
+               sdf_cylinder(px0, py0, pz0, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]),
+               sdf_cylinder(px1, py1, pz1, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]));
+      break;
+    case SHAPE_CONE:
+      RUN_LOOP(sdf_cone8(px, py, pz, f32x8_dup(shape_cx[i]), f32x8_dup(shape_cy[i]), f32x8_dup(shape_cz[i]), f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i])),
+               sdf_cone(px0, py0, pz0, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]),
+               sdf_cone(px1, py1, pz1, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]));
+      break;
+    case SHAPE_CYLINDER_Y:
+      RUN_LOOP(sdf_cylinder_y8(px, py, pz, f32x8_dup(shape_cx[i]), f32x8_dup(shape_cy[i]), f32x8_dup(shape_cz[i]), f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i])),
+               sdf_cylinder_y(px0, py0, pz0, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]),
+               sdf_cylinder_y(px1, py1, pz1, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i]));
+      break;
+    default:
+      RUN_LOOP(sdf_box8(px, py, pz, f32x8_dup(shape_cx[i]), f32x8_dup(shape_cy[i]), f32x8_dup(shape_cz[i]), f32x8_dup(shape_p0[i]), f32x8_dup(shape_p1[i]), f32x8_dup(shape_p2[i])),
+               sdf_box(px0, py0, pz0, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i], shape_p2[i]),
+               sdf_box(px1, py1, pz1, shape_cx[i], shape_cy[i], shape_cz[i], shape_p0[i], shape_p1[i], shape_p2[i]));
+      break;
+  }
+
+#undef RUN_LOOP
+#undef RUN_KERNELS
+  *acc0 = a0;
+  *acc1 = a1;
+}
+
+// scene_sdf_closest() for two packets sharing one pass over the shapes. A
+// shape (or BVH node) is skipped only when both packets can cull it, so
+// either packet may see extra exact shape distances; those only tighten
+// the bound. The tile cursor must cover the rays of both packets.
+void scene_sdf_masked2(v128_t px0, v128_t py0, v128_t pz0, v128_t mask0, v128_t px1, v128_t py1, v128_t pz1, v128_t mask1, v128_t* out0, v128_t* out1, closest_shape_t* closest0, closest_shape_t* closest1) {
+  if (closest0) {
+    closest_init(closest0, 0);
+    closest_init(closest1, 1);
+  }
+  if (shape_count == 0) {
+    *out0 = max_dist_simd;
+    *out1 = max_dist_simd;
+    return;
+  }
+
+  v128_t dists0[MAX_GROUPS];
+  v128_t dists1[MAX_GROUPS];
+  u8 group_initialized[MAX_GROUPS] = {0};
+
+  u32 evaluated = 0;
+  u32 culled = 0;
+
+  if (bvh_enabled) {
+    for (u32 rg = 0; rg < MAX_GROUPS; rg++) {
+      u32 g = rg < group_count ? rg : 0;
+      bvh_eval_group2(rg, px0, py0, pz0, mask0, px1, py1, pz1, mask1, group_blend_mode[g],
+        &dists0[g], &dists1[g], &group_initialized[g], closest0, closest1, &evaluated, &culled);
+    }
+  }
+
+  shape_cursor_t cursor;
+  v128_t cell_exit0 = max_dist_simd;
+  v128_t cell_exit1 = max_dist_simd;
+  u8 use_cursor = 1;
+  if (grid_enabled) {
+    shape_cursor_t other;
+    grid_cursor_init(&cursor, px0, py0, pz0, mask0, &cell_exit0);
+    grid_cursor_init(&other, px1, py1, pz1, mask1, &cell_exit1);
+    shape_cursor_merge(&cursor, &other);
+  } else if (tile_cursor_enabled) {
+    cursor = tile_cursor;
+  } else {
+    use_cursor = 0;
+  }
+
+  u16 span[SHAPE_SPAN_MAX];
+  u32 run = 0;
+  for (u32 r = 0; !bvh_enabled; r++) {
+    u32 count;
+    if (use_cursor) {
+      count = shape_cursor_span(&cursor, &run, span);
+      if (count == 0) break;
     } else {
-      if (group_blend_mode[g] == 0) {
-        group_dists[g] = wasm_f32x4_min(group_dists[g], d);
-      } else {
-        group_dists[g] = sdf_smooth_union(group_dists[g], d, smooth_k_simd);
-      }
+      if (r >= shape_run_count) break;
+      run = r;
+      count = shape_runs[r].count;
+    }
+
+    u32 g = shape_runs[run].group < group_count ? shape_runs[run].group : 0;
+    if (!group_initialized[g]) {
+      dists0[g] = max_dist_simd;
+      dists1[g] = max_dist_simd;
+      group_initialized[g] = 1;
     }
+    scene_run2(&shape_runs[run], use_cursor ? span : 0, count, px0, py0, pz0, mask0, px1, py1, pz1, mask1,
+      group_blend_mode[g], &dists0[g], &dists1[g], closest0, closest1, &evaluated, &culled);
+  }
+
+  perf_shapes_evaluated += evaluated;
+  perf_shapes_culled += culled;
+
+  if (closest0) {
+    closest_glow(closest0, dists0, group_initialized);
+    closest_glow(closest1, dists1, group_initialized);
+  }
+  *out0 = scene_union_groups(dists0, group_initialized);
+  *out1 = scene_union_groups(dists1, group_initialized);
+  if (grid_enabled) {
+    *out0 = f32x4_min(*out0, cell_exit0);
+    *out1 = f32x4_min(*out1, cell_exit1);
   }
+}
 
+// Smooth union of the per-group distances, in group order
+v128_t scene_union_groups(const v128_t* group_dists, const u8* group_initialized) {
   v128_t result = max_dist_simd;
   u8 first = 1;
   for (u32 g = 0; g < group_count; g++) {
@@ -425,58 +1929,876 @@ v128_t scene_sdf(v128_t px, v128_t py, v128_t pz) {
       }
     }
   }
-
   return result;
 }
 
-void get_hit_colors(v128_t px, v128_t py, v128_t pz, i32* hit_mask, f32* out_cr, f32* out_cg, f32* out_cb) {
-  v128_t min_dist = wasm_f32x4_splat(MAX_DIST);
-  v128_t closest_r = wasm_f32x4_splat(0.0f);
-  v128_t closest_g = wasm_f32x4_splat(0.0f);
-  v128_t closest_b = wasm_f32x4_splat(0.0f);
-  v128_t hit_thresh = wasm_f32x4_splat(HIT_THRESHOLD);
+// Folds one shape's distance and gradient into its group, as scene_sdf()
+// folds the distance alone
+void grad_fold(sdf_grad_t* acc, u8* initialized, u8 blend, const sdf_grad_t* d) {
+  if (!*initialized) {
+    *acc = *d;
+    *initialized = 1;
+  } else if (blend == 0) {
+    sdf_min_grad(acc, d);
+  } else {
+    sdf_smooth_union_grad(acc, d, smooth_k_simd);
+  }
+}
+
+// Distance and gradient of the scene in one pass over the shapes
+// scene_sdf_masked() visits, in the same order, so the gradient belongs to
+// the field the marcher stepped through. The culling is not quite the same:
+// outside the BVH, scene_run() starts each group at MAX_DIST and can cull
+// even its first shape, while here a group is seeded from its first shape
+// and only the later ones are culled, against that tighter bound. The extra
+// shape is further than MAX_DIST (plus slack), so it cannot change a lane
+// the marcher saw. The grid's cell-exit clamp is not applied. With a `near`
+// list (closest_shape_t fold positions, ascending) only those shapes are
+// folded, uncull'd; the shapes left out must not affect any masked lane. g
+// receives the unnormalized x, y, z.
+void scene_sdf_grad(v128_t px, v128_t py, v128_t pz, v128_t mask, const u16* near, u32 near_count, v128_t* g) {
+  sdf_grad_t group_grads[MAX_GROUPS];
+  u8 group_initialized[MAX_GROUPS] = {0};
+
+  u32 evaluated = 0;
+  u32 culled = 0;
+
+  for (u32 e = 0; near && e < near_count; e++) {
+    u32 i = bvh_enabled ? bvh_shape_index[near[e]] : near[e];
+    u8 gi = sorted_groups[i];
+    if (gi >= group_count) gi = 0;
+
+    evaluated++;
+    sdf_grad_t d;
+    eval_shape_grad(i, px, py, pz, &d);
+    grad_fold(&group_grads[gi], &group_initialized[gi], group_blend_mode[gi], &d);
+  }
+
+  if (bvh_enabled && !near) {
+    for (u32 rg = 0; rg < MAX_GROUPS; rg++) {
+      u32 gi = rg < group_count ? rg : 0;
+      bvh_eval_group_grad(rg, px, py, pz, mask, group_blend_mode[gi],
+        &group_grads[gi], &group_initialized[gi], &evaluated, &culled);
+    }
+  }
+
+  shape_cursor_t cursor;
+  u8 use_cursor = 1;
+  if (near || bvh_enabled) {
+    use_cursor = 0;
+  } else if (grid_enabled) {
+    v128_t cell_exit;
+    grid_cursor_init(&cursor, px, py, pz, mask, &cell_exit);
+  } else if (tile_cursor_enabled) {
+    cursor = tile_cursor;
+  } else {
+    use_cursor = 0;
+  }
+
+  for (u32 n = 0; !bvh_enabled && !near; n++) {
+    u32 i = use_cursor ? shape_cursor_next(&cursor) : n;
+    if (i >= shape_count) break;
+
+    u8 gi = sorted_groups[i];
+    if (gi >= group_count) gi = 0;
+
+    if (group_initialized[gi]) {
+      v128_t slack = group_blend_mode[gi] == 0 ? zero_simd : smooth_k_simd;
+      if (cull_shape(i, px, py, pz, f32x4_add(group_grads[gi].d, slack), mask)) {
+        culled++;
+        continue;
+      }
+    }
+
+    evaluated++;
+    sdf_grad_t d;
+    eval_shape_grad(i, px, py, pz, &d);
+    grad_fold(&group_grads[gi], &group_initialized[gi], group_blend_mode[gi], &d);
+  }
+
+  perf_shapes_evaluated += evaluated;
+  perf_shapes_culled += culled;
+  grad_union_groups(group_grads, group_initialized, g);
+}
+
+// Gradient of the smooth union of the per-group fields, in group order, as
+// scene_union_groups() folds the distances; g receives x, y, z
+void grad_union_groups(const sdf_grad_t* group_grads, const u8* group_initialized, v128_t* g) {
+  sdf_grad_t result = {max_dist_simd, zero_simd, zero_simd, zero_simd};
+  u8 initialized = 0;
+  for (u32 gi = 0; gi < group_count; gi++) {
+    if (group_initialized[gi]) grad_fold(&result, &initialized, 1, &group_grads[gi]);
+  }
+
+  g[0] = result.gx;
+  g[1] = result.gy;
+  g[2] = result.gz;
+}
+
+// scene_sdf_grad() with near lists for two packets at once. The lists are
+// walked merged, in fold order, and a shape on both goes through
+// eval_shape_grad2(). Each packet still folds exactly its own list in its
+// own order, so g0 and g1 match two scene_sdf_grad() calls.
+void scene_sdf_grad2(v128_t px0, v128_t py0, v128_t pz0, const u16* near0, u32 count0,
+                     v128_t px1, v128_t py1, v128_t pz1, const u16* near1, u32 count1, v128_t* g0, v128_t* g1) {
+  sdf_grad_t group_grads0[MAX_GROUPS];
+  sdf_grad_t group_grads1[MAX_GROUPS];
+  u8 group_initialized0[MAX_GROUPS] = {0};
+  u8 group_initialized1[MAX_GROUPS] = {0};
+
+  u32 evaluated = 0;
+  u32 e0 = 0;
+  u32 e1 = 0;
+  while (e0 < count0 || e1 < count1) {
+    u32 pos0 = e0 < count0 ? near0[e0] : CURSOR_END;
+    u32 pos1 = e1 < count1 ? near1[e1] : CURSOR_END;
+    u32 pos = pos0 < pos1 ? pos0 : pos1;
+    u32 i = bvh_enabled ? bvh_shape_index[pos] : pos;
+    u8 gi = sorted_groups[i];
+    if (gi >= group_count) gi = 0;
+    u8 blend = group_blend_mode[gi];
+
+    sdf_grad_t d0, d1;
+    if (pos0 == pos1) {
+      eval_shape_grad2(i, px0, py0, pz0, px1, py1, pz1, &d0, &d1);
+      grad_fold(&group_grads0[gi], &group_initialized0[gi], blend, &d0);
+      grad_fold(&group_grads1[gi], &group_initialized1[gi], blend, &d1);
+      evaluated += 2;
+      e0++;
+      e1++;
+    } else if (pos == pos0) {
+      eval_shape_grad(i, px0, py0, pz0, &d0);
+      grad_fold(&group_grads0[gi], &group_initialized0[gi], blend, &d0);
+      evaluated++;
+      e0++;
+    } else {
+      eval_shape_grad(i, px1, py1, pz1, &d1);
+      grad_fold(&group_grads1[gi], &group_initialized1[gi], blend, &d1);
+      evaluated++;
+      e1++;
+    }
+  }
+
+  perf_shapes_evaluated += evaluated;
+  grad_union_groups(group_grads0, group_initialized0, g0);
+  grad_union_groups(group_grads1, group_initialized1, g1);
+}
+
+// Slab test against the padded scene bounds. Lanes that miss the box never
+// need to be marched; lanes that hit can start at t_near and give up at t_far.
+v128_t intersect_scene_aabb(v128_t ox, v128_t oy, v128_t oz, v128_t dx, v128_t dy, v128_t dz, v128_t* t_near, v128_t* t_far) {
+  v128_t one = f32x4_splat(1.0f);
+  v128_t tiny = f32x4_splat(1e-6f);
+
+  // Axis-parallel rays would produce 0 * inf below, so nudge them off zero
+  dx = v128_bitselect(tiny, dx, f32x4_lt(f32x4_abs(dx), tiny));
+  dy = v128_bitselect(tiny, dy, f32x4_lt(f32x4_abs(dy), tiny));
+  dz = v128_bitselect(tiny, dz, f32x4_lt(f32x4_abs(dz), tiny));
+
+  v128_t inv_x = f32x4_div(one, dx);
+  v128_t inv_y = f32x4_div(one, dy);
+  v128_t inv_z = f32x4_div(one, dz);
+
+  v128_t tx0 = f32x4_mul(f32x4_sub(f32x4_splat(scene_aabb_min[0]), ox), inv_x);
+  v128_t tx1 = f32x4_mul(f32x4_sub(f32x4_splat(scene_aabb_max[0]), ox), inv_x);
+  v128_t ty0 = f32x4_mul(f32x4_sub(f32x4_splat(scene_aabb_min[1]), oy), inv_y);
+  v128_t ty1 = f32x4_mul(f32x4_sub(f32x4_splat(scene_aabb_max[1]), oy), inv_y);
+  v128_t tz0 = f32x4_mul(f32x4_sub(f32x4_splat(scene_aabb_min[2]), oz), inv_z);
+  v128_t tz1 = f32x4_mul(f32x4_sub(f32x4_splat(scene_aabb_max[2]), oz), inv_z);
+
+  v128_t near = f32x4_max(
+    f32x4_max(f32x4_min(tx0, tx1), f32x4_min(ty0, ty1)),
+    f32x4_max(f32x4_min(tz0, tz1), zero_simd));
+  v128_t far = f32x4_min(
+    f32x4_min(f32x4_max(tx0, tx1), f32x4_max(ty0, ty1)),
+    f32x4_min(f32x4_max(tz0, tz1), max_dist_simd));
+
+  *t_near = near;
+  *t_far = far;
+  return f32x4_le(near, far);
+}
+
+//////////
+// GRID //
+//////////
+// Uniform grid over the padded scene AABB. Each cell lists, in ascending
+// shape order, every shape whose AABB grown by grid_margin (smooth_k plus a
+// fraction of a cell) touches the cell, so any shape left out of a cell is at
+// least that far beyond the cell's walls. scene_sdf() clamps its result to
+// that distance, which keeps sphere tracing from stepping past shapes it did
+// not evaluate.
+u8 grid_build(void) {
+  f32 extent[3];
+  for (u32 a = 0; a < 3; a++) {
+    grid_min[a] = scene_aabb_min[a];
+    extent[a] = maxf(scene_aabb_max[a] - scene_aabb_min[a], 1e-3f);
+  }
+
+  // Aim for roughly one shape per cell, coarsening if the lists overflow
+  f32 volume = extent[0] * extent[1] * extent[2];
+  f32 target = clampf((f32)shape_count, 1.0f, (f32)GRID_MAX_CELLS);
+  f32 cell = cbrtf_approx(volume / target);
+  cell = maxf(cell, maxf(extent[0], maxf(extent[1], extent[2])) / (f32)GRID_MAX_DIM);
+
+  for (u32 attempt = 0; attempt < GRID_BUILD_ATTEMPTS; attempt++, cell *= 2.0f) {
+    if (grid_bin(extent, cell)) return 1;
+  }
+  return 0;
+}
+
+u8 grid_bin(const f32* extent, f32 cell) {
+  for (u32 a = 0; a < 3; a++) {
+    u32 dim = (u32)(extent[a] / cell) + 1;
+    grid_dim[a] = dim < GRID_MAX_DIM ? dim : GRID_MAX_DIM;
+    grid_cell_size[a] = extent[a] / (f32)grid_dim[a];
+    grid_inv_cell_size[a] = 1.0f / grid_cell_size[a];
+  }
+
+  u32 cell_count = grid_dim[0] * grid_dim[1] * grid_dim[2];
+
+  // Shapes are binned with some slack so rays are not held to tiny steps
+  // near the cell walls
+  grid_margin = smooth_k + GRID_MARGIN * minf(grid_cell_size[0], minf(grid_cell_size[1], grid_cell_size[2]));
+
+  // Pass 1: the cells each shape touches, and the entries they add up to
+  u32 total = 0;
+  for (u32 i = 0; i < shape_count; i++) {
+    u8* span = &grid_shape_span[i * 6];
+    for (u32 a = 0; a < 3; a++) {
+      f32 fmin = (shape_aabb[i * 6 + a] - grid_margin - grid_min[a]) * grid_inv_cell_size[a];
+      f32 fmax = (shape_aabb[i * 6 + a + 3] + grid_margin - grid_min[a]) * grid_inv_cell_size[a];
+      span[a] = (u8)clampf(fmin, 0.0f, (f32)(grid_dim[a] - 1));
+      span[a + 3] = (u8)clampf(fmax, 0.0f, (f32)(grid_dim[a] - 1));
+    }
+    total += (u32)(span[3] - span[0] + 1) * (u32)(span[4] - span[1] + 1) * (u32)(span[5] - span[2] + 1);
+  }
+
+  if (total > GRID_MAX_ENTRIES) return 0;
+  if (total > grid_item_capacity && !reserve_lists(total, tile_item_capacity)) return 0;
 
-  v128_t done = wasm_i32x4_splat(0);
-  v128_t valid = wasm_i32x4_make(hit_mask[0], hit_mask[1], hit_mask[2], hit_mask[3]);
+  // Pass 2: count entries per cell (offset by one for the prefix sum)
+  for (u32 c = 0; c <= cell_count; c++) grid_cell_start[c] = 0;
+  for (u32 i = 0; i < shape_count; i++) {
+    const u8* span = &grid_shape_span[i * 6];
+    for (u32 z = span[2]; z <= span[5]; z++) {
+      for (u32 y = span[1]; y <= span[4]; y++) {
+        for (u32 x = span[0]; x <= span[3]; x++) {
+          grid_cell_start[(z * grid_dim[1] + y) * grid_dim[0] + x + 1]++;
+        }
+      }
+    }
+  }
+
+  for (u32 c = 0; c < cell_count; c++) {
+    grid_cell_start[c + 1] += grid_cell_start[c];
+  }
 
+  // Pass 3: fill, walking shapes in order so every list stays sorted. Each
+  // cell's start doubles as its write cursor and is shifted back afterwards.
   for (u32 i = 0; i < shape_count; i++) {
-    perf_metrics[PERF_COLOR_LOOKUPS] += 1.0f;
+    const u8* span = &grid_shape_span[i * 6];
+    for (u32 z = span[2]; z <= span[5]; z++) {
+      for (u32 y = span[1]; y <= span[4]; y++) {
+        for (u32 x = span[0]; x <= span[3]; x++) {
+          grid_items[grid_cell_start[(z * grid_dim[1] + y) * grid_dim[0] + x]++] = (u16)i;
+        }
+      }
+    }
+  }
+
+  for (u32 c = cell_count; c > 0; c--) {
+    grid_cell_start[c] = grid_cell_start[c - 1];
+  }
+  grid_cell_start[0] = 0;
 
-    v128_t d = eval_shape(i, px, py, pz);
+  return 1;
+}
+
+// Finds the cell of every masked lane and prepares a merge of their lists.
+// cell_exit (optional) receives, per lane, the distance that shapes outside
+// the lane's cell list are guaranteed to keep.
+void grid_cursor_init(shape_cursor_t* cursor, v128_t px, v128_t py, v128_t pz, v128_t mask, v128_t* cell_exit) {
+  v128_t fx = f32x4_mul(f32x4_sub(px, f32x4_splat(grid_min[0])), f32x4_splat(grid_inv_cell_size[0]));
+  v128_t fy = f32x4_mul(f32x4_sub(py, f32x4_splat(grid_min[1])), f32x4_splat(grid_inv_cell_size[1]));
+  v128_t fz = f32x4_mul(f32x4_sub(pz, f32x4_splat(grid_min[2])), f32x4_splat(grid_inv_cell_size[2]));
+
+  v128_t zero = i32x4_splat(0);
+  v128_t ix = i32x4_min(i32x4_max(i32x4_trunc_sat_f32x4(fx), zero), i32x4_splat((i32)grid_dim[0] - 1));
+  v128_t iy = i32x4_min(i32x4_max(i32x4_trunc_sat_f32x4(fy), zero), i32x4_splat((i32)grid_dim[1] - 1));
+  v128_t iz = i32x4_min(i32x4_max(i32x4_trunc_sat_f32x4(fz), zero), i32x4_splat((i32)grid_dim[2] - 1));
+
+  if (cell_exit) {
+    // Distance from each lane to the nearest wall of its cell; lanes outside
+    // the grid get zero and only advance by the margin
+    v128_t lx = f32x4_sub(fx, f32x4_convert_i32x4(ix));
+    v128_t ly = f32x4_sub(fy, f32x4_convert_i32x4(iy));
+    v128_t lz = f32x4_sub(fz, f32x4_convert_i32x4(iz));
+    v128_t one = f32x4_splat(1.0f);
+    v128_t wx = f32x4_mul(f32x4_min(lx, f32x4_sub(one, lx)), f32x4_splat(grid_cell_size[0]));
+    v128_t wy = f32x4_mul(f32x4_min(ly, f32x4_sub(one, ly)), f32x4_splat(grid_cell_size[1]));
+    v128_t wz = f32x4_mul(f32x4_min(lz, f32x4_sub(one, lz)), f32x4_splat(grid_cell_size[2]));
+    v128_t wall = f32x4_max(f32x4_min(wx, f32x4_min(wy, wz)), zero_simd);
+    *cell_exit = f32x4_add(wall, f32x4_splat(grid_margin));
+  }
 
-    v128_t is_closer = wasm_f32x4_lt(d, min_dist);
-    v128_t should_update = wasm_v128_and(is_closer, wasm_v128_andnot(valid, done));
+  v128_t cell = i32x4_add(ix, i32x4_mul(
+    i32x4_add(iy, i32x4_mul(iz, i32x4_splat((i32)grid_dim[1]))),
+    i32x4_splat((i32)grid_dim[0])));
 
-    min_dist = wasm_v128_bitselect(d, min_dist, should_update);
+  i32 cells[4];
+  i32 lanes[4];
+  v128_store(cells, cell);
+  v128_store(lanes, mask);
 
-    closest_r = wasm_v128_bitselect(shape_r[i], closest_r, should_update);
-    closest_g = wasm_v128_bitselect(shape_g[i], closest_g, should_update);
-    closest_b = wasm_v128_bitselect(shape_b[i], closest_b, should_update);
+  cursor->items = grid_items;
+  cursor->lists = 0;
+  for (u32 l = 0; l < 4; l++) {
+    if (!lanes[l]) continue;
 
-    v128_t very_close = wasm_f32x4_lt(d, hit_thresh);
-    done = wasm_v128_or(done, wasm_v128_and(should_update, very_close));
+    u32 seen = 0;
+    for (u32 k = 0; k < l; k++) {
+      if (lanes[k] && cells[k] == cells[l]) seen = 1;
+    }
+    if (seen) continue;
 
-    v128_t all_done = wasm_v128_or(done, wasm_v128_not(valid));
-    if (wasm_i32x4_all_true(all_done)) break;
+    cursor->cur[cursor->lists] = grid_cell_start[cells[l]];
+    cursor->end[cursor->lists] = grid_cell_start[cells[l] + 1];
+    cursor->lists++;
   }
+}
 
-  wasm_v128_store(out_cr, closest_r);
-  wasm_v128_store(out_cg, closest_g);
-  wasm_v128_store(out_cb, closest_b);
+// Next shape of the union of the cursor's lists, in ascending order with
+// duplicates removed, so smooth groups blend in the same order as linear mode
+u32 shape_cursor_next(shape_cursor_t* cursor) {
+  u32 next = shape_cursor_peek(cursor);
+  shape_cursor_skip(cursor, next);
+  return next;
 }
 
-// =============================================================================
-// API Implementation
-// =============================================================================
+// The smallest shape index left in any list, or CURSOR_END
+u32 shape_cursor_peek(const shape_cursor_t* cursor) {
+  u32 next = CURSOR_END;
+  for (u32 l = 0; l < cursor->lists; l++) {
+    if (cursor->cur[l] < cursor->end[l] && cursor->items[cursor->cur[l]] < next) {
+      next = cursor->items[cursor->cur[l]];
+    }
+  }
+  return next;
+}
+
+// Steps every list past shape i, which shape_cursor_peek() returned
+void shape_cursor_skip(shape_cursor_t* cursor, u32 i) {
+  for (u32 l = 0; l < cursor->lists; l++) {
+    if (cursor->cur[l] < cursor->end[l] && cursor->items[cursor->cur[l]] == i) {
+      cursor->cur[l]++;
+    }
+  }
+}
 
-f32* get_perf_metrics_ptr(void) {
-  return perf_metrics;
+// Takes the cursor's next shapes that fall in one run, up to
+// SHAPE_SPAN_MAX, into `span` and the run's index into *run. Sorted indices
+// ascend run by run, so *run only moves forward; start it at 0. Returns the
+// span length, 0 once the cursor is done.
+u32 shape_cursor_span(shape_cursor_t* cursor, u32* run, u16* span) {
+  u32 i = shape_cursor_peek(cursor);
+  if (i >= shape_count) return 0;
+  while (i >= shape_runs[*run].first + shape_runs[*run].count) (*run)++;
+
+  u32 end = shape_runs[*run].first + shape_runs[*run].count;
+  u32 count = 0;
+  while (count < SHAPE_SPAN_MAX && i < end) {
+    span[count++] = (u16)i;
+    shape_cursor_skip(cursor, i);
+    i = shape_cursor_peek(cursor);
+  }
+  return count;
 }
 
-void reset_perf_metrics(void) {
-  for (int i = 0; i < PERF_METRICS_SIZE; i++) perf_metrics[i] = 0.0f;
+// Appends the lists of `other` that `cursor` does not already walk
+void shape_cursor_merge(shape_cursor_t* cursor, const shape_cursor_t* other) {
+  for (u32 k = 0; k < other->lists; k++) {
+    u32 seen = 0;
+    for (u32 l = 0; l < cursor->lists; l++) {
+      if (cursor->cur[l] == other->cur[k] && cursor->end[l] == other->end[k]) seen = 1;
+    }
+    if (seen) continue;
+
+    cursor->cur[cursor->lists] = other->cur[k];
+    cursor->end[cursor->lists] = other->end[k];
+    cursor->lists++;
+  }
+}
+
+///////////
+// TILES //
+///////////
+// Screen rectangle, in tiles, covered by shape i's bounding sphere grown by
+// the same blend padding as the scene AABB
+u8 tile_span(u32 i, u16* span) {
+  return sphere_tile_span(shape_bounds[i * 4], shape_bounds[i * 4 + 1], shape_bounds[i * 4 + 2],
+    shape_bounds[i * 4 + 3] + smooth_k * 2.0f, span);
+}
+
+// Screen rectangle, in tiles, covered by a sphere. Uses the sphere's tangent
+// slopes in the right/forward and up/forward planes plus a pixel of padding,
+// so the rectangle is conservative.
+u8 sphere_tile_span(f32 cx, f32 cy, f32 cz, f32 r, u16* span) {
+  f32 rx = cx - cam_eye[0];
+  f32 ry = cy - cam_eye[1];
+  f32 rz = cz - cam_eye[2];
+
+  f32 x = rx * cam_right[0] + ry * cam_right[1] + rz * cam_right[2];
+  f32 y = rx * cam_up[0] + ry * cam_up[1] + rz * cam_up[2];
+  f32 z = rx * cam_forward[0] + ry * cam_forward[1] + rz * cam_forward[2];
+
+  if (z + r <= 0.0f) return 0;
+
+  // A sphere reaching the eye plane can project anywhere
+  f32 u_min = -1.0f, u_max = 1.0f;
+  f32 v_min = -1.0f, v_max = 1.0f;
+  if (z > r) {
+    f32 inv_denom = 1.0f / (z * z - r * r);
+    f32 sx = r * sqrtf_approx(maxf(x * x + z * z - r * r, 0.0f));
+    f32 sy = r * sqrtf_approx(maxf(y * y + z * z - r * r, 0.0f));
+    u_min = (x * z - sx) * inv_denom / cam_half_width;
+    u_max = (x * z + sx) * inv_denom / cam_half_width;
+    v_min = (y * z - sy) * inv_denom / cam_half_height;
+    v_max = (y * z + sy) * inv_denom / cam_half_height;
+  }
+
+  f32 max_col = (f32)(ray_width - 1);
+  f32 max_row = (f32)(ray_height - 1);
+  f32 c0 = (u_min + 1.0f) * 0.5f * max_col - 1.0f;
+  f32 c1 = (u_max + 1.0f) * 0.5f * max_col + 1.0f;
+  f32 r0 = (1.0f - v_max) * 0.5f * max_row - 1.0f;
+  f32 r1 = (1.0f - v_min) * 0.5f * max_row + 1.0f;
+  if (c1 < 0.0f || r1 < 0.0f || c0 > max_col || r0 > max_row) return 0;
+
+  span[0] = (u16)((u32)clampf(c0, 0.0f, max_col) / TILE_SIZE);
+  span[1] = (u16)((u32)clampf(r0, 0.0f, max_row) / TILE_SIZE);
+  span[2] = (u16)((u32)clampf(c1, 0.0f, max_col) / TILE_SIZE);
+  span[3] = (u16)((u32)clampf(r1, 0.0f, max_row) / TILE_SIZE);
+  return 1;
+}
+
+u32 ray_tile(u32 idx) {
+  u32 row = idx / ray_width;
+  u32 col = idx - row * ray_width;
+  return (row / TILE_SIZE) * tiles_x + col / TILE_SIZE;
 }
 
+// Axis and half-angle tangent of a cone around every ray of tile t: the axis
+// is the mean of the corner rays and the angle reaches the widest of them,
+// which bounds the rays in between
+void tile_cone(u32 t, f32* dir, f32* tan_half) {
+  u32 ty = t / tiles_x;
+  u32 tx = t - ty * tiles_x;
+  u32 col0 = tx * TILE_SIZE;
+  u32 row0 = ty * TILE_SIZE;
+  u32 col1 = col0 + TILE_SIZE - 1 < ray_width ? col0 + TILE_SIZE - 1 : ray_width - 1;
+  u32 row1 = row0 + TILE_SIZE - 1 < ray_height ? row0 + TILE_SIZE - 1 : ray_height - 1;
+
+  f32 inv_w = 1.0f / (f32)(ray_width - 1);
+  f32 inv_h = 1.0f / (f32)(ray_height - 1);
+  f32 corners[4][3];
+  for (u32 c = 0; c < 4; c++) {
+    f32 u = 2.0f * (f32)(c & 1 ? col1 : col0) * inv_w - 1.0f;
+    f32 v = 1.0f - 2.0f * (f32)(c & 2 ? row1 : row0) * inv_h;
+    f32 x = cam_forward[0] + u * cam_half_width * cam_right[0] + v * cam_half_height * cam_up[0];
+    f32 y = cam_forward[1] + u * cam_half_width * cam_right[1] + v * cam_half_height * cam_up[1];
+    f32 z = cam_forward[2] + u * cam_half_width * cam_right[2] + v * cam_half_height * cam_up[2];
+    f32 inv_len = 1.0f / sqrtf_approx(x * x + y * y + z * z);
+    corners[c][0] = x * inv_len;
+    corners[c][1] = y * inv_len;
+    corners[c][2] = z * inv_len;
+  }
+
+  f32 ax = corners[0][0] + corners[1][0] + corners[2][0] + corners[3][0];
+  f32 ay = corners[0][1] + corners[1][1] + corners[2][1] + corners[3][1];
+  f32 az = corners[0][2] + corners[1][2] + corners[2][2] + corners[3][2];
+  f32 inv_len = 1.0f / sqrtf_approx(ax * ax + ay * ay + az * az);
+  dir[0] = ax * inv_len;
+  dir[1] = ay * inv_len;
+  dir[2] = az * inv_len;
+
+  f32 min_cos = 1.0f;
+  for (u32 c = 0; c < 4; c++) {
+    f32 cos_a = corners[c][0] * dir[0] + corners[c][1] * dir[1] + corners[c][2] * dir[2];
+    min_cos = minf(min_cos, cos_a);
+  }
+  // Rounded up slightly so the cone never comes out tighter than the rays
+  min_cos = clampf(min_cos - 1e-4f, 0.1f, 1.0f);
+  *tan_half = sqrtf_approx(maxf(1.0f - min_cos * min_cos, 0.0f)) / min_cos;
+}
+
+// Points `cursor` at the tile lists of `count` (4 or 8) rays, RAY_NONE for an
+// unused lane, and returns a bitmask of the lanes whose tile holds at least
+// one shape
+u32 packet_tiles(const u32* rays, u32 count, shape_cursor_t* cursor) {
+  u32 tiles[8];
+  u32 lanes = 0;
+
+  cursor->items = tile_items;
+  cursor->lists = 0;
+  for (u32 l = 0; l < count; l++) {
+    u32 idx = rays[l];
+    if (idx == RAY_NONE) continue;
+
+    u32 t = ray_tile(idx);
+    if (tile_start[t] == tile_start[t + 1]) continue;
+    lanes |= 1u << l;
+
+    u32 seen = 0;
+    for (u32 k = 0; k < cursor->lists; k++) {
+      if (tiles[k] == t) seen = 1;
+    }
+    if (seen) continue;
+
+    tiles[cursor->lists] = t;
+    cursor->cur[cursor->lists] = tile_start[t];
+    cursor->end[cursor->lists] = tile_start[t + 1];
+    cursor->lists++;
+  }
+  return lanes;
+}
+
+/////////
+// BVH //
+/////////
+// One BVH per group ID over the shapes' AABBs, rebuilt by set_scene(). Groups
+// are traversed separately so each keeps its own blend mode; within a group
+// the traversal is nearest-first and a subtree is skipped once every masked
+// lane is further from its box than the running group distance can reach.
+void bvh_build(void) {
+  u32 group_start[MAX_GROUPS + 1] = {0};
+
+  for (u32 i = 0; i < shape_count; i++) {
+    u32 g = sorted_groups[i];
+    group_start[g + 1]++;
+  }
+  for (u32 g = 0; g < MAX_GROUPS; g++) {
+    group_start[g + 1] += group_start[g];
+  }
+
+  u32 cursor[MAX_GROUPS];
+  for (u32 g = 0; g < MAX_GROUPS; g++) cursor[g] = group_start[g];
+  for (u32 i = 0; i < shape_count; i++) {
+    u32 g = sorted_groups[i];
+    bvh_shape_index[cursor[g]++] = i;
+  }
+
+  bvh_node_count = 0;
+  for (u32 g = 0; g < MAX_GROUPS; g++) {
+    u32 count = group_start[g + 1] - group_start[g];
+    bvh_group_root[g] = count > 0 ? bvh_build_node(group_start[g], count) : BVH_NONE;
+  }
+}
+
+u32 bvh_build_node(u32 first, u32 count) {
+  u32 index = bvh_node_count++;
+  bvh_node_t* node = &bvh_nodes[index];
+
+  f32 cmin[3] = {1e10f, 1e10f, 1e10f};
+  f32 cmax[3] = {-1e10f, -1e10f, -1e10f};
+  node->min[0] = node->min[1] = node->min[2] = 1e10f;
+  node->max[0] = node->max[1] = node->max[2] = -1e10f;
+
+  for (u32 i = first; i < first + count; i++) {
+    const f32* box = &shape_aabb[bvh_shape_index[i] * 6];
+    for (u32 a = 0; a < 3; a++) {
+      node->min[a] = minf(node->min[a], box[a]);
+      node->max[a] = maxf(node->max[a], box[a + 3]);
+      f32 c = (box[a] + box[a + 3]) * 0.5f;
+      cmin[a] = minf(cmin[a], c);
+      cmax[a] = maxf(cmax[a], c);
+    }
+  }
+
+  node->first = first;
+  node->count = count;
+  node->right = BVH_NONE;
+  if (count <= BVH_LEAF_SIZE) return index;
+
+  u32 axis = 0;
+  if (cmax[1] - cmin[1] > cmax[axis] - cmin[axis]) axis = 1;
+  if (cmax[2] - cmin[2] > cmax[axis] - cmin[axis]) axis = 2;
+
+  // Median split keeps the tree balanced, so depth stays log2(count)
+  u32 half = count / 2;
+  bvh_select(first, count, half, axis);
+
+  bvh_build_node(first, half);
+  u32 right = bvh_build_node(first + half, count - half);
+  bvh_nodes[index].right = right;
+  return index;
+}
+
+// Quickselect on shape centroids: afterwards bvh_shape_index[first + nth] holds
+// the nth smallest centroid along `axis`, with smaller ones before it.
+void bvh_select(u32 first, u32 count, u32 nth, u32 axis) {
+  u32 lo = first;
+  u32 hi = first + count - 1;
+  u32 target = first + nth;
+
+  while (lo < hi) {
+    u32 pivot_shape = bvh_shape_index[(lo + hi) / 2];
+    f32 pivot = shape_aabb[pivot_shape * 6 + axis] + shape_aabb[pivot_shape * 6 + axis + 3];
+
+    u32 i = lo;
+    u32 j = hi;
+    while (i <= j) {
+      while (shape_aabb[bvh_shape_index[i] * 6 + axis] + shape_aabb[bvh_shape_index[i] * 6 + axis + 3] < pivot) i++;
+      while (shape_aabb[bvh_shape_index[j] * 6 + axis] + shape_aabb[bvh_shape_index[j] * 6 + axis + 3] > pivot) j--;
+      if (i <= j) {
+        u32 tmp = bvh_shape_index[i];
+        bvh_shape_index[i] = bvh_shape_index[j];
+        bvh_shape_index[j] = tmp;
+        i++;
+        if (j == 0) break;
+        j--;
+      }
+    }
+
+    if (target <= j) hi = j;
+    else if (target >= i) lo = i;
+    else break;
+  }
+}
+
+v128_t bvh_node_dist_sq(const bvh_node_t* node, v128_t px, v128_t py, v128_t pz) {
+  v128_t qx = f32x4_max(f32x4_max(
+    f32x4_sub(f32x4_splat(node->min[0]), px),
+    f32x4_sub(px, f32x4_splat(node->max[0]))), zero_simd);
+  v128_t qy = f32x4_max(f32x4_max(
+    f32x4_sub(f32x4_splat(node->min[1]), py),
+    f32x4_sub(py, f32x4_splat(node->max[1]))), zero_simd);
+  v128_t qz = f32x4_max(f32x4_max(
+    f32x4_sub(f32x4_splat(node->min[2]), pz),
+    f32x4_sub(pz, f32x4_splat(node->max[2]))), zero_simd);
+  return f32x4_add(f32x4_add(
+    f32x4_mul(qx, qx),
+    f32x4_mul(qy, qy)),
+    f32x4_mul(qz, qz));
+}
+
+// A point inside the box can be inside a shape, so only lanes strictly
+// outside the box are ever culled.
+u8 bvh_cull_node(const bvh_node_t* node, v128_t px, v128_t py, v128_t pz, v128_t limit, v128_t mask) {
+  v128_t dist_sq = bvh_node_dist_sq(node, px, py, pz);
+  v128_t far = v128_and(
+    f32x4_gt(dist_sq, zero_simd),
+    v128_or(
+      f32x4_lt(limit, zero_simd),
+      f32x4_ge(dist_sq, f32x4_mul(limit, limit))));
+  return i32x4_all_true(v128_or(far, v128_not(mask)));
+}
+
+// Folds every shape of BVH group `g` that can affect the masked lanes into
+// *acc, using min() for blend 0 and the smooth union otherwise. When closest
+// is non-null, it also tracks the nearest evaluated shape per lane.
+void bvh_eval_group(u32 g, v128_t px, v128_t py, v128_t pz, v128_t mask, u8 blend, v128_t* acc, u8* initialized, closest_shape_t* closest, u32* evaluated, u32* culled) {
+  if (bvh_group_root[g] == BVH_NONE) return;
+
+  v128_t slack = blend == 0 ? zero_simd : smooth_k_simd;
+
+  u32 stack[BVH_STACK_SIZE];
+  u32 sp = 0;
+  stack[sp++] = bvh_group_root[g];
+
+  while (sp > 0) {
+    const bvh_node_t* node = &bvh_nodes[stack[--sp]];
+
+    if (*initialized && bvh_cull_node(node, px, py, pz, f32x4_add(*acc, slack), mask)) {
+      *culled += node->count;
+      continue;
+    }
+
+    if (node->count > BVH_LEAF_SIZE) {
+      u32 left = (u32)(node - bvh_nodes) + 1;
+      u32 right = node->right;
+      f32 dl[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      f32 dr[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      if (blend == 0) {
+        v128_store(dl, v128_and(bvh_node_dist_sq(&bvh_nodes[left], px, py, pz), mask));
+        v128_store(dr, v128_and(bvh_node_dist_sq(&bvh_nodes[right], px, py, pz), mask));
+      }
+
+      // The smooth union is order dependent, so smooth groups always fold in
+      // the tree's fixed left-to-right order to keep the field continuous.
+      // min() is not, so hard groups visit the nearer child first to tighten
+      // *acc sooner.
+      if (blend != 0 || dl[0] + dl[1] + dl[2] + dl[3] <= dr[0] + dr[1] + dr[2] + dr[3]) {
+        stack[sp++] = right;
+        stack[sp++] = left;
+      } else {
+        stack[sp++] = left;
+        stack[sp++] = right;
+      }
+      continue;
+    }
+
+    for (u32 k = node->first; k < node->first + node->count; k++) {
+      u32 i = bvh_shape_index[k];
+
+      if (*initialized && cull_shape(i, px, py, pz, f32x4_add(*acc, slack), mask)) {
+        (*culled)++;
+        continue;
+      }
+
+      (*evaluated)++;
+      v128_t d = eval_shape(i, px, py, pz);
+      if (closest) closest_update(closest, k, i, d, *initialized ? f32x4_add(*acc, slack) : max_dist_simd);
+
+      if (!*initialized) {
+        *acc = d;
+        *initialized = 1;
+      } else if (blend == 0) {
+        *acc = f32x4_min(*acc, d);
+      } else {
+        *acc = sdf_smooth_union(*acc, d, smooth_k_simd);
+      }
+    }
+  }
+}
+
+// bvh_eval_group() carrying the gradient along with the distance, for
+// scene_sdf_grad(); the traversal order and culling are the same
+void bvh_eval_group_grad(u32 g, v128_t px, v128_t py, v128_t pz, v128_t mask, u8 blend, sdf_grad_t* acc, u8* initialized, u32* evaluated, u32* culled) {
+  if (bvh_group_root[g] == BVH_NONE) return;
+
+  v128_t slack = blend == 0 ? zero_simd : smooth_k_simd;
+
+  u32 stack[BVH_STACK_SIZE];
+  u32 sp = 0;
+  stack[sp++] = bvh_group_root[g];
+
+  while (sp > 0) {
+    const bvh_node_t* node = &bvh_nodes[stack[--sp]];
+
+    if (*initialized && bvh_cull_node(node, px, py, pz, f32x4_add(acc->d, slack), mask)) {
+      *culled += node->count;
+      continue;
+    }
+
+    if (node->count > BVH_LEAF_SIZE) {
+      u32 left = (u32)(node - bvh_nodes) + 1;
+      u32 right = node->right;
+      f32 dl[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      f32 dr[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      if (blend == 0) {
+        v128_store(dl, v128_and(bvh_node_dist_sq(&bvh_nodes[left], px, py, pz), mask));
+        v128_store(dr, v128_and(bvh_node_dist_sq(&bvh_nodes[right], px, py, pz), mask));
+      }
+      if (blend != 0 || dl[0] + dl[1] + dl[2] + dl[3] <= dr[0] + dr[1] + dr[2] + dr[3]) {
+        stack[sp++] = right;
+        stack[sp++] = left;
+      } else {
+        stack[sp++] = left;
+        stack[sp++] = right;
+      }
+      continue;
+    }
+
+    for (u32 k = node->first; k < node->first + node->count; k++) {
+      u32 i = bvh_shape_index[k];
+
+      if (*initialized && cull_shape(i, px, py, pz, f32x4_add(acc->d, slack), mask)) {
+        (*culled)++;
+        continue;
+      }
+
+      (*evaluated)++;
+      sdf_grad_t d;
+      eval_shape_grad(i, px, py, pz, &d);
+      grad_fold(acc, initialized, blend, &d);
+    }
+  }
+}
+
+// bvh_eval_group() for two packets in one traversal: a node or shape is
+// skipped only when both packets can cull it, and every shape that survives
+// is evaluated for both through eval_shape2()
+void bvh_eval_group2(u32 g, v128_t px0, v128_t py0, v128_t pz0, v128_t mask0, v128_t px1, v128_t py1, v128_t pz1, v128_t mask1, u8 blend, v128_t* acc0, v128_t* acc1, u8* initialized, closest_shape_t* closest0, closest_shape_t* closest1, u32* evaluated, u32* culled) {
+  if (bvh_group_root[g] == BVH_NONE) return;
+
+  v128_t slack = blend == 0 ? zero_simd : smooth_k_simd;
+
+  u32 stack[BVH_STACK_SIZE];
+  u32 sp = 0;
+  stack[sp++] = bvh_group_root[g];
+
+  while (sp > 0) {
+    const bvh_node_t* node = &bvh_nodes[stack[--sp]];
+
+    if (*initialized &&
+        bvh_cull_node(node, px0, py0, pz0, f32x4_add(*acc0, slack), mask0) &&
+        bvh_cull_node(node, px1, py1, pz1, f32x4_add(*acc1, slack), mask1)) {
+      *culled += node->count * 2;
+      continue;
+    }
+
+    if (node->count > BVH_LEAF_SIZE) {
+      u32 left = (u32)(node - bvh_nodes) + 1;
+      u32 right = node->right;
+      f32 dl[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      f32 dr[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      if (blend == 0) {
+        v128_store(dl, f32x4_add(
+          v128_and(bvh_node_dist_sq(&bvh_nodes[left], px0, py0, pz0), mask0),
+          v128_and(bvh_node_dist_sq(&bvh_nodes[left], px1, py1, pz1), mask1)));
+        v128_store(dr, f32x4_add(
+          v128_and(bvh_node_dist_sq(&bvh_nodes[right], px0, py0, pz0), mask0),
+          v128_and(bvh_node_dist_sq(&bvh_nodes[right], px1, py1, pz1), mask1)));
+      }
+
+      // Same visiting order rules as bvh_eval_group()
+      if (blend != 0 || dl[0] + dl[1] + dl[2] + dl[3] <= dr[0] + dr[1] + dr[2] + dr[3]) {
+        stack[sp++] = right;
+        stack[sp++] = left;
+      } else {
+        stack[sp++] = left;
+        stack[sp++] = right;
+      }
+      continue;
+    }
+
+    for (u32 k = node->first; k < node->first + node->count; k++) {
+      u32 i = bvh_shape_index[k];
+
+      if (*initialized &&
+          cull_shape(i, px0, py0, pz0, f32x4_add(*acc0, slack), mask0) &&
+          cull_shape(i, px1, py1, pz1, f32x4_add(*acc1, slack), mask1)) {
+        *culled += 2;
+        continue;
+      }
+
+      *evaluated += 2;
+      v128_t d0, d1;
+      eval_shape2(i, px0, py0, pz0, px1, py1, pz1, &d0, &d1);
+      if (closest0) {
+        closest_update(closest0, k, i, d0, *initialized ? f32x4_add(*acc0, slack) : max_dist_simd);
+        closest_update(closest1, k, i, d1, *initialized ? f32x4_add(*acc1, slack) : max_dist_simd);
+      }
+
+      if (!*initialized) {
+        *acc0 = d0;
+        *acc1 = d1;
+        *initialized = 1;
+      } else if (blend == 0) {
+        *acc0 = f32x4_min(*acc0, d0);
+        *acc1 = f32x4_min(*acc1, d1);
+      } else {
+        *acc0 = sdf_smooth_union(*acc0, d0, smooth_k_simd);
+        *acc1 = sdf_smooth_union(*acc1, d1, smooth_k_simd);
+      }
+    }
+  }
+}
+
+// =============================================================================
+// API Implementation
+// =============================================================================
+
 f32* get_bg_ptr(void) { return bg_color; }
 
 u8* get_shape_types_ptr(void) { return shape_types; }
@@ -484,11 +2806,13 @@ f32* get_shape_params_ptr(void) { return shape_params; }
 f32* get_shape_positions_ptr(void) { return shape_positions; }
 f32* get_shape_colors_ptr(void) { return shape_colors; }
 u8* get_shape_groups_ptr(void) { return shape_groups; }
+u16* get_shape_order_ptr(void) { return shape_order; }
 u8* get_group_blend_modes_ptr(void) { return group_blend_mode; }
+f32* get_group_glow_ptr(void) { return group_glow; }
 
 void init_simd_constants(void) {
-  max_dist_simd = wasm_f32x4_splat(MAX_DIST);
-  zero_simd = wasm_f32x4_splat(0.0f);
+  max_dist_simd = f32x4_splat(MAX_DIST);
+  zero_simd = f32x4_splat(0.0f);
 }
 
 void set_lighting(f32 ambient, f32 dir_x, f32 dir_y, f32 dir_z, f32 intensity) {
@@ -502,11 +2826,11 @@ void set_lighting(f32 ambient, f32 dir_x, f32 dir_y, f32 dir_z, f32 intensity) {
     light_dir[2] = dir_z / len;
   }
 
-  light_x_simd = wasm_f32x4_splat(light_dir[0]);
-  light_y_simd = wasm_f32x4_splat(light_dir[1]);
-  light_z_simd = wasm_f32x4_splat(light_dir[2]);
-  ambient_simd = wasm_f32x4_splat(ambient_weight);
-  diffuse_simd = wasm_f32x4_splat(intensity);
+  light_x_simd = f32x4_splat(light_dir[0]);
+  light_y_simd = f32x4_splat(light_dir[1]);
+  light_z_simd = f32x4_splat(light_dir[2]);
+  ambient_simd = f32x4_splat(ambient_weight);
+  diffuse_simd = f32x4_splat(intensity);
 }
 
 void set_scene(u32 count, f32 k) {
@@ -515,59 +2839,99 @@ void set_scene(u32 count, f32 k) {
     simd_constants_initialized = 1;
   }
 
-  shape_count = count < MAX_SHAPES ? count : MAX_SHAPES;
+  u32 prev_count = shape_count;
+  f32 prev_k = smooth_k;
+  shape_count = count < shape_capacity ? count : shape_capacity;
   smooth_k = k;
-  smooth_k_simd = wasm_f32x4_splat(k);
+  moved_count = 0;
+  smooth_k_simd = f32x4_splat(k);
+  tiles_valid = 0;
+  cones_valid = 0;
 
   if (shape_count == 0) {
     scene_aabb_min[0] = scene_aabb_min[1] = scene_aabb_min[2] = -MAX_DIST;
     scene_aabb_max[0] = scene_aabb_max[1] = scene_aabb_max[2] = MAX_DIST;
+    bvh_enabled = 0;
+    grid_enabled = 0;
+    shape_run_count = 0;
     return;
   }
 
+  shape_sort();
+
   scene_aabb_min[0] = scene_aabb_min[1] = scene_aabb_min[2] = 1e10f;
   scene_aabb_max[0] = scene_aabb_max[1] = scene_aabb_max[2] = -1e10f;
 
   for (u32 i = 0; i < shape_count; i++) {
-    f32 cx = shape_positions[i * 3];
-    f32 cy = shape_positions[i * 3 + 1];
-    f32 cz = shape_positions[i * 3 + 2];
-
-    shape_cx[i] = wasm_f32x4_splat(cx);
-    shape_cy[i] = wasm_f32x4_splat(cy);
-    shape_cz[i] = wasm_f32x4_splat(cz);
-    shape_p0[i] = wasm_f32x4_splat(shape_params[i * 4]);
-    shape_p1[i] = wasm_f32x4_splat(shape_params[i * 4 + 1]);
-    shape_p2[i] = wasm_f32x4_splat(shape_params[i * 4 + 2]);
-    shape_r[i] = wasm_f32x4_splat(shape_colors[i * 3]);
-    shape_g[i] = wasm_f32x4_splat(shape_colors[i * 3 + 1]);
-    shape_b[i] = wasm_f32x4_splat(shape_colors[i * 3 + 2]);
+    u32 src = shape_order[i];
+    const f32* params = &shape_params[src * 4];
+    f32 cx = shape_positions[src * 3];
+    f32 cy = shape_positions[src * 3 + 1];
+    f32 cz = shape_positions[src * 3 + 2];
+
+    shape_cx[i] = f32x4_splat(cx);
+    shape_cy[i] = f32x4_splat(cy);
+    shape_cz[i] = f32x4_splat(cz);
+    shape_p0[i] = f32x4_splat(params[0]);
+    shape_p1[i] = f32x4_splat(params[1]);
+    shape_p2[i] = f32x4_splat(params[2]);
+    shape_r[i] = f32x4_splat(shape_colors[src * 3]);
+    shape_g[i] = f32x4_splat(shape_colors[src * 3 + 1]);
+    shape_b[i] = f32x4_splat(shape_colors[src * 3 + 2]);
 
     f32 ex, ey, ez;
-    if (shape_types[i] == SHAPE_SPHERE) {
-      f32 r = shape_params[i * 4];
+    f32 bcy = cy;
+    if (sorted_types[i] == SHAPE_SPHERE) {
+      f32 r = params[0];
       ex = ey = ez = r;
-    } else if (shape_types[i] == SHAPE_CYLINDER) {
-      f32 r = shape_params[i * 4];
-      f32 h = shape_params[i * 4 + 1];
+    } else if (sorted_types[i] == SHAPE_CYLINDER) {
+      f32 r = params[0];
+      f32 h = params[1];
       ex = h;
       ey = ez = r;
-    } else if (shape_types[i] == SHAPE_CONE) {
-      f32 r = shape_params[i * 4];
-      f32 h = shape_params[i * 4 + 1];
+    } else if (sorted_types[i] == SHAPE_CONE) {
+      f32 r = params[0];
+      f32 h = params[1];
       ex = ez = r;
       ey = h;
-    } else if (shape_types[i] == SHAPE_CYLINDER_Y) {
-      f32 r = shape_params[i * 4];
-      f32 h = shape_params[i * 4 + 1];
+      // The cone rises from its base at cy, so bound its midpoint instead
+      bcy = cy + h * 0.5f;
+    } else if (sorted_types[i] == SHAPE_CYLINDER_Y) {
+      f32 r = params[0];
+      f32 h = params[1];
       ex = ez = r;
       ey = h;
     } else {
-      ex = shape_params[i * 4];
-      ey = shape_params[i * 4 + 1];
-      ez = shape_params[i * 4 + 2];
+      ex = params[0];
+      ey = params[1];
+      ez = params[2];
+    }
+
+    f32 br;
+    if (sorted_types[i] == SHAPE_SPHERE) {
+      br = ex;
+    } else if (sorted_types[i] == SHAPE_CONE) {
+      br = sqrtf_approx(ex * ex + ey * ey * 0.25f);
+    } else {
+      br = sqrtf_approx(ex * ex + ey * ey + ez * ez);
     }
 
+    shape_bounds[i * 4] = cx;
+    shape_bounds[i * 4 + 1] = bcy;
+    shape_bounds[i * 4 + 2] = cz;
+    shape_bounds[i * 4 + 3] = br;
+    shape_bound_x[i] = shape_cx[i];
+    shape_bound_y[i] = f32x4_splat(bcy);
+    shape_bound_z[i] = shape_cz[i];
+    shape_bound_r[i] = f32x4_splat(br);
+
+    f32 aabb[6] = {cx - ex, cy - ey, cz - ez, cx + ex, cy + ey, cz + ez};
+    for (u32 a = 0; a < 6; a++) {
+      if (shape_aabb[i * 6 + a] != aabb[a]) shape_moved[i] = 1;
+      shape_aabb[i * 6 + a] = aabb[a];
+    }
+    if (shape_moved[i]) moved_shapes[moved_count++] = (u16)i;
+
     if (cx - ex < scene_aabb_min[0]) scene_aabb_min[0] = cx - ex;
     if (cy - ey < scene_aabb_min[1]) scene_aabb_min[1] = cy - ey;
     if (cz - ez < scene_aabb_min[2]) scene_aabb_min[2] = cz - ez;
@@ -583,12 +2947,93 @@ void set_scene(u32 count, f32 k) {
   scene_aabb_max[0] += padding;
   scene_aabb_max[1] += padding;
   scene_aabb_max[2] += padding;
+
+  // A different shape count or blend radius reshapes the whole field
+  if (shape_count != prev_count || smooth_k != prev_k) depth_valid = 0;
+
+  bvh_enabled = accel_mode == ACCEL_BVH ||
+    (accel_mode == ACCEL_AUTO && shape_count > ACCEL_AUTO_BVH_THRESHOLD);
+  if (bvh_enabled) bvh_build();
+
+  // Falls back to the linear path if the cell lists would overflow
+  grid_enabled = accel_mode == ACCEL_GRID && grid_build();
+}
+
+// Stable counting sort of the uploaded shapes by (group, type) into
+// shape_order, plus the run table. Unknown types evaluate as boxes and
+// out-of-range groups as group 0, so they sort the same way.
+void shape_sort(void) {
+  u32 run_start[MAX_SHAPE_RUNS + 1] = {0};
+  u8* keys = shape_keys;
+
+  for (u32 i = 0; i < shape_count; i++) {
+    u32 g = shape_groups[i] < MAX_GROUPS ? shape_groups[i] : 0;
+    u32 t = shape_types[i] < SHAPE_TYPE_COUNT ? shape_types[i] : SHAPE_BOX;
+    keys[i] = (u8)(g * SHAPE_TYPE_COUNT + t);
+    run_start[keys[i] + 1]++;
+  }
+  for (u32 r = 0; r < MAX_SHAPE_RUNS; r++) {
+    run_start[r + 1] += run_start[r];
+  }
+
+  shape_run_count = 0;
+  for (u32 r = 0; r < MAX_SHAPE_RUNS; r++) {
+    u32 count = run_start[r + 1] - run_start[r];
+    if (count == 0) continue;
+    shape_run_t* run = &shape_runs[shape_run_count++];
+    run->first = run_start[r];
+    run->count = count;
+    run->group = (u8)(r / SHAPE_TYPE_COUNT);
+    run->type = (u8)(r % SHAPE_TYPE_COUNT);
+  }
+
+  for (u32 i = 0; i < shape_count; i++) {
+    u32 slot = run_start[keys[i]]++;
+    u8 type = (u8)(keys[i] % SHAPE_TYPE_COUNT);
+    u8 group = (u8)(keys[i] / SHAPE_TYPE_COUNT);
+    shape_moved[slot] = shape_order[slot] != i || sorted_types[slot] != type || sorted_groups[slot] != group;
+    shape_order[slot] = (u16)i;
+    sorted_types[slot] = type;
+    sorted_groups[slot] = group;
+  }
 }
 
 void set_groups(u32 count) {
   group_count = count < MAX_GROUPS ? count : MAX_GROUPS;
+
+  glow_groups = 0;
+  for (u32 g = 0; g < group_count; g++) {
+    const f32* glow = &group_glow[g * 4];
+    if (glow[3] <= 0.0f || (glow[0] <= 0.0f && glow[1] <= 0.0f && glow[2] <= 0.0f)) continue;
+    glow_groups |= 1u << g;
+    glow_inv_radius_simd[g] = f32x4_splat(1.0f / glow[3]);
+  }
+}
+
+// Takes effect on the next set_scene()
+void set_accel_mode(u32 mode) {
+  accel_mode = mode <= ACCEL_GRID ? mode : ACCEL_AUTO;
+}
+
+u32 get_accel_mode(void) { return accel_mode; }
+
+void set_march_mode(u32 mode) {
+  march_mode = mode == MARCH_RELAXED ? MARCH_RELAXED : MARCH_SPHERE;
 }
 
+u32 get_march_mode(void) { return march_mode; }
+
+// Rays in flight per marcher/shading step: 4 (one packet) or 8 (two packets
+// interleaved through scene_sdf_masked2())
+void set_packet_width(u32 width) {
+  packet_width = width == 8 ? 8 : 4;
+}
+
+u32 get_packet_width(void) { return packet_width; }
+
+// Which simd.h backend this build uses (SIMD_BACKEND_*)
+u32 get_simd_backend(void) { return SIMD_BACKEND; }
+
 u32 get_max_shapes(void) { return MAX_SHAPES; }
 u32 get_max_groups(void) { return MAX_GROUPS; }
 
@@ -605,19 +3050,44 @@ f32* get_point_light_intensity_ptr(void) { return point_light_intensity; }
 f32* get_point_light_radius_ptr(void) { return point_light_radius; }
 u32 get_max_point_lights(void) { return MAX_POINT_LIGHTS; }
 
+// Keeps the lights that can add at least POINT_LIGHT_CUTOFF somewhere. The
+// attenuation I / (1 + (d / radius)^2) falls below the cutoff past
+// radius * sqrt(I / cutoff - 1), which becomes the light's reach; lights
+// with no intensity, no colour or no reach are dropped.
 void set_point_lights(u32 count) {
-  point_light_count = count < MAX_POINT_LIGHTS ? count : MAX_POINT_LIGHTS;
+  if (count > MAX_POINT_LIGHTS) count = MAX_POINT_LIGHTS;
 
-  for (u32 i = 0; i < point_light_count; i++) {
-    pl_x_simd[i] = wasm_f32x4_splat(point_light_x[i]);
-    pl_y_simd[i] = wasm_f32x4_splat(point_light_y[i]);
-    pl_z_simd[i] = wasm_f32x4_splat(point_light_z[i]);
-    pl_r_simd[i] = wasm_f32x4_splat(point_light_r[i]);
-    pl_g_simd[i] = wasm_f32x4_splat(point_light_g[i]);
-    pl_b_simd[i] = wasm_f32x4_splat(point_light_b[i]);
-    pl_intensity_simd[i] = wasm_f32x4_splat(point_light_intensity[i]);
-    pl_radius_simd[i] = wasm_f32x4_splat(point_light_radius[i]);
+  for (u32 k = 0; k < MAX_POINT_LIGHTS / 4; k++) {
+    light_pack_t* pack = &light_packs[k];
+    pack->x = pack->y = pack->z = f32x4_splat(0.0f);
+    pack->r = pack->g = pack->b = pack->x;
+    pack->intensity = pack->inv_radius_sq = pack->inv_reach_sq = pack->x;
+  }
+
+  point_light_count = 0;
+  for (u32 src = 0; src < count; src++) {
+    f32 intensity = point_light_intensity[src];
+    f32 radius = point_light_radius[src];
+    if (intensity <= POINT_LIGHT_CUTOFF || radius <= 0.0f) continue;
+    if (point_light_r[src] <= 0.0f && point_light_g[src] <= 0.0f && point_light_b[src] <= 0.0f) continue;
+
+    u32 i = point_light_count++;
+    f32 reach = radius * sqrtf_approx(intensity / POINT_LIGHT_CUTOFF - 1.0f);
+    pl_source[i] = (u8)src;
+    pl_reach[i] = reach;
+    f32* pack = (f32*)&light_packs[i / 4];
+    u32 lane = i % 4;
+    pack[0 * 4 + lane] = point_light_x[src];
+    pack[1 * 4 + lane] = point_light_y[src];
+    pack[2 * 4 + lane] = point_light_z[src];
+    pack[3 * 4 + lane] = point_light_r[src];
+    pack[4 * 4 + lane] = point_light_g[src];
+    pack[5 * 4 + lane] = point_light_b[src];
+    pack[6 * 4 + lane] = intensity;
+    pack[7 * 4 + lane] = 1.0f / (radius * radius);
+    pack[8 * 4 + lane] = 1.0f / (reach * reach);
   }
+  light_tiles_valid = 0;
 }
 
 void set_camera(f32 ex, f32 ey, f32 ez, f32 fx, f32 fy, f32 fz, f32 rx, f32 ry, f32 rz, f32 ux, f32 uy, f32 uz, f32 halfW, f32 halfH) {
@@ -627,11 +3097,18 @@ void set_camera(f32 ex, f32 ey, f32 ez, f32 fx, f32 fy, f32 fz, f32 rx, f32 ry,
   cam_up[0] = ux; cam_up[1] = uy; cam_up[2] = uz;
   cam_half_width = halfW;
   cam_half_height = halfH;
+  tiles_valid = 0;
+  cones_valid = 0;
+  light_tiles_valid = 0;
 }
 
+// Grows the ray buffers to fit the grid; if memory cannot grow, the rays
+// past the current capacity are dropped
 void generate_rays(u32 width, u32 height) {
+  u64 start = perf_now();
   u32 count = width * height;
-  if (count > MAX_RAYS) count = MAX_RAYS;
+  if (count > ray_capacity) resize_buffers(count, upscale_capacity);
+  if (count > ray_capacity) count = ray_capacity;
 
   f32 inv_w = 1.0f / (f32)(width - 1);
   f32 inv_h = 1.0f / (f32)(height - 1);
@@ -641,7 +3118,7 @@ void generate_rays(u32 width, u32 height) {
 
     for (u32 col = 0; col < width; col++) {
       u32 idx = row * width + col;
-      if (idx >= MAX_RAYS) break;
+      if (idx >= ray_capacity) break;
 
       f32 u = 2.0f * (f32)col * inv_w - 1.0f;
 
@@ -668,6 +3145,207 @@ void generate_rays(u32 width, u32 height) {
   }
 
   ray_count = count;
+  ray_width = width;
+  ray_height = height;
+  tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+  tiles_valid = 0;
+  cones_valid = 0;
+  light_tiles_valid = 0;
+  perf_stage(PERF_STAGE_RAYS, start);
+}
+
+// Pre-pass after generate_rays(): lists, per tile, every shape whose bound
+// projects onto it, in ascending shape order. march_rays() then evaluates only
+// those shapes (linear mode) and writes background for empty tiles without
+// marching. set_scene(), set_camera() and generate_rays() drop the lists; if
+// they would overflow, march_rays() keeps the global loop. The lists grow
+// with the scene (reserve_lists()), which can grow memory, so JS calls this
+// through binTiles().
+void bin_tiles(void) {
+  u64 start = perf_now();
+  tile_lists_build();
+  perf_stage(PERF_STAGE_TILES, start);
+}
+
+void tile_lists_build(void) {
+  tiles_valid = 0;
+  if (ray_width < 2 || ray_height < 2) return;
+
+  u32 tile_count = tiles_x * tiles_y;
+  if (tile_count > tile_capacity) return;
+
+  for (u32 t = 0; t <= tile_count; t++) tile_start[t] = 0;
+
+  // Pass 1: count entries per tile (offset by one for the prefix sum)
+  u32 total = 0;
+  for (u32 i = 0; i < shape_count; i++) {
+    u16* span = &tile_shape_span[i * 4];
+    if (!tile_span(i, span)) {
+      span[0] = 1;
+      span[2] = 0;
+      continue;
+    }
+
+    for (u32 y = span[1]; y <= span[3]; y++) {
+      for (u32 x = span[0]; x <= span[2]; x++) {
+        tile_start[y * tiles_x + x + 1]++;
+      }
+    }
+    total += (u32)(span[2] - span[0] + 1) * (u32)(span[3] - span[1] + 1);
+  }
+
+  if (total > TILE_MAX_ENTRIES) return;
+  if (total > tile_item_capacity && !reserve_lists(grid_item_capacity, total)) return;
+
+  for (u32 t = 0; t < tile_count; t++) {
+    tile_start[t + 1] += tile_start[t];
+  }
+
+  // Pass 2: fill, using each tile's start as its write cursor
+  for (u32 i = 0; i < shape_count; i++) {
+    const u16* span = &tile_shape_span[i * 4];
+    for (u32 y = span[1]; y <= span[3] && span[0] <= span[2]; y++) {
+      for (u32 x = span[0]; x <= span[2]; x++) {
+        tile_items[tile_start[y * tiles_x + x]++] = (u16)i;
+      }
+    }
+  }
+
+  for (u32 t = tile_count; t > 0; t--) {
+    tile_start[t] = tile_start[t - 1];
+  }
+  tile_start[0] = 0;
+
+  tiles_valid = 1;
+}
+
+// Marks, in each tile's light mask, every light whose reach sphere projects
+// onto the tile. Without a usable ray grid every packet takes every light.
+void bin_lights(void) {
+  light_tiles_valid = 1;
+  u32 tile_count = tiles_x * tiles_y;
+  light_tiles_enabled = ray_width >= 2 && ray_height >= 2 && tile_count <= tile_capacity;
+  if (!light_tiles_enabled) return;
+
+  for (u32 t = 0; t < tile_count; t++) tile_lights[t] = 0;
+
+  for (u32 i = 0; i < point_light_count; i++) {
+    u32 src = pl_source[i];
+    u16 span[4];
+    if (!sphere_tile_span(point_light_x[src], point_light_y[src], point_light_z[src], pl_reach[i], span)) continue;
+
+    for (u32 y = span[1]; y <= span[3]; y++) {
+      for (u32 x = span[0]; x <= span[2]; x++) {
+        tile_lights[y * tiles_x + x] |= 1ull << i;
+      }
+    }
+  }
+}
+
+// Lights that can reach some hit lane of the packet of rays base..base+3:
+// the union of the light masks of the hit lanes' tiles
+u64 packet_lights(u32 base, v128_t hit) {
+  if (!light_tiles_enabled) {
+    return point_light_count == MAX_POINT_LIGHTS ? ~0ull : (1ull << point_light_count) - 1;
+  }
+
+  i32 hit_arr[4];
+  v128_store(hit_arr, hit);
+
+  u64 lights = 0;
+  for (u32 l = 0; l < 4; l++) {
+    if (hit_arr[l]) lights |= tile_lights[ray_tile(base + l)];
+  }
+  return lights;
+}
+
+// Optional pre-pass after generate_rays() (and bin_tiles(), whose lists it
+// uses when present): marches one cone per tile, four tiles per packet, and
+// records how far along the tile's rays the scene is guaranteed empty.
+// march_rays() then starts each ray there instead of at the scene AABB.
+// From the axis point at distance t, a step s keeps the cone inside the
+// empty sphere of radius d while s + (t + s) * tan <= d.
+void cone_march(void) {
+  u64 start = perf_now();
+  march_cones();
+  perf_flush_shapes();
+  perf_stage(PERF_STAGE_TILES, start);
+}
+
+void march_cones(void) {
+  cones_valid = 0;
+  if (ray_width < 2 || ray_height < 2) return;
+
+  u32 tile_count = tiles_x * tiles_y;
+  if (tile_count > tile_capacity) return;
+
+  v128_t ox = f32x4_splat(cam_eye[0]);
+  v128_t oy = f32x4_splat(cam_eye[1]);
+  v128_t oz = f32x4_splat(cam_eye[2]);
+  v128_t one = f32x4_splat(1.0f);
+  v128_t min_step = f32x4_splat(CONE_MIN_STEP);
+
+  u32 total_steps = 0;
+  for (u32 base = 0; base < tile_count; base += 4) {
+    f32 dir_x[4], dir_y[4], dir_z[4], tan_half[4];
+    i32 lanes[4];
+
+    tile_cursor.items = tile_items;
+    tile_cursor.lists = 0;
+    for (u32 l = 0; l < 4; l++) {
+      u32 t = base + l;
+      f32 dir[3] = {cam_forward[0], cam_forward[1], cam_forward[2]};
+      tan_half[l] = 0.0f;
+      lanes[l] = 0;
+
+      // Empty tiles are never marched, so their cones need no work
+      if (t < tile_count && (!tiles_valid || tile_start[t] != tile_start[t + 1])) {
+        tile_cone(t, dir, &tan_half[l]);
+        lanes[l] = -1;
+        if (tiles_valid) {
+          tile_cursor.cur[tile_cursor.lists] = tile_start[t];
+          tile_cursor.end[tile_cursor.lists] = tile_start[t + 1];
+          tile_cursor.lists++;
+        }
+      }
+      dir_x[l] = dir[0];
+      dir_y[l] = dir[1];
+      dir_z[l] = dir[2];
+    }
+    tile_cursor_enabled = tiles_valid;
+
+    v128_t dx = v128_load(dir_x);
+    v128_t dy = v128_load(dir_y);
+    v128_t dz = v128_load(dir_z);
+    v128_t tan_v = v128_load(tan_half);
+    v128_t inv_spread = f32x4_div(one, f32x4_add(one, tan_v));
+
+    v128_t active = v128_load(lanes);
+    v128_t t = zero_simd;
+    for (u32 step = 0; step < CONE_MAX_STEPS && v128_any_true(active); step++) {
+      v128_t px = f32x4_add(ox, f32x4_mul(dx, t));
+      v128_t py = f32x4_add(oy, f32x4_mul(dy, t));
+      v128_t pz = f32x4_add(oz, f32x4_mul(dz, t));
+      v128_t dist = scene_sdf_masked(px, py, pz, active);
+      total_steps++;
+
+      v128_t safe = f32x4_mul(f32x4_sub(dist, f32x4_mul(t, tan_v)), inv_spread);
+      active = v128_andnot(active, f32x4_lt(safe, min_step));
+      t = f32x4_add(t, v128_and(safe, active));
+      active = v128_andnot(active, f32x4_ge(t, max_dist_simd));
+    }
+
+    f32 cone_t[4];
+    v128_store(cone_t, f32x4_min(t, max_dist_simd));
+    for (u32 l = 0; l < 4 && base + l < tile_count; l++) {
+      tile_cone_t[base + l] = cone_t[l];
+    }
+  }
+
+  tile_cursor_enabled = 0;
+  perf_add(PERF_CONE_STEPS, total_steps);
+  cones_valid = 1;
 }
 
 void compute_background(f32 time) {
@@ -682,224 +3360,1008 @@ void compute_background(f32 time) {
   bg_color[2] = clampf(base_b + osc3, 0.0f, 1.0f);
 }
 
-void march_rays(void) {
-  u32 batch_count = (ray_count + 3) / 4;
-
-  u32 total_steps_all = 0;
-  u32 total_hits = 0;
-  u32 total_misses = 0;
+// Enables warm-starting rays from the previous frame's reprojected hits.
+// Disabling drops the depth buffer so re-enabling starts cold.
+void set_temporal(u32 enabled) {
+  temporal_enabled = enabled != 0;
+  depth_valid = 0;
+}
 
-  for (u32 batch = 0; batch < batch_count; batch++) {
-    u32 base = batch * 4;
+// Scatters last frame's hit points into the current ray grid (keeping the
+// nearest per ray), then gives each ray a warm start of TEMPORAL_FRACTION of
+// the nearest reprojected depth in its 3x3 neighbourhood. Rays fall back to a
+// cold start on disocclusion (a neighbour received no hit), at depth edges,
+// at the border where shapes can enter from off screen, and on every
+// TEMPORAL_REFRESH-th row in rotation so mistakes cannot persist.
+u8 temporal_reproject(void) {
+  if (!temporal_enabled || !depth_valid) return 0;
+  if (ray_width != prev_ray_width || ray_height != prev_ray_height) return 0;
+  if (ray_width < 3 || ray_height < 3) return 0;
+
+  // Camera cuts start the frame cold
+  f32 ex = cam_eye[0] - prev_cam_eye[0];
+  f32 ey = cam_eye[1] - prev_cam_eye[1];
+  f32 ez = cam_eye[2] - prev_cam_eye[2];
+  f32 forward_dot = cam_forward[0] * prev_cam_forward[0] + cam_forward[1] * prev_cam_forward[1] + cam_forward[2] * prev_cam_forward[2];
+  if (ex * ex + ey * ey + ez * ez > TEMPORAL_MAX_EYE_MOVE * TEMPORAL_MAX_EYE_MOVE) return 0;
+  if (forward_dot < TEMPORAL_MIN_FORWARD_DOT) return 0;
+
+  for (u32 i = 0; i < ray_count; i++) reproj_depth[i] = 0.0f;
+
+  f32 inv_w = 1.0f / (f32)(ray_width - 1);
+  f32 inv_h = 1.0f / (f32)(ray_height - 1);
+  f32 max_col = (f32)(ray_width - 1);
+  f32 max_row = (f32)(ray_height - 1);
+
+  for (u32 idx = 0; idx < ray_count; idx++) {
+    f32 depth = ray_depth[idx];
+    if (depth <= 0.0f) continue;
+
+    // Rebuild last frame's ray exactly as generate_rays() did
+    u32 row = idx / ray_width;
+    u32 col = idx - row * ray_width;
+    f32 u = 2.0f * (f32)col * inv_w - 1.0f;
+    f32 v = 1.0f - 2.0f * (f32)row * inv_h;
+    f32 dx = prev_cam_forward[0] + u * prev_cam_half_width * prev_cam_right[0] + v * prev_cam_half_height * prev_cam_up[0];
+    f32 dy = prev_cam_forward[1] + u * prev_cam_half_width * prev_cam_right[1] + v * prev_cam_half_height * prev_cam_up[1];
+    f32 dz = prev_cam_forward[2] + u * prev_cam_half_width * prev_cam_right[2] + v * prev_cam_half_height * prev_cam_up[2];
+    f32 scale = depth / sqrtf_approx(dx * dx + dy * dy + dz * dz);
+
+    f32 rx = prev_cam_eye[0] + dx * scale - cam_eye[0];
+    f32 ry = prev_cam_eye[1] + dy * scale - cam_eye[1];
+    f32 rz = prev_cam_eye[2] + dz * scale - cam_eye[2];
+
+    f32 z = rx * cam_forward[0] + ry * cam_forward[1] + rz * cam_forward[2];
+    if (z <= 0.0f) continue;
+    f32 pu = (rx * cam_right[0] + ry * cam_right[1] + rz * cam_right[2]) / (z * cam_half_width);
+    f32 pv = (rx * cam_up[0] + ry * cam_up[1] + rz * cam_up[2]) / (z * cam_half_height);
+
+    f32 fc = (pu + 1.0f) * 0.5f * max_col + 0.5f;
+    f32 fr = (1.0f - pv) * 0.5f * max_row + 0.5f;
+    if (fc < 0.0f || fr < 0.0f || fc >= (f32)ray_width || fr >= (f32)ray_height) continue;
+
+    u32 target = (u32)fr * ray_width + (u32)fc;
+    if (target >= ray_count) continue;
+
+    f32 new_depth = sqrtf_approx(rx * rx + ry * ry + rz * rz);
+    if (reproj_depth[target] == 0.0f || new_depth < reproj_depth[target]) {
+      reproj_depth[target] = new_depth;
+    }
+  }
 
-    v128_t ox = wasm_v128_load(&ray_ox[base]);
-    v128_t oy = wasm_v128_load(&ray_oy[base]);
-    v128_t oz = wasm_v128_load(&ray_oz[base]);
-    v128_t dx = wasm_v128_load(&ray_dx[base]);
-    v128_t dy = wasm_v128_load(&ray_dy[base]);
-    v128_t dz = wasm_v128_load(&ray_dz[base]);
+  u32 refresh_row = temporal_frame % TEMPORAL_REFRESH;
+  for (u32 idx = 0; idx < ray_count; idx++) {
+    u32 row = idx / ray_width;
+    u32 col = idx - row * ray_width;
+    ray_start[idx] = 0.0f;
+
+    if (row == 0 || col == 0 || row + 1 >= ray_height || col + 1 >= ray_width) continue;
+    if (row % TEMPORAL_REFRESH == refresh_row) continue;
+
+    f32 lo = MAX_DIST;
+    f32 hi = 0.0f;
+    for (u32 y = row - 1; y <= row + 1; y++) {
+      for (u32 x = col - 1; x <= col + 1; x++) {
+        u32 n = y * ray_width + x;
+        f32 d = n < ray_count ? reproj_depth[n] : 0.0f;
+        lo = minf(lo, d);
+        hi = maxf(hi, d);
+      }
+    }
 
-    v128_t px = ox;
-    v128_t py = oy;
-    v128_t pz = oz;
+    if (lo > 0.0f && hi <= lo * TEMPORAL_MAX_RATIO) {
+      ray_start[idx] = lo * TEMPORAL_FRACTION;
+    }
+  }
+  return 1;
+}
 
-    v128_t total_dist = wasm_f32x4_splat(0.0f);
+// Pulls a warm start in front of every shape that changed since the last
+// frame: the reprojected depth knows nothing of a snowflake that fell into
+// the ray. Checks the ray's tile list when tiles are binned, else every
+// changed shape; the bounds grow by the blend radius like the scene AABB.
+f32 moved_start_cap(u32 idx, f32 start) {
+  f32 ox = ray_ox[idx], oy = ray_oy[idx], oz = ray_oz[idx];
+  f32 dx = ray_dx[idx], dy = ray_dy[idx], dz = ray_dz[idx];
+  f32 padding = smooth_k * 2.0f;
 
-    v128_t active = wasm_i32x4_splat(-1);
+  u32 cur = 0;
+  u32 end = moved_count;
+  if (tiles_valid) {
+    u32 t = ray_tile(idx);
+    cur = tile_start[t];
+    end = tile_start[t + 1];
+  }
+  for (; cur < end; cur++) {
+    u32 i = tiles_valid ? tile_items[cur] : moved_shapes[cur];
+    if (!shape_moved[i]) continue;
+
+    const f32* b = &shape_bounds[i * 4];
+    f32 r = b[3] + padding;
+    f32 lx = ox - b[0], ly = oy - b[1], lz = oz - b[2];
+    f32 half_b = lx * dx + ly * dy + lz * dz;
+    f32 disc = half_b * half_b - (lx * lx + ly * ly + lz * lz - r * r);
+    if (disc < 0.0f) continue;
+    f32 t_enter = -half_b - sqrtf_approx(disc);
+    if (t_enter + 2.0f * sqrtf_approx(disc) < 0.0f) continue; // behind the eye
+    start = minf(start, maxf(t_enter, 0.0f));
+  }
+  return start;
+}
 
-    v128_t max_dist = wasm_f32x4_splat(MAX_DIST);
-    v128_t hit_thresh = wasm_f32x4_splat(HIT_THRESHOLD);
+// Stage 1: clips the rays in [first, end) against the scene AABB, their
+// tiles and cones, picks each start (warm or cold) and writes the rays
+// that need marching to `queue`. first is a multiple of 4. Returns the
+// queue length.
+u32 queue_rays(u32 first, u32 end, u8 warm, u32* queue, march_stats_t* stats) {
+  u32 queued = 0;
+
+  for (u32 base = first; base < end; base += 4) {
+    v128_t ox = v128_load(&ray_ox[base]);
+    v128_t oy = v128_load(&ray_oy[base]);
+    v128_t oz = v128_load(&ray_oz[base]);
+    v128_t dx = v128_load(&ray_dx[base]);
+    v128_t dy = v128_load(&ray_dy[base]);
+    v128_t dz = v128_load(&ray_dz[base]);
+
+    v128_t t_near, t_far;
+    v128_t in_box = intersect_scene_aabb(ox, oy, oz, dx, dy, dz, &t_near, &t_far);
+
+    u32 rays[4];
+    for (u32 l = 0; l < 4; l++) {
+      rays[l] = base + l < end ? base + l : RAY_NONE;
+    }
 
-    v128_t accumulated_hit = wasm_i32x4_splat(0);
+    if (cones_valid) {
+      f32 cone_t[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      for (u32 l = 0; l < 4 && rays[l] != RAY_NONE; l++) {
+        cone_t[l] = tile_cone_t[ray_tile(rays[l])];
+      }
+      t_near = f32x4_max(t_near, v128_load(cone_t));
+      in_box = v128_and(in_box, f32x4_le(t_near, t_far));
+    }
 
-    u32 steps_this_batch = 0;
-    for (int step = 0; step < MAX_STEPS; step++) {
-      v128_t dist = scene_sdf(px, py, pz);
-      steps_this_batch++;
+    // Lanes in empty tiles cannot hit anything
+    if (tiles_valid) {
+      shape_cursor_t cursor;
+      u32 lanes = packet_tiles(rays, 4, &cursor);
+      if (!lanes) stats->tile_skips++;
+      in_box = v128_and(in_box, i32x4_make(
+        -(i32)(lanes & 1), -(i32)((lanes >> 1) & 1), -(i32)((lanes >> 2) & 1), -(i32)((lanes >> 3) & 1)));
+    }
 
-      v128_t hit = wasm_f32x4_lt(dist, hit_thresh);
-      v128_t miss = wasm_f32x4_gt(total_dist, max_dist);
+    f32 near_arr[4], far_arr[4];
+    i32 box_arr[4];
+    v128_store(near_arr, t_near);
+    v128_store(far_arr, t_far);
+    v128_store(box_arr, in_box);
+
+    for (u32 l = 0; l < 4 && rays[l] != RAY_NONE; l++) {
+      u32 idx = rays[l];
+      ray_depth[idx] = 0.0f;
+      ray_glow[idx] = MAX_DIST;
+      if (!box_arr[l]) {
+        ray_start[idx] = 0.0f;
+        continue;
+      }
 
-      accumulated_hit = wasm_v128_or(accumulated_hit, hit);
+      // A warm start is only kept when it beats the cold one; lanes that
+      // turn out to start inside a shape fall back to ray_t_near
+      ray_t_near[idx] = near_arr[l];
+      ray_t_far[idx] = far_arr[l];
+      if (warm && moved_count > 0 && ray_start[idx] > near_arr[l]) {
+        ray_start[idx] = moved_start_cap(idx, ray_start[idx]);
+      }
+      if (!warm || ray_start[idx] <= near_arr[l]) {
+        ray_start[idx] = 0.0f;
+      } else {
+        ray_start[idx] = minf(ray_start[idx], far_arr[l]);
+      }
+      queue[queued++] = idx;
+    }
+  }
 
-      active = wasm_v128_andnot(active, wasm_v128_or(hit, miss));
+  return queued;
+}
 
-      if (!wasm_v128_any_true(active)) break;
+// Empties every lane of a marcher packet
+void lanes_init(march_lanes_t* lanes) {
+  for (u32 l = 0; l < 4; l++) lanes->ray[l] = RAY_NONE;
+  lanes->ox = lanes->oy = lanes->oz = zero_simd;
+  lanes->dx = lanes->dy = lanes->dz = zero_simd;
+  lanes->t = lanes->t_far = lanes->t_cold = zero_simd;
+  lanes->active = lanes->warm = lanes->fresh = lanes->steps = i32x4_splat(0);
+  lanes->omega = lanes->prev_radius = lanes->step_len = zero_simd;
+  lanes->last_t = zero_simd;
+  lanes->last_dist = max_dist_simd;
+  lanes->refine_left = i32x4_splat(0);
+  lanes->glow = max_dist_simd;
+  lanes->glow_group = i32x4_splat(0);
+}
 
-      v128_t step_dist = wasm_v128_and(dist, active);
-      px = wasm_f32x4_add(px, wasm_f32x4_mul(dx, step_dist));
-      py = wasm_f32x4_add(py, wasm_f32x4_mul(dy, step_dist));
-      pz = wasm_f32x4_add(pz, wasm_f32x4_mul(dz, step_dist));
-      total_dist = wasm_f32x4_add(total_dist, step_dist);
+// Loads the next queued rays into the packet's free lanes. Returns whether
+// any lane was loaded.
+u8 lanes_refill(march_lanes_t* lanes, const u32* queue, u32 queued, u32* next) {
+  if (*next >= queued) return 0;
+  if (lanes->ray[0] != RAY_NONE && lanes->ray[1] != RAY_NONE &&
+      lanes->ray[2] != RAY_NONE && lanes->ray[3] != RAY_NONE) return 0;
+
+  i32 loaded[4] = {0, 0, 0, 0};
+  f32 lo[6][4], start[4], cold[4], far[4];
+  for (u32 l = 0; l < 4; l++) {
+    if (lanes->ray[l] == RAY_NONE && *next < queued) {
+      lanes->ray[l] = queue[(*next)++];
+      loaded[l] = -1;
     }
+    // Idle lanes load a ray of this queue, which stays in this thread's band
+    u32 idx = lanes->ray[l] != RAY_NONE ? lanes->ray[l] : queue[0];
+    lo[0][l] = ray_ox[idx];
+    lo[1][l] = ray_oy[idx];
+    lo[2][l] = ray_oz[idx];
+    lo[3][l] = ray_dx[idx];
+    lo[4][l] = ray_dy[idx];
+    lo[5][l] = ray_dz[idx];
+    cold[l] = ray_t_near[idx];
+    far[l] = ray_t_far[idx];
+    start[l] = ray_start[idx] > 0.0f ? ray_start[idx] : ray_t_near[idx];
+  }
 
-    total_steps_all += steps_this_batch;
-    perf_metrics[PERF_TOTAL_SDF_CALLS] += (f32)steps_this_batch;
+  v128_t mask = v128_load(loaded);
+  v128_t omega_init = f32x4_splat(march_mode == MARCH_RELAXED ? MARCH_OMEGA : 1.0f);
+  lanes->ox = v128_bitselect(v128_load(lo[0]), lanes->ox, mask);
+  lanes->oy = v128_bitselect(v128_load(lo[1]), lanes->oy, mask);
+  lanes->oz = v128_bitselect(v128_load(lo[2]), lanes->oz, mask);
+  lanes->dx = v128_bitselect(v128_load(lo[3]), lanes->dx, mask);
+  lanes->dy = v128_bitselect(v128_load(lo[4]), lanes->dy, mask);
+  lanes->dz = v128_bitselect(v128_load(lo[5]), lanes->dz, mask);
+  v128_t start_t = v128_load(start);
+  v128_t cold_t = v128_load(cold);
+  lanes->t = v128_bitselect(start_t, lanes->t, mask);
+  lanes->t_cold = v128_bitselect(cold_t, lanes->t_cold, mask);
+  lanes->t_far = v128_bitselect(v128_load(far), lanes->t_far, mask);
+  lanes->warm = v128_bitselect(f32x4_gt(start_t, cold_t), lanes->warm, mask);
+  lanes->active = v128_or(lanes->active, mask);
+  lanes->fresh = v128_or(lanes->fresh, mask);
+  lanes->steps = v128_andnot(lanes->steps, mask);
+  lanes->omega = v128_bitselect(omega_init, lanes->omega, mask);
+  lanes->prev_radius = v128_andnot(lanes->prev_radius, mask);
+  lanes->step_len = v128_andnot(lanes->step_len, mask);
+  lanes->last_t = v128_bitselect(lanes->t, lanes->last_t, mask);
+  lanes->last_dist = v128_bitselect(max_dist_simd, lanes->last_dist, mask);
+  lanes->refine_left = v128_andnot(lanes->refine_left, mask);
+  lanes->glow = v128_bitselect(max_dist_simd, lanes->glow, mask);
+  return 1;
+}
 
-    v128_t hit = accumulated_hit;
+// Current sample point of every lane
+void lanes_point(const march_lanes_t* lanes, v128_t* px, v128_t* py, v128_t* pz) {
+  *px = f32x4_add(lanes->ox, f32x4_mul(lanes->dx, lanes->t));
+  *py = f32x4_add(lanes->oy, f32x4_mul(lanes->dy, lanes->t));
+  *pz = f32x4_add(lanes->oz, f32x4_mul(lanes->dz, lanes->t));
+}
 
-    i32 hit_arr[4];
-    wasm_v128_store(hit_arr, hit);
+// Advances every lane by one step from `dist`, the scene distance at
+// lanes_point(), and `shape`, the nearest shape there. Lanes whose ray hits
+// or misses write ray_depth (0 = miss), ray_shape and ray_glow, and are
+// freed for lanes_refill().
+void lanes_step(march_lanes_t* lanes, v128_t dist, const closest_shape_t* closest, march_stats_t* stats) {
+  u8 relaxed = march_mode == MARCH_RELAXED;
+  v128_t one = f32x4_splat(1.0f);
+  v128_t omega_init = relaxed ? f32x4_splat(MARCH_OMEGA) : one;
+  v128_t refine_init = i32x4_splat(relaxed ? MARCH_REFINE_STEPS : 0);
+  v128_t ones = i32x4_splat(1);
+  v128_t active = lanes->active;
+  v128_t t = lanes->t;
+
+  stats->iterations++;
+  lanes->steps = i32x4_add(lanes->steps, v128_and(ones, active));
+
+  i32 active_arr[4];
+  v128_store(active_arr, active);
+  stats->lane_steps += (active_arr[0] & 1) + (active_arr[1] & 1) + (active_arr[2] & 1) + (active_arr[3] & 1);
+
+  // A warm start that landed inside a shape goes back to the cold start
+  // and spends this iteration there
+  v128_t hold = v128_and(v128_and(lanes->fresh, lanes->warm), f32x4_lt(dist, zero_simd));
+  t = v128_bitselect(lanes->t_cold, t, hold);
+  lanes->last_t = v128_bitselect(lanes->t_cold, lanes->last_t, hold);
+  lanes->warm = v128_andnot(lanes->warm, hold);
+  lanes->fresh = i32x4_splat(0);
+
+  v128_t refining = i32x4_gt(lanes->refine_left, i32x4_splat(0));
+  v128_t marching = v128_andnot(v128_andnot(active, hold), refining);
+
+  // Over-relaxation (Keinert et al.): lanes step omega * dist until two
+  // consecutive distance spheres stop overlapping, then step back to inside
+  // the last safe sphere and take one plain step from there
+  v128_t step_dist = dist;
+  v128_t radius = dist;
+  v128_t failed = i32x4_splat(0);
+  if (relaxed) {
+    // An overshoot lands inside a shape with a negative distance, which
+    // steps back out instead of counting as a hit
+    radius = f32x4_abs(dist);
+    failed = v128_and(marching, v128_and(
+      f32x4_lt(f32x4_add(radius, lanes->prev_radius), lanes->step_len),
+      f32x4_gt(lanes->omega, one)));
+    step_dist = v128_bitselect(
+      f32x4_mul(lanes->step_len, f32x4_sub(one, lanes->omega)),
+      f32x4_mul(dist, lanes->omega),
+      failed);
+    lanes->omega = v128_bitselect(lanes->omega, v128_bitselect(one, omega_init, failed), v128_not(marching));
+    lanes->prev_radius = v128_bitselect(radius, lanes->prev_radius, marching);
+    lanes->step_len = v128_bitselect(step_dist, lanes->step_len, marching);
+  }
 
-    i32 any_hit = hit_arr[0] | hit_arr[1] | hit_arr[2] | hit_arr[3];
+  v128_t sample = v128_andnot(marching, failed);
+  v128_t hit = v128_and(sample, f32x4_lt(radius, f32x4_splat(HIT_THRESHOLD)));
+  v128_t miss = v128_andnot(v128_and(sample, f32x4_gt(t, lanes->t_far)), hit);
+
+  // Secant refinement of relaxed hits: move to where the line through the
+  // last two samples crosses zero. The slope is floored so a grazing hit
+  // moves at most dist / MARCH_MIN_SLOPE.
+  lanes->refine_left = v128_bitselect(refine_init, lanes->refine_left, hit);
+  v128_t refine = v128_and(v128_or(hit, refining), i32x4_gt(lanes->refine_left, i32x4_splat(0)));
+  if (v128_any_true(refine)) {
+    v128_t gap = f32x4_max(f32x4_sub(t, lanes->last_t), f32x4_splat(1e-6f));
+    v128_t slope = f32x4_max(
+      f32x4_div(f32x4_sub(lanes->last_dist, dist), gap),
+      f32x4_splat(MARCH_MIN_SLOPE));
+    v128_t next_t = f32x4_add(t, f32x4_div(dist, slope));
+    lanes->last_t = v128_bitselect(t, lanes->last_t, refine);
+    lanes->last_dist = v128_bitselect(dist, lanes->last_dist, refine);
+    t = v128_bitselect(next_t, t, refine);
+    lanes->refine_left = i32x4_sub(lanes->refine_left, v128_and(ones, refine));
+  }
 
-    f32 bright_arr[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  v128_t hit_done = v128_andnot(v128_or(hit, refining), i32x4_gt(lanes->refine_left, i32x4_splat(0)));
+  hit_done = v128_and(hit_done, active);
+  v128_t exhausted = v128_andnot(v128_andnot(i32x4_ge(lanes->steps, i32x4_splat(MAX_STEPS)), hit), refining);
+  v128_t done = v128_or(hit_done, v128_and(v128_or(miss, exhausted), active));
 
-    if (any_hit) {
-      v128_t eps = wasm_f32x4_splat(NORMAL_EPS);
-      v128_t neg_eps = wasm_f32x4_splat(-NORMAL_EPS);
+  // Closest approach to a glowing group, over every sample of the ray
+  if (glow_groups) {
+    v128_t nearer = v128_and(active, f32x4_lt(closest->glow, lanes->glow));
+    lanes->glow = v128_bitselect(closest->glow, lanes->glow, nearer);
+    lanes->glow_group = v128_bitselect(closest->glow_group, lanes->glow_group, nearer);
+  }
 
-      v128_t d0 = scene_sdf(
-        wasm_f32x4_add(px, eps), wasm_f32x4_add(py, eps), wasm_f32x4_add(pz, neg_eps));
-      v128_t d1 = scene_sdf(
-        wasm_f32x4_add(px, eps), wasm_f32x4_add(py, neg_eps), wasm_f32x4_add(pz, eps));
-      v128_t d2 = scene_sdf(
-        wasm_f32x4_add(px, neg_eps), wasm_f32x4_add(py, eps), wasm_f32x4_add(pz, eps));
-      v128_t d3 = scene_sdf(
-        wasm_f32x4_add(px, neg_eps), wasm_f32x4_add(py, neg_eps), wasm_f32x4_add(pz, neg_eps));
-
-      v128_t nx = wasm_f32x4_sub(wasm_f32x4_add(d0, d1), wasm_f32x4_add(d2, d3));
-      v128_t ny = wasm_f32x4_sub(wasm_f32x4_add(d0, d2), wasm_f32x4_add(d1, d3));
-      v128_t nz = wasm_f32x4_sub(wasm_f32x4_add(d1, d2), wasm_f32x4_add(d0, d3));
-
-      perf_metrics[PERF_NORMAL_SDF_CALLS] += 4.0f;
-
-      v128_t len_sq = wasm_f32x4_add(wasm_f32x4_add(
-        wasm_f32x4_mul(nx, nx),
-        wasm_f32x4_mul(ny, ny)),
-        wasm_f32x4_mul(nz, nz));
-      v128_t inv_len = wasm_f32x4_div(wasm_f32x4_splat(1.0f), wasm_f32x4_sqrt(len_sq));
-      nx = wasm_f32x4_mul(nx, inv_len);
-      ny = wasm_f32x4_mul(ny, inv_len);
-      nz = wasm_f32x4_mul(nz, inv_len);
-
-      v128_t ndotl = wasm_f32x4_add(wasm_f32x4_add(
-        wasm_f32x4_mul(nx, light_x_simd),
-        wasm_f32x4_mul(ny, light_y_simd)),
-        wasm_f32x4_mul(nz, light_z_simd));
-      ndotl = wasm_f32x4_max(ndotl, zero_simd);
-
-      v128_t brightness = wasm_f32x4_add(
-        ambient_simd,
-        wasm_f32x4_mul(ndotl, diffuse_simd)
-      );
-
-      wasm_v128_store(bright_arr, brightness);
-    }
-
-    f32 cr_arr[4], cg_arr[4], cb_arr[4];
-    if (any_hit) {
-      get_hit_colors(px, py, pz, hit_arr, cr_arr, cg_arr, cb_arr);
-    }
-
-    f32 pl_contrib_r[4] = {0.0f, 0.0f, 0.0f, 0.0f};
-    f32 pl_contrib_g[4] = {0.0f, 0.0f, 0.0f, 0.0f};
-    f32 pl_contrib_b[4] = {0.0f, 0.0f, 0.0f, 0.0f};
-
-    if (any_hit && point_light_count > 0) {
-      v128_t eps = wasm_f32x4_splat(NORMAL_EPS);
-      v128_t neg_eps = wasm_f32x4_splat(-NORMAL_EPS);
-      v128_t d0 = scene_sdf(
-        wasm_f32x4_add(px, eps), wasm_f32x4_add(py, eps), wasm_f32x4_add(pz, neg_eps));
-      v128_t d1 = scene_sdf(
-        wasm_f32x4_add(px, eps), wasm_f32x4_add(py, neg_eps), wasm_f32x4_add(pz, eps));
-      v128_t d2 = scene_sdf(
-        wasm_f32x4_add(px, neg_eps), wasm_f32x4_add(py, eps), wasm_f32x4_add(pz, eps));
-      v128_t d3 = scene_sdf(
-        wasm_f32x4_add(px, neg_eps), wasm_f32x4_add(py, neg_eps), wasm_f32x4_add(pz, neg_eps));
-      v128_t nx = wasm_f32x4_sub(wasm_f32x4_add(d0, d1), wasm_f32x4_add(d2, d3));
-      v128_t ny = wasm_f32x4_sub(wasm_f32x4_add(d0, d2), wasm_f32x4_add(d1, d3));
-      v128_t nz = wasm_f32x4_sub(wasm_f32x4_add(d1, d2), wasm_f32x4_add(d0, d3));
-      v128_t len_sq = wasm_f32x4_add(wasm_f32x4_add(
-        wasm_f32x4_mul(nx, nx), wasm_f32x4_mul(ny, ny)), wasm_f32x4_mul(nz, nz));
-      v128_t inv_len = wasm_f32x4_div(wasm_f32x4_splat(1.0f), wasm_f32x4_sqrt(len_sq));
-      nx = wasm_f32x4_mul(nx, inv_len);
-      ny = wasm_f32x4_mul(ny, inv_len);
-      nz = wasm_f32x4_mul(nz, inv_len);
-
-      v128_t one = wasm_f32x4_splat(1.0f);
-
-      for (u32 pl = 0; pl < point_light_count; pl++) {
-        v128_t lx = wasm_f32x4_sub(pl_x_simd[pl], px);
-        v128_t ly = wasm_f32x4_sub(pl_y_simd[pl], py);
-        v128_t lz = wasm_f32x4_sub(pl_z_simd[pl], pz);
-
-        v128_t dist_sq = wasm_f32x4_add(wasm_f32x4_add(
-          wasm_f32x4_mul(lx, lx), wasm_f32x4_mul(ly, ly)), wasm_f32x4_mul(lz, lz));
-        v128_t dist = wasm_f32x4_sqrt(dist_sq);
-
-        v128_t inv_dist = wasm_f32x4_div(one, wasm_f32x4_max(dist, wasm_f32x4_splat(0.001f)));
-        lx = wasm_f32x4_mul(lx, inv_dist);
-        ly = wasm_f32x4_mul(ly, inv_dist);
-        lz = wasm_f32x4_mul(lz, inv_dist);
-
-        v128_t ndotl_pl = wasm_f32x4_add(wasm_f32x4_add(
-          wasm_f32x4_mul(nx, lx), wasm_f32x4_mul(ny, ly)), wasm_f32x4_mul(nz, lz));
-        ndotl_pl = wasm_f32x4_max(ndotl_pl, zero_simd);
-
-        v128_t dist_norm = wasm_f32x4_div(dist, pl_radius_simd[pl]);
-        v128_t atten = wasm_f32x4_div(one,
-          wasm_f32x4_add(one, wasm_f32x4_mul(dist_norm, dist_norm)));
-
-        v128_t factor = wasm_f32x4_mul(wasm_f32x4_mul(pl_intensity_simd[pl], atten), ndotl_pl);
-        v128_t contrib_r = wasm_f32x4_mul(pl_r_simd[pl], factor);
-        v128_t contrib_g = wasm_f32x4_mul(pl_g_simd[pl], factor);
-        v128_t contrib_b = wasm_f32x4_mul(pl_b_simd[pl], factor);
-
-        f32 tmp_r[4], tmp_g[4], tmp_b[4];
-        wasm_v128_store(tmp_r, contrib_r);
-        wasm_v128_store(tmp_g, contrib_g);
-        wasm_v128_store(tmp_b, contrib_b);
-        for (int i = 0; i < 4; i++) {
-          pl_contrib_r[i] += tmp_r[i];
-          pl_contrib_g[i] += tmp_g[i];
-          pl_contrib_b[i] += tmp_b[i];
-        }
+  if (v128_any_true(done)) {
+    i32 done_arr[4], hit_arr[4], steps_arr[4], warm_arr[4], shape_arr[4], glow_group_arr[4];
+    f32 t_arr[4], glow_arr[4];
+    v128_store(done_arr, done);
+    v128_store(shape_arr, closest->id);
+    v128_store(hit_arr, hit_done);
+    v128_store(steps_arr, lanes->steps);
+    v128_store(warm_arr, lanes->warm);
+    v128_store(t_arr, t);
+    v128_store(glow_arr, lanes->glow);
+    v128_store(glow_group_arr, lanes->glow_group);
+    for (u32 l = 0; l < 4; l++) {
+      if (!done_arr[l]) continue;
+      ray_depth[lanes->ray[l]] = hit_arr[l] ? maxf(t_arr[l], 1e-6f) : 0.0f;
+      ray_shape[lanes->ray[l]] = (u16)shape_arr[l];
+      ray_glow[lanes->ray[l]] = glow_arr[l];
+      ray_glow_group[lanes->ray[l]] = (u8)glow_group_arr[l];
+      if (hit_arr[l]) record_near(lanes->ray[l], l, closest);
+      if (warm_arr[l]) {
+        stats->warm_rays++;
+        stats->warm_steps += (u32)steps_arr[l];
+      } else {
+        stats->cold_rays++;
+        stats->cold_steps += (u32)steps_arr[l];
       }
+      lanes->ray[l] = RAY_NONE;
     }
+    lanes->active = v128_andnot(active, done);
+    lanes->warm = v128_andnot(lanes->warm, done);
+  }
+
+  v128_t advance = v128_andnot(v128_andnot(sample, done), refine);
+  lanes->last_t = v128_bitselect(t, lanes->last_t, advance);
+  lanes->last_dist = v128_bitselect(dist, lanes->last_dist, advance);
+  advance = v128_or(advance, v128_and(failed, active));
+  lanes->t = f32x4_add(t, v128_and(step_dist, advance));
+}
 
-    for (int i = 0; i < 4; i++) {
-      u32 idx = base + i;
-      if (idx >= ray_count) break;
+// Stage 2: persistent-lane marcher. Each lane owns one queued ray and pulls
+// the next one as soon as its ray hits or misses, so the vector stays full
+// until the queue drains instead of idling behind the slowest lane of a
+// fixed packet. With packet_width 8, two packets step in lockstep through
+// scene_sdf_masked2(). Writes the hit distance (0 = miss) to ray_depth.
+void march_queue_rays(const u32* queue, u32 queued, march_stats_t* stats) {
+  u32 packets = packet_width == 8 ? 2 : 1;
+  march_lanes_t lanes[2];
+  lanes_init(&lanes[0]);
+  lanes_init(&lanes[1]);
+  u32 next = 0;
+
+  for (;;) {
+    u8 refilled = 0;
+    for (u32 k = 0; k < packets; k++) {
+      refilled |= lanes_refill(&lanes[k], queue, queued, &next);
+    }
+    if (refilled && tiles_valid) {
+      u32 rays[8];
+      for (u32 l = 0; l < 4; l++) {
+        rays[l] = lanes[0].ray[l];
+        rays[l + 4] = lanes[1].ray[l];
+      }
+      packet_tiles(rays, packets * 4, &tile_cursor);
+      tile_cursor_enabled = 1;
+    }
 
-      if (hit_arr[i]) {
-        total_hits++;
-        out_r[idx] = bright_arr[i] * cr_arr[i] + pl_contrib_r[i] * cr_arr[i];
-        out_g[idx] = bright_arr[i] * cg_arr[i] + pl_contrib_g[i] * cg_arr[i];
-        out_b[idx] = bright_arr[i] * cb_arr[i] + pl_contrib_b[i] * cb_arr[i];
-      } else {
-        total_misses++;
-        out_r[idx] = bg_color[0];
-        out_g[idx] = bg_color[1];
-        out_b[idx] = bg_color[2];
+    u8 live0 = v128_any_true(lanes[0].active);
+    u8 live1 = v128_any_true(lanes[1].active);
+    if (!live0 && !live1) break;
+
+    v128_t px0, py0, pz0, px1, py1, pz1;
+    if (live0 && live1) {
+      lanes_point(&lanes[0], &px0, &py0, &pz0);
+      lanes_point(&lanes[1], &px1, &py1, &pz1);
+      v128_t d0, d1;
+      closest_shape_t c0, c1;
+      scene_sdf_masked2(px0, py0, pz0, lanes[0].active, px1, py1, pz1, lanes[1].active, &d0, &d1, &c0, &c1);
+      lanes_step(&lanes[0], d0, &c0, stats);
+      lanes_step(&lanes[1], d1, &c1, stats);
+    } else {
+      march_lanes_t* live = live0 ? &lanes[0] : &lanes[1];
+      lanes_point(live, &px0, &py0, &pz0);
+      closest_shape_t c;
+      v128_t d = scene_sdf_closest(px0, py0, pz0, live->active, &c);
+      lanes_step(live, d, &c, stats);
+    }
+  }
+
+  tile_cursor_enabled = 0;
+}
+
+// Keeps the shapes of the call that just hit `ray` in `lane` that could
+// affect the field there, for the shading queries at the hit
+void record_near(u32 ray, u32 lane, const closest_shape_t* closest) {
+  u16* near = &ray_near[ray * SHADE_NEAR_MAX];
+  u32 count = 0;
+  for (u32 e = 0; e < closest->near_count; e++) {
+    if (!((closest->near_lanes[e] >> lane) & 1)) continue;
+    if (count == SHADE_NEAR_MAX) {
+      ray_near_count[ray] = SHADE_NEAR_FULL;
+      return;
+    }
+    near[count++] = closest->near[e];
+  }
+  ray_near_count[ray] = (u8)count;
+}
+
+// Merges the recorded near lists of the hit lanes of one packet into `near`
+// (ascending, without repeats). Returns the entry count, or SHADE_NEAR_FULL
+// when some lane had too many shapes to record.
+u32 packet_near(const u32* rays, v128_t hit, u16* near) {
+  i32 hit_arr[4];
+  v128_store(hit_arr, hit);
+
+  u32 count = 0;
+  for (u32 l = 0; l < 4; l++) {
+    if (!hit_arr[l]) continue;
+    u32 ray = rays[l];
+    if (ray_near_count[ray] == SHADE_NEAR_FULL) return SHADE_NEAR_FULL;
+
+    for (u32 e = 0; e < ray_near_count[ray]; e++) {
+      u16 pos = ray_near[ray * SHADE_NEAR_MAX + e];
+      u32 at = count;
+      while (at > 0 && near[at - 1] > pos) at--;
+      if (at > 0 && near[at - 1] == pos) continue;
+      for (u32 m = count; m > at; m--) near[m] = near[m - 1];
+      near[at] = pos;
+      count++;
+    }
+  }
+  return count;
+}
+
+// Unnormalized gradient at the hit lanes of one packet, from one
+// scene_sdf_grad() pass over the packet's near list from packet_near(), or
+// over the whole scene when a lane had too many; g receives x, y, z
+void hit_grad(const u32* rays, v128_t px, v128_t py, v128_t pz, v128_t hit, const u16* near, u32 near_count, v128_t* g) {
+  if (near_count == SHADE_NEAR_FULL) {
+    tile_cursor_enabled = 0;
+    if (tiles_valid) {
+      packet_tiles(rays, 4, &tile_cursor);
+      tile_cursor_enabled = 1;
+    }
+    scene_sdf_grad(px, py, pz, hit, 0, 0, g);
+    tile_cursor_enabled = 0;
+  } else {
+    scene_sdf_grad(px, py, pz, hit, near, near_count, g);
+  }
+}
+
+// Surface normal of the hit lanes of one packet from the analytic
+// gradient of one scene_sdf_grad() pass; n receives x, y, z. The pass only
+// folds the shapes the marcher recorded near the hits, unless a lane had
+// too many
+void hit_normals(const u32* rays, v128_t px, v128_t py, v128_t pz, v128_t hit, v128_t* n) {
+  u16 near[4 * SHADE_NEAR_MAX];
+  u32 near_count = packet_near(rays, hit, near);
+  hit_grad(rays, px, py, pz, hit, near, near_count, n);
+  normalize_grad(n);
+}
+
+// hit_normals() for two packets (rays holds eight), with both near lists
+// folded in one scene_sdf_grad2() pass; a packet with a full list takes
+// its own whole-scene pass
+void hit_normals2(const u32* rays, const v128_t* px, const v128_t* py, const v128_t* pz, const v128_t* hit, v128_t n[2][3]) {
+  u16 near[2][4 * SHADE_NEAR_MAX];
+  u32 near_count[2];
+  for (u32 k = 0; k < 2; k++) near_count[k] = packet_near(&rays[k * 4], hit[k], near[k]);
+
+  if (near_count[0] != SHADE_NEAR_FULL && near_count[1] != SHADE_NEAR_FULL) {
+    scene_sdf_grad2(px[0], py[0], pz[0], near[0], near_count[0],
+      px[1], py[1], pz[1], near[1], near_count[1], n[0], n[1]);
+  } else {
+    for (u32 k = 0; k < 2; k++) hit_grad(&rays[k * 4], px[k], py[k], pz[k], hit[k], near[k], near_count[k], n[k]);
+  }
+  normalize_grad(n[0]);
+  normalize_grad(n[1]);
+}
+
+// Scales a gradient to unit length in place
+void normalize_grad(v128_t* n) {
+  // A zero gradient (a point exactly on a centre or axis) stays zero
+  v128_t len_sq = f32x4_add(f32x4_add(
+    f32x4_mul(n[0], n[0]),
+    f32x4_mul(n[1], n[1])),
+    f32x4_mul(n[2], n[2]));
+  v128_t inv_len = f32x4_div(f32x4_splat(1.0f), f32x4_sqrt(f32x4_max(len_sq, f32x4_splat(1e-24f))));
+  n[0] = f32x4_mul(n[0], inv_len);
+  n[1] = f32x4_mul(n[1], inv_len);
+  n[2] = f32x4_mul(n[2], inv_len);
+}
+
+// Hit mask and hit points of the packet of rays base..base+3 from the
+// ray_depth distances written by the marcher; rays receives the packet's
+// ray indices, RAY_NONE past end
+v128_t packet_hits(u32 base, u32 end, u32* rays, v128_t* px, v128_t* py, v128_t* pz) {
+  f32 depth[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (u32 l = 0; l < 4; l++) {
+    rays[l] = base + l < end ? base + l : RAY_NONE;
+    if (base + l < end) depth[l] = ray_depth[base + l];
+  }
+
+  v128_t total_dist = v128_load(depth);
+  *px = f32x4_add(v128_load(&ray_ox[base]), f32x4_mul(v128_load(&ray_dx[base]), total_dist));
+  *py = f32x4_add(v128_load(&ray_oy[base]), f32x4_mul(v128_load(&ray_dy[base]), total_dist));
+  *pz = f32x4_add(v128_load(&ray_oz[base]), f32x4_mul(v128_load(&ray_dz[base]), total_dist));
+  return f32x4_gt(total_dist, zero_simd);
+}
+
+// Stage 3: shades the rays in [first, end), in screen-order packets of
+// four, or pairs of them with packet_width 8. The normals of all hit
+// packets go first, into ray_nx/ny/nz, then the lighting, so each is timed
+// as its own stage.
+void shade_rays(u32 first, u32 end, march_stats_t* stats) {
+  u32 width = packet_width == 8 ? 8 : 4;
+  u64 start = perf_now();
+  for (u32 base = first; base < end; base += width) {
+    u32 packets = width == 8 && base + 4 < end ? 2 : 1;
+    u32 rays[8];
+    v128_t px[2], py[2], pz[2], hit[2];
+    u8 any_hit[2] = {0, 0};
+    for (u32 k = 0; k < packets; k++) {
+      hit[k] = packet_hits(base + k * 4, end, &rays[k * 4], &px[k], &py[k], &pz[k]);
+      any_hit[k] = v128_any_true(hit[k]);
+    }
+
+    v128_t n[2][3];
+    if (any_hit[0] && any_hit[1]) {
+      hit_normals2(rays, px, py, pz, hit, n);
+    } else {
+      for (u32 k = 0; k < packets; k++) {
+        if (any_hit[k]) hit_normals(&rays[k * 4], px[k], py[k], pz[k], hit[k], n[k]);
       }
     }
+
+    for (u32 k = 0; k < packets; k++) {
+      if (!any_hit[k]) continue;
+      v128_store(&ray_nx[base + k * 4], n[k][0]);
+      v128_store(&ray_ny[base + k * 4], n[k][1]);
+      v128_store(&ray_nz[base + k * 4], n[k][2]);
+      stats->normal_passes++;
+    }
+  }
+  u64 normals_end = perf_now();
+  stats->normals_ns += normals_end - start;
+
+  for (u32 base = first; base < end; base += width) {
+    u32 packets = width == 8 && base + 4 < end ? 2 : 1;
+    u32 rays[8];
+    v128_t px[2], py[2], pz[2], hit[2];
+    v128_t n[2][3];
+    for (u32 k = 0; k < packets; k++) {
+      u32 at = base + k * 4;
+      hit[k] = packet_hits(at, end, &rays[k * 4], &px[k], &py[k], &pz[k]);
+      n[k][0] = v128_load(&ray_nx[at]);
+      n[k][1] = v128_load(&ray_ny[at]);
+      n[k][2] = v128_load(&ray_nz[at]);
+    }
+
+    if (packets == 2) {
+      shade_packet2(base, px, py, pz, hit, n, stats);
+    } else {
+      shade_packet(base, px[0], py[0], pz[0], hit[0], n[0], stats);
+    }
+  }
+  stats->lighting_ns += perf_now() - normals_end;
+}
+
+// Windowed point light term for four (light, point) pairs, given the
+// unnormalized vector to the light and the normal. Lanes that are not
+// active or out of reach come back as 0
+v128_t point_light_factor(v128_t lx, v128_t ly, v128_t lz, v128_t nx, v128_t ny, v128_t nz,
+                          v128_t intensity, v128_t inv_radius_sq, v128_t inv_reach_sq, v128_t active) {
+  v128_t one = f32x4_splat(1.0f);
+  v128_t dist_sq = f32x4_add(f32x4_add(
+    f32x4_mul(lx, lx), f32x4_mul(ly, ly)), f32x4_mul(lz, lz));
+  v128_t reach_frac = f32x4_mul(dist_sq, inv_reach_sq);
+
+  v128_t inv_dist = f32x4_div(one, f32x4_max(f32x4_sqrt(dist_sq), f32x4_splat(0.001f)));
+  v128_t ndotl = f32x4_mul(f32x4_add(f32x4_add(
+    f32x4_mul(nx, lx), f32x4_mul(ny, ly)), f32x4_mul(nz, lz)), inv_dist);
+  ndotl = f32x4_max(ndotl, zero_simd);
+
+  v128_t atten = f32x4_div(one, f32x4_add(one, f32x4_mul(dist_sq, inv_radius_sq)));
+
+  // Windowed to reach zero at the reach instead of cutting off there
+  v128_t window = f32x4_max(f32x4_sub(one, f32x4_mul(reach_frac, reach_frac)), zero_simd);
+  atten = f32x4_mul(atten, f32x4_mul(window, window));
+
+  v128_t factor = f32x4_mul(f32x4_mul(intensity, atten), ndotl);
+  return v128_and(factor, v128_and(active, f32x4_lt(reach_frac, one)));
+}
+
+// Point lights in `lights` at a single point (lane `lane` of p and n), four
+// lights per instruction: each pack with a light set is evaluated whole
+// and the lanes summed at the end. rgb receives the point's r, g, b
+u32 light_point(v128_t px, v128_t py, v128_t pz, const v128_t* n, u32 lane, u64 lights, f32* rgb) {
+  f32 p_arr[3][4], n_arr[3][4];
+  v128_store(p_arr[0], px);
+  v128_store(p_arr[1], py);
+  v128_store(p_arr[2], pz);
+  v128_store(n_arr[0], n[0]);
+  v128_store(n_arr[1], n[1]);
+  v128_store(n_arr[2], n[2]);
+
+  v128_t x = f32x4_splat(p_arr[0][lane]);
+  v128_t y = f32x4_splat(p_arr[1][lane]);
+  v128_t z = f32x4_splat(p_arr[2][lane]);
+  v128_t nx = f32x4_splat(n_arr[0][lane]);
+  v128_t ny = f32x4_splat(n_arr[1][lane]);
+  v128_t nz = f32x4_splat(n_arr[2][lane]);
+
+  v128_t lane_bits = i32x4_make(1, 2, 4, 8);
+  v128_t acc_r = zero_simd;
+  v128_t acc_g = zero_simd;
+  v128_t acc_b = zero_simd;
+  u32 evaluated = 0;
+
+  for (u32 k = 0; lights; k++, lights >>= 4) {
+    u32 nibble = (u32)(lights & 0xF);
+    if (!nibble) continue;
+    const light_pack_t* pack = &light_packs[k];
+
+    v128_t active = i32x4_ne(v128_and(i32x4_splat((i32)nibble), lane_bits), i32x4_splat(0));
+    v128_t factor = point_light_factor(
+      f32x4_sub(pack->x, x), f32x4_sub(pack->y, y), f32x4_sub(pack->z, z),
+      nx, ny, nz, pack->intensity, pack->inv_radius_sq, pack->inv_reach_sq, active);
+    evaluated += (u32)__builtin_popcount(nibble);
+
+    acc_r = f32x4_add(acc_r, f32x4_mul(pack->r, factor));
+    acc_g = f32x4_add(acc_g, f32x4_mul(pack->g, factor));
+    acc_b = f32x4_add(acc_b, f32x4_mul(pack->b, factor));
+  }
+
+  f32 sum[3][4];
+  v128_store(sum[0], acc_r);
+  v128_store(sum[1], acc_g);
+  v128_store(sum[2], acc_b);
+  for (u32 c = 0; c < 3; c++) {
+    rgb[c] = (sum[c][0] + sum[c][1]) + (sum[c][2] + sum[c][3]);
+  }
+  return evaluated;
+}
+
+// Incident light at the hit points of one packet: ambient plus the
+// directional light and the point lights set in `lights`, all from the one
+// normal n. A point light only lights the lanes within its reach, and is
+// skipped when no hit lane is. With a single hit lane, the lights go four
+// at a time through light_point() instead of one light across mostly idle
+// lanes. light receives r, g, b and is meant to be scaled by the surface
+// colour. Returns the lights evaluated.
+u32 light_packet(v128_t px, v128_t py, v128_t pz, v128_t hit, const v128_t* n, u64 lights, v128_t* light) {
+  light_directional(n, light);
+
+  u32 hit_bits = i32x4_bitmask(hit);
+  if (lights && !(hit_bits & (hit_bits - 1))) {
+    f32 rgb[3];
+    u32 lane = (u32)__builtin_ctz(hit_bits);
+    u32 evaluated = light_point(px, py, pz, n, lane, lights, rgb);
+    for (u32 c = 0; c < 3; c++) {
+      light[c] = f32x4_add(light[c], v128_and(f32x4_splat(rgb[c]), hit));
+    }
+    return evaluated;
+  }
+
+  v128_t one = f32x4_splat(1.0f);
+  u32 evaluated = 0;
+
+  for (; lights; lights &= lights - 1) {
+    u32 pl = (u32)__builtin_ctzll(lights);
+    // Lane pl % 4 of each field in pack pl / 4, splatted straight from memory
+    const f32* field = (const f32*)&light_packs[pl / 4] + pl % 4;
+    v128_t lx = f32x4_sub(v128_load32_splat(field + 0 * 4), px);
+    v128_t ly = f32x4_sub(v128_load32_splat(field + 1 * 4), py);
+    v128_t lz = f32x4_sub(v128_load32_splat(field + 2 * 4), pz);
+
+    v128_t dist_sq = f32x4_add(f32x4_add(
+      f32x4_mul(lx, lx), f32x4_mul(ly, ly)), f32x4_mul(lz, lz));
+    v128_t inv_reach_sq = v128_load32_splat(field + 8 * 4);
+    if (!v128_any_true(v128_and(f32x4_lt(f32x4_mul(dist_sq, inv_reach_sq), one), hit))) continue;
+    evaluated++;
+
+    v128_t factor = point_light_factor(lx, ly, lz, n[0], n[1], n[2],
+      v128_load32_splat(field + 6 * 4), v128_load32_splat(field + 7 * 4), inv_reach_sq, hit);
+    light[0] = f32x4_add(light[0], f32x4_mul(v128_load32_splat(field + 3 * 4), factor));
+    light[1] = f32x4_add(light[1], f32x4_mul(v128_load32_splat(field + 4 * 4), factor));
+    light[2] = f32x4_add(light[2], f32x4_mul(v128_load32_splat(field + 5 * 4), factor));
+  }
+
+  return evaluated;
+}
+
+// Ambient plus the directional light for normal n, into light's r, g, b
+void light_directional(const v128_t* n, v128_t* light) {
+  v128_t ndotl = f32x4_add(f32x4_add(
+    f32x4_mul(n[0], light_x_simd),
+    f32x4_mul(n[1], light_y_simd)),
+    f32x4_mul(n[2], light_z_simd));
+  ndotl = f32x4_max(ndotl, zero_simd);
+
+  v128_t brightness = f32x4_add(ambient_simd, f32x4_mul(ndotl, diffuse_simd));
+  light[0] = brightness;
+  light[1] = brightness;
+  light[2] = brightness;
+}
+
+// light_packet() for two packets, each with its own light set: one walk
+// over the union of the sets loads each light's fields once and runs its
+// term for both packets back to back. Each packet adds exactly its own
+// lights in the same order, so the result matches two light_packet()
+// calls; a packet with a single hit lane goes through light_packet() and
+// its four-lights-at-a-time path instead. Returns the lights evaluated.
+u32 light_packet2(const v128_t* px, const v128_t* py, const v128_t* pz, const v128_t* hit, v128_t n[2][3], const u64* lights, v128_t light[2][3]) {
+  for (u32 k = 0; k < 2; k++) {
+    u32 hit_bits = i32x4_bitmask(hit[k]);
+    if (lights[k] && !(hit_bits & (hit_bits - 1))) {
+      return light_packet(px[0], py[0], pz[0], hit[0], n[0], lights[0], light[0]) +
+             light_packet(px[1], py[1], pz[1], hit[1], n[1], lights[1], light[1]);
+    }
+  }
+
+  light_directional(n[0], light[0]);
+  light_directional(n[1], light[1]);
+
+  v128_t one = f32x4_splat(1.0f);
+  u32 evaluated = 0;
+
+  for (u64 both = lights[0] | lights[1]; both; both &= both - 1) {
+    u32 pl = (u32)__builtin_ctzll(both);
+    const f32* field = (const f32*)&light_packs[pl / 4] + pl % 4;
+    v128_t x = v128_load32_splat(field + 0 * 4);
+    v128_t y = v128_load32_splat(field + 1 * 4);
+    v128_t z = v128_load32_splat(field + 2 * 4);
+    v128_t inv_reach_sq = v128_load32_splat(field + 8 * 4);
+
+    v128_t lx[2], ly[2], lz[2];
+    u8 reached[2];
+    for (u32 k = 0; k < 2; k++) {
+      lx[k] = f32x4_sub(x, px[k]);
+      ly[k] = f32x4_sub(y, py[k]);
+      lz[k] = f32x4_sub(z, pz[k]);
+      v128_t dist_sq = f32x4_add(f32x4_add(
+        f32x4_mul(lx[k], lx[k]), f32x4_mul(ly[k], ly[k])), f32x4_mul(lz[k], lz[k]));
+      reached[k] = (lights[k] >> pl & 1) &&
+        v128_any_true(v128_and(f32x4_lt(f32x4_mul(dist_sq, inv_reach_sq), one), hit[k]));
+    }
+    if (!reached[0] && !reached[1]) continue;
+
+    v128_t intensity = v128_load32_splat(field + 6 * 4);
+    v128_t inv_radius_sq = v128_load32_splat(field + 7 * 4);
+    v128_t r = v128_load32_splat(field + 3 * 4);
+    v128_t g = v128_load32_splat(field + 4 * 4);
+    v128_t b = v128_load32_splat(field + 5 * 4);
+    for (u32 k = 0; k < 2; k++) {
+      if (!reached[k]) continue;
+      evaluated++;
+      v128_t factor = point_light_factor(lx[k], ly[k], lz[k], n[k][0], n[k][1], n[k][2],
+        intensity, inv_radius_sq, inv_reach_sq, hit[k]);
+      light[k][0] = f32x4_add(light[k][0], f32x4_mul(r, factor));
+      light[k][1] = f32x4_add(light[k][1], f32x4_mul(g, factor));
+      light[k][2] = f32x4_add(light[k][2], f32x4_mul(b, factor));
+    }
+  }
+
+  return evaluated;
+}
+
+// Lights and writes one packet of four rays; n is the normal from
+// hit_normals() and is only read when some lane hit
+void shade_packet(u32 base, v128_t px, v128_t py, v128_t pz, v128_t hit, const v128_t* n, march_stats_t* stats) {
+  v128_t light[3];
+  if (v128_any_true(hit)) {
+    stats->light_evals += light_packet(px, py, pz, hit, n, packet_lights(base, hit), light);
+  }
+  shade_store(base, hit, light, stats);
+}
+
+// shade_packet() for the packets at base and base + 4, lit together through
+// light_packet2() when both have hits
+void shade_packet2(u32 base, const v128_t* px, const v128_t* py, const v128_t* pz, const v128_t* hit, v128_t n[2][3], march_stats_t* stats) {
+  if (!v128_any_true(hit[0]) || !v128_any_true(hit[1])) {
+    shade_packet(base, px[0], py[0], pz[0], hit[0], n[0], stats);
+    shade_packet(base + 4, px[1], py[1], pz[1], hit[1], n[1], stats);
+    return;
+  }
+
+  u64 lights[2] = {packet_lights(base, hit[0]), packet_lights(base + 4, hit[1])};
+  v128_t light[2][3];
+  stats->light_evals += light_packet2(px, py, pz, hit, n, lights, light);
+  shade_store(base, hit[0], light[0], stats);
+  shade_store(base + 4, hit[1], light[1], stats);
+}
+
+// Writes the colour of one packet: the surface colour scaled by `light`
+// (only read when some lane hit) at hits, the background at misses, plus
+// any glow
+void shade_store(u32 base, v128_t hit, const v128_t* light, march_stats_t* stats) {
+  i32 hit_arr[4];
+  v128_store(hit_arr, hit);
+
+  i32 any_hit = hit_arr[0] | hit_arr[1] | hit_arr[2] | hit_arr[3];
+
+  f32 light_r[4], light_g[4], light_b[4];
+  if (any_hit) {
+    v128_store(light_r, light[0]);
+    v128_store(light_g, light[1]);
+    v128_store(light_b, light[2]);
+  }
+
+  for (int i = 0; i < 4; i++) {
+    u32 idx = base + i;
+    if (idx >= ray_count) break;
+
+    if (hit_arr[i]) {
+      stats->hits++;
+      u32 src = shape_order[ray_shape[idx]];
+      out_r[idx] = light_r[i] * shape_colors[src * 3];
+      out_g[idx] = light_g[i] * shape_colors[src * 3 + 1];
+      out_b[idx] = light_b[i] * shape_colors[src * 3 + 2];
+    } else {
+      stats->misses++;
+      out_r[idx] = bg_color[0];
+      out_g[idx] = bg_color[1];
+      out_b[idx] = bg_color[2];
+    }
+
+    // Emissive glow from the ray's closest approach to a glowing group,
+    // fading to zero at one glow radius
+    if (glow_groups && ray_glow[idx] < 1.0f) {
+      const f32* glow = &group_glow[ray_glow_group[idx] * 4];
+      f32 fade = 1.0f - maxf(ray_glow[idx], 0.0f);
+      fade *= fade;
+      out_r[idx] += glow[0] * fade;
+      out_g[idx] += glow[1] * fade;
+      out_b[idx] += glow[2] * fade;
+    }
+  }
+}
+
+// Shading stage on its own: re-lights the hits left in ray_depth and
+// ray_shape by the last march_rays() without marching again, e.g. after
+// set_lighting() or set_point_lights()
+void shade_frame(void) {
+  march_stats_t stats = {0};
+  u64 start = perf_now();
+  if (!light_tiles_valid) bin_lights();
+  stats.lighting_ns = perf_now() - start;
+
+  shade_rays(0, ray_count, &stats);
+  perf_flush(&stats);
+}
+
+// Frame setup shared by march_rays() and threaded frames: the temporal
+// warm starts and the light tiles. Returns whether the starts are warm.
+u8 march_begin(void) {
+  u8 warm = temporal_reproject();
+  if (!light_tiles_valid) bin_lights();
+  return warm;
+}
+
+// Queues, marches and shades the rays in [first, end); first and end are
+// multiples of 4 (or end is ray_count), so ranges never share a packet
+void march_range(u32 first, u32 end, u8 warm, march_stats_t* stats) {
+  u64 start = perf_now();
+  u32 queued = queue_rays(first, end, warm, &march_queue[first], stats);
+  march_queue_rays(&march_queue[first], queued, stats);
+  stats->march_ns += perf_now() - start;
+  shade_rays(first, end, stats);
+}
+
+void stats_add(march_stats_t* acc, const march_stats_t* stats) {
+  acc->iterations += stats->iterations;
+  acc->lane_steps += stats->lane_steps;
+  acc->warm_rays += stats->warm_rays;
+  acc->warm_steps += stats->warm_steps;
+  acc->cold_rays += stats->cold_rays;
+  acc->cold_steps += stats->cold_steps;
+  acc->tile_skips += stats->tile_skips;
+  acc->hits += stats->hits;
+  acc->misses += stats->misses;
+  acc->normal_passes += stats->normal_passes;
+  acc->light_evals += stats->light_evals;
+  acc->march_ns += stats->march_ns;
+  acc->normals_ns += stats->normals_ns;
+  acc->lighting_ns += stats->lighting_ns;
+  acc->composite_ns += stats->composite_ns;
+}
+
+// Publishes the frame's counters and keeps its camera for reprojection
+void march_end(const march_stats_t* stats) {
+  perf_flush(stats);
+  perf_add(PERF_RAYS, ray_count);
+  perf_add(PERF_MARCHES, 1);
+
+  for (u32 a = 0; a < 3; a++) {
+    prev_cam_eye[a] = cam_eye[a];
+    prev_cam_forward[a] = cam_forward[a];
+    prev_cam_right[a] = cam_right[a];
+    prev_cam_up[a] = cam_up[a];
   }
+  prev_cam_half_width = cam_half_width;
+  prev_cam_half_height = cam_half_height;
+  prev_ray_width = ray_width;
+  prev_ray_height = ray_height;
+  depth_valid = 1;
+  temporal_frame++;
+}
 
-  perf_metrics[PERF_TOTAL_STEPS] = (f32)total_steps_all;
-  perf_metrics[PERF_EARLY_HITS] = (f32)total_hits;
-  perf_metrics[PERF_MISSES] = (f32)total_misses;
-  u32 active_batches = batch_count > 0 ? batch_count : 1;
-  perf_metrics[PERF_AVG_STEPS] = (f32)total_steps_all / (f32)active_batches;
-  perf_metrics[PERF_HIT_RATE] = (ray_count > 0) ? (100.0f * (f32)total_hits / (f32)ray_count) : 0.0f;
+void march_rays(void) {
+  march_stats_t stats = {0};
+  u64 start = perf_now();
+  u8 warm = march_begin();
+  stats.march_ns = perf_now() - start;
+  march_range(0, ray_count, warm, &stats);
+  march_end(&stats);
 }
 
-u32 get_max_rays(void) { return MAX_RAYS; }
+u32 get_max_rays(void) { return ray_capacity; }
 
 u32* get_out_char_ptr(void) { return out_char; }
 f32* get_out_fg_ptr(void) { return out_fg; }
 f32* get_out_bg_ptr(void) { return out_bg; }
 
 void composite(u32 width, u32 height) {
-  u32 count = width * height;
-  if (count > MAX_RAYS) count = MAX_RAYS;
+  u64 start = perf_now();
+  composite_rows(width, 0, height);
+  perf_stage(PERF_STAGE_COMPOSITE, start);
+}
 
-  u32 i = 0;
-  for (u32 row = 0; row < height; row++) {
+// composite() for the rows in [first_row, end_row) only
+void composite_rows(u32 width, u32 first_row, u32 end_row) {
+  u32 i = first_row * width;
+  for (u32 row = first_row; row < end_row; row++) {
     u32 row_bit = (row & 1) * 2;
 
     for (u32 col = 0; col < width; col++, i++) {
-      if (i >= MAX_RAYS) break;
+      if (i >= ray_capacity) break;
 
       f32 r = out_r[i];
       f32 g = out_g[i];
@@ -936,9 +4398,10 @@ void composite(u32 width, u32 height) {
 }
 
 void composite_blocks(u32 width, u32 height) {
+  u64 start = perf_now();
   u32 out_height = height / 2;
   u32 out_count = width * out_height;
-  if (out_count > MAX_RAYS) out_count = MAX_RAYS;
+  if (out_count > ray_capacity) out_count = ray_capacity;
 
   for (u32 out_row = 0; out_row < out_height; out_row++) {
     u32 top_row = out_row * 2;
@@ -947,7 +4410,7 @@ void composite_blocks(u32 width, u32 height) {
 
     for (u32 col = 0; col < width; col++) {
       u32 out_idx = out_row * width + col;
-      if (out_idx >= MAX_RAYS) break;
+      if (out_idx >= ray_capacity) break;
 
       u32 top_idx = top_row * width + col;
       u32 bot_idx = bot_row * width + col;
@@ -1010,15 +4473,20 @@ void composite_blocks(u32 width, u32 height) {
       }
     }
   }
+  perf_stage(PERF_STAGE_COMPOSITE, start);
 }
 
 u32* get_upscaled_char_ptr(void) { return upscaled_char; }
 f32* get_upscaled_fg_ptr(void) { return upscaled_fg; }
-u32 get_max_upscaled(void) { return MAX_RAYS; }
+u32 get_max_upscaled(void) { return upscale_capacity; }
 
 void upscale(u32 native_width, u32 native_height, u32 output_width, u32 output_height, u32 scale) {
+  u64 start = perf_now();
   u32 out_count = output_width * output_height;
-  if (out_count > MAX_RAYS) out_count = MAX_RAYS;
+  // Grows like generate_rays(). The upscale buffers are carved after the
+  // ray buffers, so this frame's out_char and out_fg stay where they are.
+  if (out_count > upscale_capacity) resize_buffers(ray_capacity, out_count);
+  if (out_count > upscale_capacity) out_count = upscale_capacity;
 
   u32 out_idx = 0;
   for (u32 out_row = 0; out_row < output_height; out_row++) {
@@ -1027,7 +4495,7 @@ void upscale(u32 native_width, u32 native_height, u32 output_width, u32 output_h
     u32 native_row_offset = native_row * native_width;
 
     for (u32 out_col = 0; out_col < output_width; out_col++, out_idx++) {
-      if (out_idx >= MAX_RAYS) break;
+      if (out_idx >= upscale_capacity) break;
 
       u32 native_col = out_col / scale;
       if (native_col >= native_width) native_col = native_width - 1;
@@ -1044,4 +4512,142 @@ void upscale(u32 native_width, u32 native_height, u32 output_width, u32 output_h
       upscaled_fg[out_fg_base + 3] = out_fg[native_fg_base + 3];
     }
   }
+  perf_stage(PERF_STAGE_UPSCALE, start);
+}
+
+/////////////
+// THREADS //
+/////////////
+// Threaded builds (build:wasm:threads) share one memory between the main
+// instance and one instance per Bun Worker. begin_frame_work() publishes a
+// frame as bands of TILE_SIZE rows, and every thread, the main one
+// included, claims bands from work_state.next in run_frame_work() and
+// marches, shades and composites them. Bands own disjoint rays and the
+// scene, light and tile arrays are only read during a frame, so the only
+// shared writes are the counters, merged under work_state.lock. Without
+// atomics (the plain build) the same code runs every band on one thread.
+//
+// Each worker needs its own stack and TLS block (near lists, tile cursor,
+// shape counts); set_threads() reserves them at the bottom of the arena and
+// the worker points __stack_pointer and __wasm_init_tls() at them.
+u32 thread_tls_size(void) {
+#if defined(__wasm__) && defined(__wasm_atomics__)
+  return ((u32)__builtin_wasm_tls_size() + ARENA_ALIGN - 1) & ~(u32)(ARENA_ALIGN - 1);
+#else
+  return 0;
+#endif
+}
+
+// Reserves stacks and TLS for `count` threads. The main thread is index 0
+// and keeps the linker's stack and TLS block, so workers are 1..count-1.
+// Moves every buffer above the new stacks and drops the scene, so call it
+// once before the first frame. Returns 0 when memory cannot grow.
+u32 set_threads(u32 count) {
+  u32 old_count = worker_count;
+  u32 old_size = thread_area_size;
+  worker_count = count > 1 ? count - 1 : 0;
+  thread_area_size = THREAD_STACK_SIZE + thread_tls_size();
+  if (relayout_arena(shape_capacity, ray_capacity, tile_capacity, upscale_capacity)) {
+    set_scene(0, smooth_k);
+    return 1;
+  }
+
+  worker_count = old_count;
+  thread_area_size = old_size;
+  carve_buffers(shape_capacity, ray_capacity, tile_capacity, upscale_capacity);
+  return 0;
+}
+
+// Stack pointer for worker `index` (1..count-1); stacks grow down
+u8* get_thread_stack_top(u32 index) {
+  return arena_start() + (index - 1) * thread_area_size + THREAD_STACK_SIZE;
+}
+
+// The TLS block sits right above the worker's stack
+u8* get_thread_tls(u32 index) {
+  return get_thread_stack_top(index);
+}
+
+void thread_init(u32 index) {
+  thread_index = index;
+}
+
+u32* get_work_state_ptr(void) { return &work_state.frame; }
+
+void work_lock(void) {
+  while (__atomic_exchange_n(&work_state.lock, 1, __ATOMIC_ACQUIRE)) {}
+}
+
+void work_unlock(void) {
+  __atomic_store_n(&work_state.lock, 0, __ATOMIC_RELEASE);
+}
+
+// Main thread: sets the frame up as march_rays() does and publishes its
+// bands. Returns the band count `done` has to reach.
+u32 begin_frame_work(u32 composite) {
+  march_stats_t zero = {0};
+  work_stats = zero;
+  work_shapes_evaluated = 0;
+  work_shapes_culled = 0;
+
+  u32 frame = work_state.frame + 1;
+  u32 bands = (ray_height + TILE_SIZE - 1) / TILE_SIZE;
+  u64 start = perf_now();
+  __atomic_store_n(&work_state.warm, march_begin(), __ATOMIC_RELAXED);
+  work_stats.march_ns = perf_now() - start;
+  __atomic_store_n(&work_state.composite, composite, __ATOMIC_RELAXED);
+  __atomic_store_n(&work_state.bands, bands, __ATOMIC_RELAXED);
+  __atomic_store_n(&work_state.done, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&work_state.next, (frame & WORK_BAND_MASK) << WORK_BAND_BITS, __ATOMIC_RELEASE);
+  __atomic_store_n(&work_state.frame, frame, __ATOMIC_SEQ_CST);
+  return bands;
+}
+
+// Any thread: claims and runs bands until none are left. A claim only
+// succeeds while `next` still carries the frame this thread woke up for, so
+// a worker late out of the last frame cannot take a band of the next one
+// from a stale counter.
+void run_frame_work(void) {
+  u32 tag = __atomic_load_n(&work_state.frame, __ATOMIC_ACQUIRE) & WORK_BAND_MASK;
+  for (;;) {
+    u32 claim = __atomic_load_n(&work_state.next, __ATOMIC_ACQUIRE);
+    if ((claim >> WORK_BAND_BITS) != tag) break;
+    u32 band = claim & WORK_BAND_MASK;
+    if (band >= __atomic_load_n(&work_state.bands, __ATOMIC_RELAXED)) break;
+    if (!__atomic_compare_exchange_n(&work_state.next, &claim, claim + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) continue;
+
+    u32 first_row = band * TILE_SIZE;
+    u32 end_row = minu(first_row + TILE_SIZE, ray_height);
+    u32 first = first_row * ray_width;
+    u32 end = minu(end_row * ray_width, ray_count);
+
+    march_stats_t stats = {0};
+    if (first < end) march_range(first, end, (u8)__atomic_load_n(&work_state.warm, __ATOMIC_RELAXED), &stats);
+    if (__atomic_load_n(&work_state.composite, __ATOMIC_RELAXED)) {
+      u64 start = perf_now();
+      composite_rows(ray_width, first_row, end_row);
+      stats.composite_ns = perf_now() - start;
+    }
+
+    // Counted before `done`, so the main thread sees every band's counts
+    work_lock();
+    stats_add(&work_stats, &stats);
+    if (thread_index != 0) {
+      work_shapes_evaluated += perf_shapes_evaluated;
+      work_shapes_culled += perf_shapes_culled;
+      perf_shapes_evaluated = 0;
+      perf_shapes_culled = 0;
+    }
+    work_unlock();
+    __atomic_fetch_add(&work_state.done, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+// Main thread, once `done` reached the band count. The stage times are
+// summed over the bands, so with several threads they are thread time and
+// can add up to more than the frame took.
+void end_frame_work(void) {
+  perf_shapes_evaluated += work_shapes_evaluated;
+  perf_shapes_culled += work_shapes_culled;
+  march_end(&work_stats);
 }
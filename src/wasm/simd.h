@@ -0,0 +1,183 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Thin 4-lane SIMD layer for renderer.c: the subset of wasm_simd128.h it
+// uses, without the wasm_ prefix, so the same source builds as wasm
+// (-msimd128) or as a native library on x86 (-msse4.1 or -mavx2).
+//
+// With -mavx2 there is also an 8-lane float type, v256_t, with the f32x8_*
+// ops the SDF kernels need. SIMD_F32X8 is 1 when it exists; renderer.c then
+// evaluates the two packets of the dual-packet path as one 8-lane packet.
+//
+// Masks are lane-wide (all ones or all zeros), as the compares produce them;
+// v128_bitselect() relies on that on x86. Also on x86, f32x4_min/max return
+// the second operand when either is NaN, where wasm returns NaN.
+
+#define SIMD_BACKEND_WASM  0
+#define SIMD_BACKEND_SSE41 1
+#define SIMD_BACKEND_AVX2  2
+
+#if defined(__wasm_simd128__)
+
+#include <wasm_simd128.h>
+
+#define SIMD_BACKEND SIMD_BACKEND_WASM
+
+#define f32x4_splat               wasm_f32x4_splat
+#define f32x4_const               wasm_f32x4_const
+#define f32x4_extract_lane        wasm_f32x4_extract_lane
+#define f32x4_add                 wasm_f32x4_add
+#define f32x4_sub                 wasm_f32x4_sub
+#define f32x4_mul                 wasm_f32x4_mul
+#define f32x4_div                 wasm_f32x4_div
+#define f32x4_sqrt                wasm_f32x4_sqrt
+#define f32x4_min                 wasm_f32x4_min
+#define f32x4_max                 wasm_f32x4_max
+#define f32x4_abs                 wasm_f32x4_abs
+#define f32x4_neg                 wasm_f32x4_neg
+#define f32x4_lt                  wasm_f32x4_lt
+#define f32x4_gt                  wasm_f32x4_gt
+#define f32x4_le                  wasm_f32x4_le
+#define f32x4_ge                  wasm_f32x4_ge
+#define f32x4_eq                  wasm_f32x4_eq
+#define f32x4_convert_i32x4       wasm_f32x4_convert_i32x4
+#define i32x4_splat               wasm_i32x4_splat
+#define i32x4_make                wasm_i32x4_make
+#define i32x4_add                 wasm_i32x4_add
+#define i32x4_sub                 wasm_i32x4_sub
+#define i32x4_mul                 wasm_i32x4_mul
+#define i32x4_min                 wasm_i32x4_min
+#define i32x4_max                 wasm_i32x4_max
+#define i32x4_gt                  wasm_i32x4_gt
+#define i32x4_ge                  wasm_i32x4_ge
+#define i32x4_ne                  wasm_i32x4_ne
+#define i32x4_trunc_sat_f32x4     wasm_i32x4_trunc_sat_f32x4
+#define i32x4_all_true            wasm_i32x4_all_true
+#define i32x4_bitmask             wasm_i32x4_bitmask
+#define v128_and                  wasm_v128_and
+#define v128_or                   wasm_v128_or
+#define v128_not                  wasm_v128_not
+#define v128_andnot               wasm_v128_andnot
+#define v128_bitselect            wasm_v128_bitselect
+#define v128_any_true             wasm_v128_any_true
+#define v128_load                 wasm_v128_load
+#define v128_store                wasm_v128_store
+#define v128_load32_splat         wasm_v128_load32_splat
+
+#elif defined(__SSE4_1__)
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#define SIMD_BACKEND SIMD_BACKEND_AVX2
+#define SIMD_F32X8 1
+#else
+#include <smmintrin.h>
+#define SIMD_BACKEND SIMD_BACKEND_SSE41
+#endif
+
+typedef __m128i v128_t;
+
+#define SIMD_INLINE static inline __attribute__((always_inline))
+#define SIMD_PS(v) _mm_castsi128_ps(v)
+#define SIMD_SI(v) _mm_castps_si128(v)
+
+///////////////
+// F32 LANES //
+///////////////
+SIMD_INLINE v128_t f32x4_splat(float x) { return SIMD_SI(_mm_set1_ps(x)); }
+#define f32x4_const(a, b, c, d) ((v128_t)(__m128){a, b, c, d})
+#define f32x4_extract_lane(v, i) _mm_cvtss_f32(_mm_shuffle_ps(SIMD_PS(v), SIMD_PS(v), _MM_SHUFFLE(i, i, i, i)))
+
+SIMD_INLINE v128_t f32x4_add(v128_t a, v128_t b) { return SIMD_SI(_mm_add_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_sub(v128_t a, v128_t b) { return SIMD_SI(_mm_sub_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_mul(v128_t a, v128_t b) { return SIMD_SI(_mm_mul_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_div(v128_t a, v128_t b) { return SIMD_SI(_mm_div_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_sqrt(v128_t a) { return SIMD_SI(_mm_sqrt_ps(SIMD_PS(a))); }
+SIMD_INLINE v128_t f32x4_min(v128_t a, v128_t b) { return SIMD_SI(_mm_min_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_max(v128_t a, v128_t b) { return SIMD_SI(_mm_max_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_abs(v128_t a) { return SIMD_SI(_mm_andnot_ps(_mm_set1_ps(-0.0f), SIMD_PS(a))); }
+SIMD_INLINE v128_t f32x4_neg(v128_t a) { return SIMD_SI(_mm_xor_ps(_mm_set1_ps(-0.0f), SIMD_PS(a))); }
+
+SIMD_INLINE v128_t f32x4_lt(v128_t a, v128_t b) { return SIMD_SI(_mm_cmplt_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_gt(v128_t a, v128_t b) { return SIMD_SI(_mm_cmpgt_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_le(v128_t a, v128_t b) { return SIMD_SI(_mm_cmple_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_ge(v128_t a, v128_t b) { return SIMD_SI(_mm_cmpge_ps(SIMD_PS(a), SIMD_PS(b))); }
+SIMD_INLINE v128_t f32x4_eq(v128_t a, v128_t b) { return SIMD_SI(_mm_cmpeq_ps(SIMD_PS(a), SIMD_PS(b))); }
+
+SIMD_INLINE v128_t f32x4_convert_i32x4(v128_t a) { return SIMD_SI(_mm_cvtepi32_ps(a)); }
+
+///////////////
+// I32 LANES //
+///////////////
+SIMD_INLINE v128_t i32x4_splat(int x) { return _mm_set1_epi32(x); }
+SIMD_INLINE v128_t i32x4_make(int a, int b, int c, int d) { return _mm_setr_epi32(a, b, c, d); }
+SIMD_INLINE v128_t i32x4_add(v128_t a, v128_t b) { return _mm_add_epi32(a, b); }
+SIMD_INLINE v128_t i32x4_sub(v128_t a, v128_t b) { return _mm_sub_epi32(a, b); }
+SIMD_INLINE v128_t i32x4_mul(v128_t a, v128_t b) { return _mm_mullo_epi32(a, b); }
+SIMD_INLINE v128_t i32x4_min(v128_t a, v128_t b) { return _mm_min_epi32(a, b); }
+SIMD_INLINE v128_t i32x4_max(v128_t a, v128_t b) { return _mm_max_epi32(a, b); }
+SIMD_INLINE v128_t i32x4_gt(v128_t a, v128_t b) { return _mm_cmpgt_epi32(a, b); }
+SIMD_INLINE v128_t i32x4_ge(v128_t a, v128_t b) { return _mm_or_si128(_mm_cmpgt_epi32(a, b), _mm_cmpeq_epi32(a, b)); }
+SIMD_INLINE v128_t i32x4_ne(v128_t a, v128_t b) { return _mm_xor_si128(_mm_cmpeq_epi32(a, b), _mm_set1_epi32(-1)); }
+
+// cvttps gives INT_MIN for NaN and overflow; wasm saturates and maps NaN to 0
+SIMD_INLINE v128_t i32x4_trunc_sat_f32x4(v128_t a) {
+  __m128 f = SIMD_PS(a);
+  v128_t r = _mm_cvttps_epi32(f);
+  r = _mm_blendv_epi8(r, _mm_set1_epi32(0x7fffffff), SIMD_SI(_mm_cmpge_ps(f, _mm_set1_ps(2147483648.0f))));
+  return _mm_and_si128(r, SIMD_SI(_mm_cmpord_ps(f, f)));
+}
+
+SIMD_INLINE int i32x4_all_true(v128_t a) { return _mm_movemask_ps(SIMD_PS(_mm_cmpeq_epi32(a, _mm_setzero_si128()))) == 0; }
+SIMD_INLINE unsigned int i32x4_bitmask(v128_t a) { return (unsigned int)_mm_movemask_ps(SIMD_PS(a)); }
+
+//////////
+// BITS //
+//////////
+SIMD_INLINE v128_t v128_and(v128_t a, v128_t b) { return _mm_and_si128(a, b); }
+SIMD_INLINE v128_t v128_or(v128_t a, v128_t b) { return _mm_or_si128(a, b); }
+SIMD_INLINE v128_t v128_not(v128_t a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+SIMD_INLINE v128_t v128_andnot(v128_t a, v128_t b) { return _mm_andnot_si128(b, a); }
+SIMD_INLINE v128_t v128_bitselect(v128_t a, v128_t b, v128_t mask) { return _mm_blendv_epi8(b, a, mask); }
+SIMD_INLINE int v128_any_true(v128_t a) { return !_mm_testz_si128(a, a); }
+
+////////////
+// MEMORY //
+////////////
+SIMD_INLINE v128_t v128_load(const void* p) { return _mm_loadu_si128((const __m128i*)p); }
+SIMD_INLINE void v128_store(void* p, v128_t v) { _mm_storeu_si128((__m128i*)p, v); }
+
+SIMD_INLINE v128_t v128_load32_splat(const void* p) { return SIMD_SI(_mm_load1_ps((const float*)p)); }
+
+#ifdef __AVX2__
+//////////////////
+// F32 LANES x8 //
+//////////////////
+// Two 4-lane packets side by side: the low half is the first packet. Only
+// the float ops the SDF kernels use, with the same semantics as f32x4_*.
+typedef __m256 v256_t;
+
+SIMD_INLINE v256_t f32x8_join(v128_t lo, v128_t hi) { return _mm256_set_m128(SIMD_PS(hi), SIMD_PS(lo)); }
+SIMD_INLINE v256_t f32x8_dup(v128_t a) { return _mm256_set_m128(SIMD_PS(a), SIMD_PS(a)); }
+SIMD_INLINE v128_t f32x8_lo(v256_t a) { return SIMD_SI(_mm256_castps256_ps128(a)); }
+SIMD_INLINE v128_t f32x8_hi(v256_t a) { return SIMD_SI(_mm256_extractf128_ps(a, 1)); }
+
+SIMD_INLINE v256_t f32x8_splat(float x) { return _mm256_set1_ps(x); }
+SIMD_INLINE v256_t f32x8_add(v256_t a, v256_t b) { return _mm256_add_ps(a, b); }
+SIMD_INLINE v256_t f32x8_sub(v256_t a, v256_t b) { return _mm256_sub_ps(a, b); }
+SIMD_INLINE v256_t f32x8_mul(v256_t a, v256_t b) { return _mm256_mul_ps(a, b); }
+SIMD_INLINE v256_t f32x8_div(v256_t a, v256_t b) { return _mm256_div_ps(a, b); }
+SIMD_INLINE v256_t f32x8_sqrt(v256_t a) { return _mm256_sqrt_ps(a); }
+SIMD_INLINE v256_t f32x8_min(v256_t a, v256_t b) { return _mm256_min_ps(a, b); }
+SIMD_INLINE v256_t f32x8_max(v256_t a, v256_t b) { return _mm256_max_ps(a, b); }
+SIMD_INLINE v256_t f32x8_abs(v256_t a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+SIMD_INLINE v256_t f32x8_lt(v256_t a, v256_t b) { return _mm256_cmp_ps(a, b, _CMP_LT_OS); }
+SIMD_INLINE v256_t f32x8_gt(v256_t a, v256_t b) { return _mm256_cmp_ps(a, b, _CMP_GT_OS); }
+SIMD_INLINE v256_t f32x8_bitselect(v256_t a, v256_t b, v256_t mask) { return _mm256_blendv_ps(b, a, mask); }
+#endif
+
+#else
+#error "simd.h needs wasm simd128 (-msimd128) or x86 SSE4.1 (-msse4.1, -mavx2)"
+#endif
+
+#endif
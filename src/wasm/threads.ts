@@ -0,0 +1,76 @@
+/**
+ * Threaded WASM renderer - the threads build (build:wasm:threads) on one
+ * shared memory, with a Bun Worker per extra thread marching bands of tile
+ * rows alongside the main thread.
+ */
+
+import { readFileSync } from "fs";
+import { createRenderer, syncViews, rendererImports, type WasmExports, type WasmRenderer } from "./index";
+
+// Must match --initial-memory and --max-memory in build:wasm:threads
+const INITIAL_PAGES = 512;
+const MAX_PAGES = 4096;
+
+// Int32 offsets into work_state_t (renderer.c)
+export const WORK_STATE_WORDS = 8;
+export const WORK_FRAME = 0;
+export const WORK_DONE = 2;
+
+export interface WorkerInit {
+  module: WebAssembly.Module;
+  memory: WebAssembly.Memory;
+  index: number;
+}
+
+export interface ThreadedRenderer extends WasmRenderer {
+  workers: Worker[];
+  workState: Int32Array;
+}
+
+// Loads the threads build and starts `threads - 1` workers from
+// `workerPath` (worker.ts, or worker.js once bundled)
+export async function loadWasmThreaded(wasmPath: string, workerPath: string, threads: number): Promise<ThreadedRenderer> {
+  const module = await WebAssembly.compile(readFileSync(wasmPath));
+  const memory = new WebAssembly.Memory({ initial: INITIAL_PAGES, maximum: MAX_PAGES, shared: true });
+  const instance = await WebAssembly.instantiate(module, { env: { memory, ...rendererImports } });
+  const exports = instance.exports as unknown as WasmExports;
+  if (!exports.set_threads(threads)) {
+    throw new Error(`Cannot reserve stacks for ${threads} render threads`);
+  }
+
+  const workers = await Promise.all(
+    Array.from({ length: threads - 1 }, (_, i) => startWorker(workerPath, { module, memory, index: i + 1 }))
+  );
+  const workState = new Int32Array(memory.buffer, exports.get_work_state_ptr(), WORK_STATE_WORDS);
+  return { ...createRenderer(exports), workers, workState };
+}
+
+function startWorker(workerPath: string, init: WorkerInit): Promise<Worker> {
+  return new Promise((resolve, reject) => {
+    const worker = new Worker(workerPath);
+    worker.onmessage = () => resolve(worker);
+    worker.onerror = (event) => reject(event.error ?? new Error(event.message));
+    worker.postMessage(init);
+  });
+}
+
+// Threaded march_rays() (and composite() of the same grid when `composite`
+// is set): wakes the workers, runs bands on this thread too, then blocks
+// until every band is done
+export function marchFrame(wasm: ThreadedRenderer, composite: boolean): void {
+  const { exports, workState } = wasm;
+  const bands = exports.begin_frame_work(composite ? 1 : 0);
+  Atomics.notify(workState, WORK_FRAME);
+  exports.run_frame_work();
+
+  for (let done = Atomics.load(workState, WORK_DONE); done < bands; done = Atomics.load(workState, WORK_DONE)) {
+    Atomics.wait(workState, WORK_DONE, done);
+  }
+  exports.end_frame_work();
+  syncViews(wasm);
+}
+
+export function stopWorkers(wasm: ThreadedRenderer): void {
+  for (const worker of wasm.workers) worker.terminate();
+  wasm.workers = [];
+}
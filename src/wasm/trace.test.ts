@@ -0,0 +1,147 @@
+/**
+ * Tests for the scene trace format: what TraceRecorder writes, readTrace()
+ * must read back field for field.
+ */
+
+import { describe, test, expect, afterEach } from "bun:test";
+import { mkdtempSync, rmSync, statSync, truncateSync } from "fs";
+import { tmpdir } from "os";
+import { join } from "path";
+import type { FlatScene } from "../scene";
+import type { WasmRenderer } from "./index";
+import { TraceRecorder, readTrace, LIGHT_FLOATS, type TraceFrame } from "./trace";
+
+// =============================================================================
+// Test Harness
+// =============================================================================
+
+const MAX_LIGHTS = 8;
+
+// record() only reads the point light arrays, so a renderer stand-in with
+// just those is enough
+function createLightArrays() {
+  return {
+    pointLightX: new Float32Array(MAX_LIGHTS),
+    pointLightY: new Float32Array(MAX_LIGHTS),
+    pointLightZ: new Float32Array(MAX_LIGHTS),
+    pointLightR: new Float32Array(MAX_LIGHTS),
+    pointLightG: new Float32Array(MAX_LIGHTS),
+    pointLightB: new Float32Array(MAX_LIGHTS),
+    pointLightIntensity: new Float32Array(MAX_LIGHTS),
+    pointLightRadius: new Float32Array(MAX_LIGHTS),
+  };
+}
+
+// Distinct values everywhere, so a field read from the wrong offset shows up
+function ramp(length: number, base: number): Float32Array {
+  return Float32Array.from({ length }, (_, i) => base + i * 0.25);
+}
+
+function bytes(length: number, base: number): Uint8Array {
+  return Uint8Array.from({ length }, (_, i) => (base + i) & 0xff);
+}
+
+function createScene(count: number, groupCount: number, base: number): FlatScene {
+  return {
+    types: bytes(count, base),
+    params: ramp(count * 4, base + 100),
+    positions: ramp(count * 3, base + 200),
+    colors: ramp(count * 3, base + 300),
+    groups: bytes(count, base + 40),
+    groupBlendModes: bytes(groupCount, base + 80),
+    groupGlow: ramp(groupCount * 4, base + 400),
+    count,
+    groupCount,
+    smoothK: 0.125 + base,
+  };
+}
+
+function createFrame(lightCount: number, count: number, groupCount: number, base: number): TraceFrame {
+  return {
+    time: 1.5 + base,
+    width: 80 + base,
+    height: 24 + base,
+    camera: ramp(14, base + 500),
+    lighting: ramp(5, base + 600),
+    lights: ramp(lightCount * LIGHT_FLOATS, base + 700),
+    scene: createScene(count, groupCount, base),
+  };
+}
+
+// Loads a frame's lights into the arrays the recorder reads them from
+function setLights(wasm: ReturnType<typeof createLightArrays>, frame: TraceFrame): void {
+  const arrays = [
+    wasm.pointLightX, wasm.pointLightY, wasm.pointLightZ,
+    wasm.pointLightR, wasm.pointLightG, wasm.pointLightB,
+    wasm.pointLightIntensity, wasm.pointLightRadius,
+  ];
+  const count = frame.lights.length / LIGHT_FLOATS;
+  for (let i = 0; i < count; i++) {
+    for (let k = 0; k < LIGHT_FLOATS; k++) arrays[k]![i] = frame.lights[i * LIGHT_FLOATS + k]!;
+  }
+}
+
+function writeTrace(path: string, frames: TraceFrame[]): void {
+  const wasm = createLightArrays();
+  const recorder = new TraceRecorder(path);
+  for (const frame of frames) {
+    setLights(wasm, frame);
+    const { lights, ...rest } = frame;
+    recorder.record(wasm as unknown as WasmRenderer, rest, lights.length / LIGHT_FLOATS);
+  }
+  recorder.close();
+}
+
+let dir = "";
+
+function tracePath(): string {
+  dir = mkdtempSync(join(tmpdir(), "trace-test-"));
+  return join(dir, "frames.trace");
+}
+
+afterEach(() => {
+  if (dir) rmSync(dir, { recursive: true, force: true });
+  dir = "";
+});
+
+// =============================================================================
+// Tests
+// =============================================================================
+
+describe("trace round trip", () => {
+  test("reads back every field of frames with different counts", () => {
+    const path = tracePath();
+    // Odd shape and group counts leave the u8 tail unaligned, so the
+    // padding to 4 bytes is exercised too
+    const frames = [createFrame(3, 5, 2, 0), createFrame(1, 2, 3, 10)];
+    writeTrace(path, frames);
+
+    const read = readTrace(path);
+    expect(read).toEqual(frames);
+  });
+
+  test("handles frames without lights, shapes or groups", () => {
+    const path = tracePath();
+    const frames = [createFrame(0, 0, 0, 0), createFrame(2, 1, 1, 5)];
+    writeTrace(path, frames);
+
+    expect(readTrace(path)).toEqual(frames);
+  });
+
+  test("drops a truncated last frame", () => {
+    const path = tracePath();
+    const frames = [createFrame(3, 5, 2, 0), createFrame(1, 2, 3, 10), createFrame(2, 4, 1, 20)];
+    writeTrace(path, frames);
+    truncateSync(path, statSync(path).size - 4);
+
+    expect(readTrace(path)).toEqual(frames.slice(0, 2));
+  });
+
+  test("rejects files that are not traces", () => {
+    const path = tracePath();
+    writeTrace(path, []);
+    truncateSync(path, 4);
+
+    expect(() => readTrace(path)).toThrow("not a scene trace");
+  });
+});
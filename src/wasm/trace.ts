@@ -0,0 +1,193 @@
+/**
+ * Scene traces - the per-frame renderer inputs (FlatScene, camera basis,
+ * lighting, point lights) recorded into a binary file, and replayed straight
+ * into the exports. Recorded runs of main.ts (RECORD_TRACE=path) make
+ * reproducible perf runs of the real scene; `bun run bench --trace path`
+ * replays one.
+ *
+ * Layout, little-endian: a header of magic and version (u32 each), then one
+ * record per frame:
+ *   u32 byte length of the rest of the record
+ *   f32 time, u32 width, u32 height
+ *   f32 camera[14]   set_camera() arguments
+ *   f32 lighting[5]  set_lighting() arguments
+ *   u32 light count, f32 smooth k, u32 shape count, u32 group count
+ *   f32 lights[lights * 8], params[shapes * 4], positions[shapes * 3],
+ *       colors[shapes * 3], group glow[groups * 4]
+ *   u8 types[shapes], groups[shapes], group blend modes[groups], padded to 4
+ */
+
+import { closeSync, openSync, readFileSync, writeSync } from "fs";
+import type { FlatScene } from "../scene";
+import { loadScene, generateRays, binTiles, setCameraBasis, type WasmRenderer } from "./index";
+
+const TRACE_MAGIC = 0x52545053; // "SPTR"
+const TRACE_VERSION = 1;
+const HEADER_BYTES = 8;
+const FRAME_FIXED_WORDS = 3 + 14 + 5 + 4;
+export const LIGHT_FLOATS = 8; // x, y, z, r, g, b, intensity, radius
+
+export interface TraceFrame {
+  time: number;            // compute_background() time
+  width: number;           // ray grid
+  height: number;
+  camera: Float32Array;    // eye, forward, right, up, half width, half height
+  lighting: Float32Array;  // ambient, direction xyz, intensity
+  lights: Float32Array;    // LIGHT_FLOATS per point light
+  scene: FlatScene;
+}
+
+function frameBytes(lights: number, shapes: number, groups: number): number {
+  const floats = FRAME_FIXED_WORDS + lights * LIGHT_FLOATS + shapes * 10 + groups * 4;
+  return (floats * 4 + shapes * 2 + groups + 3) & ~3;
+}
+
+// =============================================================================
+// Recording
+// =============================================================================
+
+export class TraceRecorder {
+  private fd: number;
+
+  constructor(path: string) {
+    this.fd = openSync(path, "w");
+    const header = new Uint32Array([TRACE_MAGIC, TRACE_VERSION]);
+    writeSync(this.fd, new Uint8Array(header.buffer));
+  }
+
+  // Appends a frame; the point lights are read back from the renderer's
+  // arrays, so call it after they were set
+  record(wasm: WasmRenderer, frame: Omit<TraceFrame, "lights">, lightCount: number): void {
+    const { scene } = frame;
+    const bytes = frameBytes(lightCount, scene.count, scene.groupCount);
+    const buffer = new ArrayBuffer(4 + bytes);
+    new Uint32Array(buffer, 0, 1)[0] = bytes;
+    // Views of the record after its length word, so the word offsets here
+    // are the ones readTrace() and render.c use
+    const f32 = new Float32Array(buffer, 4, bytes >> 2);
+    const u32 = new Uint32Array(buffer, 4, bytes >> 2);
+
+    f32[0] = frame.time;
+    u32[1] = frame.width;
+    u32[2] = frame.height;
+    f32.set(frame.camera, 3);
+    f32.set(frame.lighting, 17);
+    u32[22] = lightCount;
+    f32[23] = scene.smoothK;
+    u32[24] = scene.count;
+    u32[25] = scene.groupCount;
+
+    let word = FRAME_FIXED_WORDS;
+    const lightArrays = [
+      wasm.pointLightX, wasm.pointLightY, wasm.pointLightZ,
+      wasm.pointLightR, wasm.pointLightG, wasm.pointLightB,
+      wasm.pointLightIntensity, wasm.pointLightRadius,
+    ];
+    for (let i = 0; i < lightCount; i++) {
+      for (const array of lightArrays) f32[word++] = array[i]!;
+    }
+    for (const array of [scene.params, scene.positions, scene.colors, scene.groupGlow]) {
+      f32.set(array, word);
+      word += array.length;
+    }
+
+    let byte = 4 + word * 4;
+    for (const array of [scene.types, scene.groups, scene.groupBlendModes]) {
+      new Uint8Array(buffer, byte, array.length).set(array);
+      byte += array.length;
+    }
+    writeSync(this.fd, new Uint8Array(buffer));
+  }
+
+  close(): void {
+    closeSync(this.fd);
+  }
+}
+
+// =============================================================================
+// Replay
+// =============================================================================
+
+export function readTrace(path: string): TraceFrame[] {
+  const file = readFileSync(path);
+  const data = file.buffer.slice(file.byteOffset, file.byteOffset + file.byteLength);
+  const header = data.byteLength >= HEADER_BYTES ? new Uint32Array(data, 0, 2) : null;
+  if (!header || header[0] !== TRACE_MAGIC) {
+    throw new Error(`${path} is not a scene trace`);
+  }
+  if (header[1] !== TRACE_VERSION) {
+    throw new Error(`${path} is trace version ${header[1]}, expected ${TRACE_VERSION}`);
+  }
+
+  const frames: TraceFrame[] = [];
+  let offset = HEADER_BYTES;
+  while (offset + 4 <= data.byteLength) {
+    const bytes = new Uint32Array(data, offset, 1)[0]!;
+    if (offset + 4 + bytes > data.byteLength) break; // truncated last frame
+    const f32 = new Float32Array(data, offset + 4, bytes >> 2);
+    const u32 = new Uint32Array(data, offset + 4, bytes >> 2);
+
+    const lights = u32[22]!;
+    const count = u32[24]!;
+    const groupCount = u32[25]!;
+    let word = FRAME_FIXED_WORDS;
+    const floats = (length: number) => {
+      const array = f32.slice(word, word + length);
+      word += length;
+      return array;
+    };
+    const lightData = floats(lights * LIGHT_FLOATS);
+    const params = floats(count * 4);
+    const positions = floats(count * 3);
+    const colors = floats(count * 3);
+    const groupGlow = floats(groupCount * 4);
+
+    let byte = offset + 4 + word * 4;
+    const bytesOf = (length: number) => {
+      const array = new Uint8Array(data.slice(byte, byte + length));
+      byte += length;
+      return array;
+    };
+    const types = bytesOf(count);
+    const groups = bytesOf(count);
+    const groupBlendModes = bytesOf(groupCount);
+
+    frames.push({
+      time: f32[0]!,
+      width: u32[1]!,
+      height: u32[2]!,
+      camera: f32.slice(3, 17),
+      lighting: f32.slice(17, 22),
+      lights: lightData,
+      scene: { types, params, positions, colors, groups, groupBlendModes, groupGlow, count, groupCount, smoothK: f32[23]! },
+    });
+    offset += 4 + bytes;
+  }
+  return frames;
+}
+
+// Uploads a recorded frame and runs the stages main.ts runs before
+// march_rays(): background, scene, camera, rays, tiles, cones, lighting
+export function applyTraceFrame(wasm: WasmRenderer, frame: TraceFrame): void {
+  const { exports } = wasm;
+  exports.compute_background(frame.time);
+  loadScene(wasm, frame.scene);
+  setCameraBasis(wasm, frame.camera);
+  generateRays(wasm, frame.width, frame.height);
+  binTiles(wasm);
+  exports.cone_march();
+
+  const [ambient, dx, dy, dz, intensity] = frame.lighting;
+  exports.set_lighting(ambient!, dx!, dy!, dz!, intensity!);
+
+  const lightArrays = [
+    wasm.pointLightX, wasm.pointLightY, wasm.pointLightZ,
+    wasm.pointLightR, wasm.pointLightG, wasm.pointLightB,
+    wasm.pointLightIntensity, wasm.pointLightRadius,
+  ];
+  const lights = Math.min(frame.lights.length / LIGHT_FLOATS, wasm.maxPointLights);
+  for (let i = 0; i < lights; i++) {
+    for (let k = 0; k < LIGHT_FLOATS; k++) lightArrays[k]![i] = frame.lights[i * LIGHT_FLOATS + k]!;
+  }
+  exports.set_point_lights(lights);
+}
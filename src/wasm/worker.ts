@@ -0,0 +1,32 @@
+/**
+ * Render worker - one instance of the threads build on the main thread's
+ * shared memory, running bands of every frame marchFrame() publishes.
+ */
+
+import { rendererImports, type WasmExports } from "./index";
+import { WORK_STATE_WORDS, WORK_FRAME, WORK_DONE, type WorkerInit } from "./threads";
+
+declare var self: Worker;
+
+self.onmessage = async (event: MessageEvent<WorkerInit>) => {
+  const { module, memory, index } = event.data;
+  const instance = await WebAssembly.instantiate(module, { env: { memory, ...rendererImports } });
+  const exports = instance.exports as unknown as WasmExports;
+
+  // The instance starts on the main thread's stack and TLS block; move it
+  // to its own before any other call
+  exports.__stack_pointer!.value = exports.get_thread_stack_top(index);
+  exports.__wasm_init_tls!(exports.get_thread_tls(index));
+  exports.thread_init(index);
+
+  const workState = new Int32Array(memory.buffer, exports.get_work_state_ptr(), WORK_STATE_WORDS);
+  let frame = Atomics.load(workState, WORK_FRAME);
+  postMessage("ready");
+
+  for (;;) {
+    Atomics.wait(workState, WORK_FRAME, frame);
+    frame = Atomics.load(workState, WORK_FRAME);
+    exports.run_frame_work();
+    Atomics.notify(workState, WORK_DONE);
+  }
+};